@@ -0,0 +1,322 @@
+#pragma once
+#include "common.h"
+#include "span.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__GNUC__)
+#define ZLUA_RESTRICT __restrict__
+#else
+#define ZLUA_RESTRICT
+#endif
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// kernel
+// bulk loops over raw pointers, written so that the compiler vectorizes them:
+//   no aliasing (restrict), no branches in the loop body,
+//   reductions split into independent lanes to break the dependency chain
+////////////////////////////////////////////////////////////////////////////////
+namespace kernel
+{
+const static size_t lanes = 8;
+
+template <typename T>
+void fill(T *ZLUA_RESTRICT dst, size_t n, T v)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = v;
+}
+
+template <typename T>
+void add(T *ZLUA_RESTRICT dst, const T *ZLUA_RESTRICT src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] += src[i];
+}
+
+template <typename T>
+void mul(T *ZLUA_RESTRICT dst, const T *ZLUA_RESTRICT src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] *= src[i];
+}
+
+// dst = a * x + dst
+template <typename T>
+void axpy(T *ZLUA_RESTRICT dst, T a, const T *ZLUA_RESTRICT x, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] += a * x[i];
+}
+
+template <typename T>
+void clamp(T *ZLUA_RESTRICT dst, size_t n, T lo, T hi)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        T v = dst[i] < lo ? lo : dst[i];
+        dst[i] = v > hi ? hi : v;
+    }
+}
+
+template <typename T, typename Acc>
+Acc sum(const T *ZLUA_RESTRICT src, size_t n)
+{
+    Acc acc[lanes] = {};
+    size_t i = 0;
+    for (; i + lanes <= n; i += lanes)
+        for (size_t k = 0; k < lanes; ++k)
+            acc[k] += src[i + k];
+
+    Acc ret = 0;
+    for (size_t k = 0; k < lanes; ++k)
+        ret += acc[k];
+    for (; i < n; ++i)
+        ret += src[i];
+
+    return ret;
+}
+
+template <typename T, typename Acc>
+Acc dot(const T *ZLUA_RESTRICT a, const T *ZLUA_RESTRICT b, size_t n)
+{
+    Acc acc[lanes] = {};
+    size_t i = 0;
+    for (; i + lanes <= n; i += lanes)
+        for (size_t k = 0; k < lanes; ++k)
+            acc[k] += static_cast<Acc>(a[i + k]) * b[i + k];
+
+    Acc ret = 0;
+    for (size_t k = 0; k < lanes; ++k)
+        ret += acc[k];
+    for (; i < n; ++i)
+        ret += static_cast<Acc>(a[i]) * b[i];
+
+    return ret;
+}
+
+// n must be > 0
+template <typename T>
+T min(const T *ZLUA_RESTRICT src, size_t n)
+{
+    T acc[lanes];
+    for (size_t k = 0; k < lanes; ++k)
+        acc[k] = src[0];
+
+    size_t i = 0;
+    for (; i + lanes <= n; i += lanes)
+        for (size_t k = 0; k < lanes; ++k)
+            acc[k] = src[i + k] < acc[k] ? src[i + k] : acc[k];
+
+    T ret = acc[0];
+    for (size_t k = 1; k < lanes; ++k)
+        ret = acc[k] < ret ? acc[k] : ret;
+    for (; i < n; ++i)
+        ret = src[i] < ret ? src[i] : ret;
+
+    return ret;
+}
+
+// n must be > 0
+template <typename T>
+T max(const T *ZLUA_RESTRICT src, size_t n)
+{
+    T acc[lanes];
+    for (size_t k = 0; k < lanes; ++k)
+        acc[k] = src[0];
+
+    size_t i = 0;
+    for (; i + lanes <= n; i += lanes)
+        for (size_t k = 0; k < lanes; ++k)
+            acc[k] = src[i + k] > acc[k] ? src[i + k] : acc[k];
+
+    T ret = acc[0];
+    for (size_t k = 1; k < lanes; ++k)
+        ret = acc[k] > ret ? acc[k] : ret;
+    for (; i < n; ++i)
+        ret = src[i] > ret ? src[i] : ret;
+
+    return ret;
+}
+
+// indices are validated by caller
+template <typename T, typename I>
+void gather(T *ZLUA_RESTRICT dst, const T *ZLUA_RESTRICT src, const I *ZLUA_RESTRICT idx, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = src[idx[i]];
+}
+
+template <typename T, typename I>
+void scatter(T *ZLUA_RESTRICT dst, const T *ZLUA_RESTRICT src, const I *ZLUA_RESTRICT idx, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[idx[i]] = src[i];
+}
+} // namespace kernel
+
+////////////////////////////////////////////////////////////////////////////////
+// array
+// typed contiguous numeric array, operated in bulk from lua
+// registered as array.int32, array.int64, array.float and array.double
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class array
+{
+    static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, char>::value,
+                  "array only holds numeric types");
+
+public:
+    using value_type = T;
+    using index_type = int32_t;
+    // integer sums are widened to avoid overflowing int32
+    using accum_type = typename std::conditional<std::is_integral<T>::value, int64_t, T>::type;
+
+    array() {}
+    explicit array(size_t n) : data_(n) {}
+    array(size_t n, T v) : data_(n, v) {}
+    array(const T *data, size_t n) : data_(data, data + n) {}
+
+    // element access, 0-based like vector.at
+    T get(size_t i) const
+    {
+        ZLUA_CHECK_THROW(nullptr, i < this->data_.size(), "array index out of range");
+        return this->data_[i];
+    }
+
+    void set(size_t i, T v)
+    {
+        ZLUA_CHECK_THROW(nullptr, i < this->data_.size(), "array index out of range");
+        this->data_[i] = v;
+    }
+
+    void push_back(T v) { this->data_.push_back(v); }
+    void resize(size_t n) { this->data_.resize(n); }
+    void reserve(size_t n) { this->data_.reserve(n); }
+    void clear() { this->data_.clear(); }
+    size_t size() const { return this->data_.size(); }
+
+    T *data() { return this->data_.data(); }
+    const T *data() const { return this->data_.data(); }
+    span<T> view() { return span<T>(this->data(), this->size()); }
+    span<const T> view() const { return span<const T>(this->data(), this->size()); }
+
+    // bulk operations
+    void fill(T v) { kernel::fill(this->data(), this->size(), v); }
+
+    void copy(const array &src)
+    {
+        if (&src != this)
+        {
+            this->data_.assign(src.data_.begin(), src.data_.end());
+        }
+    }
+
+    // [first, last)
+    array slice(size_t first, size_t last) const
+    {
+        last = std::min(last, this->size());
+        ZLUA_CHECK_THROW(nullptr, first <= last, "array slice out of range");
+        return array(this->data() + first, last - first);
+    }
+
+    void add(const array &rhs)
+    {
+        this->check_size(rhs);
+        if (&rhs == this)
+            this->mul_scalar(2);
+        else
+            kernel::add(this->data(), rhs.data(), this->size());
+    }
+
+    void mul(const array &rhs)
+    {
+        this->check_size(rhs);
+        if (&rhs == this)
+            for (auto &v : this->data_)
+                v *= v;
+        else
+            kernel::mul(this->data(), rhs.data(), this->size());
+    }
+
+    // this = a * x + this
+    void axpy(T a, const array &x)
+    {
+        this->check_size(x);
+        if (&x == this)
+            this->mul_scalar(a + 1);
+        else
+            kernel::axpy(this->data(), a, x.data(), this->size());
+    }
+
+    accum_type sum() const { return kernel::sum<T, accum_type>(this->data(), this->size()); }
+
+    accum_type dot(const array &rhs) const
+    {
+        this->check_size(rhs);
+        return kernel::dot<T, accum_type>(this->data(), rhs.data(), this->size());
+    }
+
+    T min() const
+    {
+        ZLUA_CHECK_THROW(nullptr, !this->data_.empty(), "min of empty array");
+        return kernel::min(this->data(), this->size());
+    }
+
+    T max() const
+    {
+        ZLUA_CHECK_THROW(nullptr, !this->data_.empty(), "max of empty array");
+        return kernel::max(this->data(), this->size());
+    }
+
+    void clamp(T lo, T hi)
+    {
+        ZLUA_CHECK_THROW(nullptr, !(hi < lo), "clamp with hi < lo");
+        kernel::clamp(this->data(), this->size(), lo, hi);
+    }
+
+    // ret[i] = this[idx[i]]
+    array gather(const array<index_type> &idx) const
+    {
+        this->check_indices(idx);
+        array ret(idx.size());
+        kernel::gather(ret.data(), this->data(), idx.data(), idx.size());
+        return ret;
+    }
+
+    // this[idx[i]] = values[i]
+    void scatter(const array<index_type> &idx, const array &values)
+    {
+        ZLUA_CHECK_THROW(nullptr, idx.size() == values.size(), "scatter with mismatched index/value sizes");
+        this->check_indices(idx);
+        kernel::scatter(this->data(), values.data(), idx.data(), idx.size());
+    }
+
+private:
+    void check_size(const array &rhs) const
+    {
+        ZLUA_CHECK_THROW(nullptr, rhs.size() == this->size(), "array size mismatch");
+    }
+
+    void check_indices(const array<index_type> &idx) const
+    {
+        const index_type *p = idx.data();
+        for (size_t i = 0; i < idx.size(); ++i)
+        {
+            ZLUA_CHECK_THROW(nullptr, p[i] >= 0 && static_cast<size_t>(p[i]) < this->size(), "array index out of range");
+        }
+    }
+
+    void mul_scalar(T a)
+    {
+        for (auto &v : this->data_)
+            v *= a;
+    }
+
+    std::vector<T> data_;
+};
+
+} // namespace zlua
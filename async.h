@@ -0,0 +1,590 @@
+#pragma once
+#include "common.h"
+#include "core.h"
+#include "error.h"
+#include "stack.h"
+#include "thread_pool.h"
+#include "timer_wheel.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// async
+// a bound member function returning std::future<R> suspends the calling coroutine
+// instead of blocking the engine; Engine::poll() resumes it with the result once ready
+//   std::future<std::string> Store::load(std::string key) { return zlua::run_async([=] { return read(key); }); }
+//   async.spawn(function() local s = store:load("k") ... end)
+// a failed future raises its exception's message as a lua error in the coroutine
+// called outside a coroutine (or in a state without scheduler) the call blocks on the future
+// arguments are gone once the call suspends, async functions must take them by value
+// plain coroutine.yield() in a spawned task gives way until the next poll
+// tasks also park on timers and named events, waking them schedules nothing else:
+//   async.sleep(0.5)                        -- resumed by the first poll 500ms later
+//   local x, y = async.wait("door")         -- resumed with the values of async.signal("door", x, y)
+// Engine::run_until(deadline) polls and sleeps until the deadline or until no task is left
+////////////////////////////////////////////////////////////////////////////////
+
+// runs f on the shared pool
+template <typename F>
+auto run_async(F f) -> std::future<decltype(f())>
+{
+    using R = decltype(f());
+    auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+    std::future<R> future = task->get_future();
+    thread_pool::shared().submit([task] { (*task)(); });
+    return future;
+}
+
+namespace impl
+{
+// coroutine waiting to be resumed by a scheduler
+struct async_pending
+{
+    async_pending(lua_State *co) : co(co)
+    {
+        lua_pushthread(co);
+        this->ref = luaL_ref(co, LUA_REGISTRYINDEX);
+    }
+
+    virtual ~async_pending() {}
+
+    virtual bool ready() const = 0;
+
+    // pushes the values the coroutine resumes with
+    virtual int push(lua_State *co) = 0;
+
+    lua_State *co;
+    int ref;
+};
+
+template <typename R>
+struct future_result
+{
+    static int push(lua_State *ls, std::future<R> &future)
+    {
+        R r = future.get();
+        stack_op<R>::push(ls, std::move(r));
+        return element_size<R>::value;
+    }
+};
+
+template <>
+struct future_result<void>
+{
+    static int push(lua_State *, std::future<void> &future)
+    {
+        future.get();
+        return 0;
+    }
+};
+
+// resumes into async_resumed with true and the results, or false and the error message
+template <typename R>
+struct async_future : async_pending
+{
+    async_future(lua_State *co, std::future<R> &&future) : async_pending(co), future(std::move(future)) {}
+
+    bool ready() const override
+    {
+        return this->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    int push(lua_State *co) override
+    {
+        int top = lua_gettop(co);
+        try
+        {
+            lua_pushboolean(co, 1);
+            return 1 + future_result<R>::push(co, this->future);
+        }
+        catch (const std::exception &e)
+        {
+            lua_settop(co, top);
+            lua_pushboolean(co, 0);
+            lua_pushstring(co, e.what());
+        }
+        catch (...)
+        {
+            lua_settop(co, top);
+            lua_pushboolean(co, 0);
+            lua_pushstring(co, "unknown exception in async function");
+        }
+        return 2;
+    }
+
+    std::future<R> future;
+};
+
+// a task that yielded by itself, picked up again at the next poll
+struct async_yield : async_pending
+{
+    async_yield(lua_State *co) : async_pending(co) {}
+
+    bool ready() const override { return true; }
+    int push(lua_State *) override { return 0; }
+};
+
+// a task waiting for a named event, the signal values are moved onto its stack
+struct async_event : async_pending
+{
+    async_event(lua_State *co) : async_pending(co), nargs(0) {}
+
+    bool ready() const override { return true; }
+    int push(lua_State *) override { return this->nargs; }
+
+    int nargs;
+};
+
+inline const void *scheduler_key()
+{
+    static const char key = 0;
+    return &key;
+}
+
+// registry set of the threads spawned as tasks, weak keys
+inline const void *tasks_key()
+{
+    static const char key = 0;
+    return &key;
+}
+} // namespace impl
+
+////////////////////////////////////////////////////////////////////////////////
+// async_scheduler
+// tasks of one lua state suspended on futures, timers or events, owned by the engine
+// woken tasks join a ready list, a poll resumes that list and checks only the futures;
+// sleeping tasks sit in a timer_wheel of 1ms ticks, waiting ones in a list per event name
+////////////////////////////////////////////////////////////////////////////////
+class async_scheduler
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    async_scheduler() : ls_(nullptr), resuspended_(false), waiting_(0), origin_(clock::now()) {}
+
+    async_scheduler(const async_scheduler &) = delete;
+    async_scheduler &operator=(const async_scheduler &) = delete;
+
+    // makes this the scheduler of ls, async calls in ls suspend from now on
+    void attach(lua_State *ls)
+    {
+        this->ls_ = ls;
+        impl::running_slot(ls) = nullptr;
+        lua_pushlightuserdata(ls, this);
+        lua_rawsetp(ls, LUA_REGISTRYINDEX, impl::scheduler_key());
+
+        lua_newtable(ls);
+        lua_createtable(ls, 0, 1);
+        lua_pushstring(ls, "k");
+        lua_setfield(ls, -2, "__mode");
+        lua_setmetatable(ls, -2);
+        lua_rawsetp(ls, LUA_REGISTRYINDEX, impl::tasks_key());
+    }
+
+    static async_scheduler *of(lua_State *ls)
+    {
+        lua_rawgetp(ls, LUA_REGISTRYINDEX, impl::scheduler_key());
+        auto *scheduler = static_cast<async_scheduler *>(lua_touserdata(ls, -1));
+        lua_pop(ls, 1);
+        return scheduler;
+    }
+
+    // the scheduler of ls if ls is one of its tasks and can suspend, coroutines created
+    // by lua code are not tasks, async calls in them block instead
+    static async_scheduler *of_task(lua_State *ls)
+    {
+        async_scheduler *scheduler = lua_isyieldable(ls) ? of(ls) : nullptr;
+        if (scheduler == nullptr)
+        {
+            return nullptr;
+        }
+
+        lua_rawgetp(ls, LUA_REGISTRYINDEX, impl::tasks_key());
+        lua_pushthread(ls);
+        lua_rawget(ls, -2);
+        bool task = lua_toboolean(ls, -1) != 0;
+        lua_pop(ls, 2);
+        return task ? scheduler : nullptr;
+    }
+
+    size_t pending() const
+    {
+        return this->futures_.size() + this->ready_.size() + this->timers_.size() + this->waiting_;
+    }
+
+    // the running coroutine waits for the future of pending
+    void suspend(impl::async_pending *pending)
+    {
+        this->futures_.emplace_back(pending);
+        this->resuspended_ = true;
+    }
+
+    // the running coroutine co sleeps for ms milliseconds
+    void sleep(lua_State *co, uint64_t ms)
+    {
+        uint64_t now = this->tick_of(clock::now());
+        this->timers_.advance(now, this->ready_);
+        this->timers_.add(now + ms, std::unique_ptr<impl::async_pending>(new impl::async_yield(co)), this->ready_);
+        this->resuspended_ = true;
+    }
+
+    // the running coroutine co waits for event name
+    void wait(lua_State *co, const char *name)
+    {
+        this->events_[name].emplace_back(new impl::async_event(co));
+        ++this->waiting_;
+        this->resuspended_ = true;
+    }
+
+    // wakes the tasks waiting for event name with the nargs values on top of ls, which are popped
+    // returns how many were woken, they run at the next poll
+    size_t signal(lua_State *ls, const char *name, int nargs)
+    {
+        size_t woken = 0;
+        auto it = this->events_.find(name);
+        if (it != this->events_.end())
+        {
+            std::vector<std::unique_ptr<impl::async_event>> waiters;
+            waiters.swap(it->second);
+            this->events_.erase(it);
+
+            for (auto &w : waiters)
+            {
+                for (int i = 0; i < nargs; ++i)
+                {
+                    lua_pushvalue(ls, -nargs);
+                }
+                lua_xmove(ls, w->co, nargs);
+                w->nargs = nargs;
+                this->ready_.push_back(std::move(w));
+            }
+
+            woken = waiters.size();
+            this->waiting_ -= woken;
+        }
+
+        lua_pop(ls, nargs);
+        return woken;
+    }
+
+    // resumes the tasks woken so far, returns how many were resumed
+    // errors of tasks that fail are appended to errors
+    size_t poll(std::vector<std::string> *errors = nullptr)
+    {
+        this->timers_.advance(this->tick_of(clock::now()), this->ready_);
+
+        std::vector<std::unique_ptr<impl::async_pending>> waiting;
+        for (auto &p : this->futures_)
+        {
+            if (p->ready())
+            {
+                this->ready_.push_back(std::move(p));
+            }
+            else
+            {
+                waiting.push_back(std::move(p));
+            }
+        }
+        this->futures_.swap(waiting);
+
+        // tasks woken while resuming wait for the next poll
+        std::vector<std::unique_ptr<impl::async_pending>> ready;
+        ready.swap(this->ready_);
+        for (auto &p : ready)
+        {
+            lua_State *co = p->co;
+            int ref = p->ref;
+            int nargs = p->push(co);
+            p.reset();
+
+            std::string err;
+            if (!this->resume(co, nargs, &err) && errors != nullptr)
+            {
+                errors->push_back(err);
+            }
+            luaL_unref(this->ls_, LUA_REGISTRYINDEX, ref);
+        }
+
+        return ready.size();
+    }
+
+    // polls until deadline or until no task is left, sleeping while nothing is due
+    // returns how many tasks were resumed
+    size_t run_until(clock::time_point deadline, std::vector<std::string> *errors = nullptr)
+    {
+        size_t resumed = 0;
+        for (;;)
+        {
+            resumed += this->poll(errors);
+
+            clock::time_point now = clock::now();
+            if (this->pending() == 0 || now >= deadline)
+            {
+                return resumed;
+            }
+
+            if (!this->ready_.empty())
+            {
+                continue;
+            }
+
+            // futures complete on other threads and are checked every tick
+            clock::time_point wake = deadline;
+            if (!this->futures_.empty())
+            {
+                wake = std::min(wake, now + std::chrono::milliseconds(1));
+            }
+            else if (!this->timers_.empty())
+            {
+                wake = std::min(wake, this->origin_ + std::chrono::milliseconds(this->timers_.next_due()));
+            }
+            std::this_thread::sleep_until(wake);
+        }
+    }
+
+    // resumes co with the nargs values on its stack, false with err set if the task failed
+    bool resume(lua_State *co, int nargs, std::string *err)
+    {
+        // a task spawned by co resumes in between, the flag of co is kept aside meanwhile
+        bool outer = this->resuspended_;
+        this->resuspended_ = false;
+        int status = 0;
+        {
+            impl::running_guard running(this->ls_, co);
+            status = lua_resume(co, nullptr, nargs);
+        }
+        bool resuspended = this->resuspended_;
+        this->resuspended_ = outer;
+
+        if (status == LUA_YIELD)
+        {
+            if (!resuspended)
+            {
+                lua_settop(co, 0);
+                this->ready_.emplace_back(new impl::async_yield(co));
+            }
+            return true;
+        }
+
+        if (status != LUA_OK)
+        {
+            const char *msg = lua_tostring(co, -1);
+            luaL_traceback(this->ls_, co, msg != nullptr ? msg : "(error object is not a string)", 0);
+            *err = lua_tostring(this->ls_, -1);
+            lua_pop(this->ls_, 1);
+            return false;
+        }
+
+        return true;
+    }
+
+    // runs the function below the nargs values on top of ls as a new task
+    // false with err set if it fails before its first suspension
+    bool spawn(lua_State *ls, int nargs, std::string *err)
+    {
+        lua_State *co = lua_newthread(ls);
+        lua_rawgetp(ls, LUA_REGISTRYINDEX, impl::tasks_key());
+        lua_pushvalue(ls, -2);
+        lua_pushboolean(ls, 1);
+        lua_rawset(ls, -3);
+        lua_pop(ls, 1);
+
+        lua_insert(ls, -(nargs + 2));
+        lua_xmove(ls, co, nargs + 1);
+
+        // the thread stays referenced while the first resume runs
+        int ref = luaL_ref(ls, LUA_REGISTRYINDEX);
+        bool ok = this->resume(co, nargs, err);
+        luaL_unref(ls, LUA_REGISTRYINDEX, ref);
+        return ok;
+    }
+
+private:
+    uint64_t tick_of(clock::time_point t) const
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(t - this->origin_).count());
+    }
+
+    lua_State *ls_;
+    bool resuspended_;
+    size_t waiting_;
+    clock::time_point origin_;
+    std::vector<std::unique_ptr<impl::async_pending>> futures_;
+    std::vector<std::unique_ptr<impl::async_pending>> ready_;
+    timer_wheel<impl::async_pending> timers_;
+    std::unordered_map<std::string, std::vector<std::unique_ptr<impl::async_event>>> events_;
+};
+
+namespace impl
+{
+// continuation of a suspended async call, the scheduler resumes with (ok, results...)
+inline int async_resumed(lua_State *ls, int, lua_KContext)
+{
+    if (!lua_toboolean(ls, 1))
+    {
+        lua_remove(ls, 1);
+        return lua_error(ls);
+    }
+
+    lua_remove(ls, 1);
+    return lua_gettop(ls);
+}
+
+// calls the function, returns the number of results pushed, -1 if the coroutine is to suspend
+template <typename T, typename R, typename... Args>
+int async_call(lua_State *ls)
+{
+    using method_t = userdata::method_t<std::future<R> (T::*)(Args...)>;
+
+    userdata::object_t<T> *obj_wrapper = static_cast<userdata::object_t<T> *>(lua_touserdata(ls, 1));
+    T *t = reinterpret_cast<T *>(((char *)obj_wrapper->ptr + obj_wrapper->offset));
+    obj_wrapper->offset = 0;
+
+    method_t *func_wrapper = static_cast<method_t *>(lua_touserdata(ls, lua_upvalueindex(1)));
+    assert(!obj_wrapper->is_const || (func_wrapper->is_const && "const object can't call non-const member function"));
+
+    std::future<R> future;
+    {
+        using wrapped_tuple_t = pack_tuple_t<Args...>;
+        wrapped_tuple_t params;
+        stack_op<wrapped_tuple_t>::pop(ls, params, -1, lua_gettop(ls) - 1);
+        future = tuple_invoke(func_wrapper->ptr, t, params);
+    }
+
+    async_scheduler *scheduler = async_scheduler::of_task(ls);
+    if (scheduler == nullptr)
+    {
+        return future_result<R>::push(ls, future);
+    }
+
+    lua_settop(ls, 0);
+    scheduler->suspend(new async_future<R>(ls, std::move(future)));
+    return -1;
+}
+} // namespace impl
+
+// no c++ object lives in this frame, lua_yieldk doesn't return
+template <typename T, typename R, typename... Args>
+int lua_async_forwarder(lua_State *ls)
+{
+    int n = impl::async_call<T, R, Args...>(ls);
+    if (n >= 0)
+    {
+        return n;
+    }
+
+    return lua_yieldk(ls, 0, 0, &impl::async_resumed);
+}
+
+// forwarder for member functions, async for those returning std::future
+template <typename T, typename R, typename... Args>
+struct method_forwarder
+{
+    static lua_CFunction get() { return &lua_function_forwarder<T, R, Args...>; }
+};
+
+template <typename T, typename R, typename... Args>
+struct method_forwarder<T, std::future<R>, Args...>
+{
+    static lua_CFunction get() { return &lua_async_forwarder<T, R, Args...>; }
+};
+
+// async.spawn(f, ...) runs f(...) as a task resumed by Engine::poll()
+inline int lua_async_spawn(lua_State *ls)
+{
+    luaL_checktype(ls, 1, LUA_TFUNCTION);
+    async_scheduler *scheduler = async_scheduler::of(ls);
+    if (scheduler == nullptr)
+    {
+        return luaL_error(ls, "no scheduler in this lua state");
+    }
+
+    bool ok = false;
+    {
+        std::string err;
+        ok = scheduler->spawn(ls, lua_gettop(ls) - 1, &err);
+        if (!ok)
+        {
+            lua_pushstring(ls, err.c_str());
+        }
+    }
+
+    return ok ? 0 : lua_error(ls);
+}
+
+namespace impl
+{
+// the scheduler a task in ls parks on, nullptr with an error message pushed if there is none
+inline async_scheduler *parking_scheduler(lua_State *ls, const char *what)
+{
+    if (async_scheduler::of(ls) == nullptr)
+    {
+        lua_pushstring(ls, "no scheduler in this lua state");
+        return nullptr;
+    }
+
+    async_scheduler *scheduler = async_scheduler::of_task(ls);
+    if (scheduler == nullptr)
+    {
+        lua_pushfstring(ls, "%s outside a task", what);
+    }
+    return scheduler;
+}
+} // namespace impl
+
+// async.sleep(seconds) suspends the task for at least seconds, in 1ms ticks
+inline int lua_async_sleep(lua_State *ls)
+{
+    lua_Number seconds = luaL_checknumber(ls, 1);
+    async_scheduler *scheduler = impl::parking_scheduler(ls, "async.sleep");
+    if (scheduler == nullptr)
+    {
+        return lua_error(ls);
+    }
+
+    lua_Number ms = seconds > 0 ? seconds * 1000 + 0.999 : 0;
+    scheduler->sleep(ls, static_cast<uint64_t>(ms));
+    lua_settop(ls, 0);
+    return lua_yield(ls, 0);
+}
+
+// async.wait(name) suspends the task until async.signal(name, ...), returns the signal values
+inline int lua_async_wait(lua_State *ls)
+{
+    const char *name = luaL_checkstring(ls, 1);
+    async_scheduler *scheduler = impl::parking_scheduler(ls, "async.wait");
+    if (scheduler == nullptr)
+    {
+        return lua_error(ls);
+    }
+
+    scheduler->wait(ls, name);
+    lua_settop(ls, 0);
+    return lua_yield(ls, 0);
+}
+
+// async.signal(name, ...) wakes the tasks waiting for name, returns how many
+inline int lua_async_signal(lua_State *ls)
+{
+    const char *name = luaL_checkstring(ls, 1);
+    async_scheduler *scheduler = async_scheduler::of(ls);
+    if (scheduler == nullptr)
+    {
+        return luaL_error(ls, "no scheduler in this lua state");
+    }
+
+    lua_Integer woken = static_cast<lua_Integer>(scheduler->signal(ls, name, lua_gettop(ls) - 1));
+    lua_pushinteger(ls, woken);
+    return 1;
+}
+
+} // namespace zlua
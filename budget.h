@@ -0,0 +1,179 @@
+#pragma once
+#include "common.h"
+#include <chrono>
+#include <cstdint>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// budget
+// limit of a call into lua, in vm instructions and/or wall time, 0 is unlimited
+//   engine.call<int>(zlua::budget(1000000), "score", x);
+//   engine.load_file("tenant.lua", zlua::budget(std::chrono::milliseconds(5)));
+// enforced by a count hook installed only while the call runs, every hook_step instructions,
+// so precision is hook_step instructions and overhead is one hook call per hook_step
+// once exceeded every following instruction raises again, pcall in the script can't swallow it,
+// and the call throws zlua::call_error with code() == error_code::budget_exceeded
+// time spent inside a single c function is not interrupted, nested budgets take the tighter limits
+// coroutines created by the call are counted, those created before it are not
+////////////////////////////////////////////////////////////////////////////////
+struct budget
+{
+    using clock = std::chrono::steady_clock;
+
+    const static int hook_step = 1000;
+
+    budget() : instructions(0), time(0) {}
+    explicit budget(uint64_t instructions, std::chrono::microseconds time = std::chrono::microseconds(0))
+        : instructions(instructions), time(time) {}
+    budget(std::chrono::microseconds time) : instructions(0), time(time) {}
+
+    bool unlimited() const { return this->instructions == 0 && this->time.count() == 0; }
+
+    uint64_t instructions;
+    std::chrono::microseconds time;
+};
+
+namespace impl
+{
+// state of the innermost budgeted call of a lua state, found by the hook through the registry
+struct budget_state
+{
+    uint64_t limit;
+    uint64_t used;
+    bool timed;
+    budget::clock::time_point deadline;
+    const char *exceeded;
+
+    static const void *key()
+    {
+        static const char k = 0;
+        return &k;
+    }
+
+    static budget_state *of(lua_State *ls)
+    {
+        lua_rawgetp(ls, LUA_REGISTRYINDEX, key());
+        auto *state = static_cast<budget_state *>(lua_touserdata(ls, -1));
+        lua_pop(ls, 1);
+        return state;
+    }
+};
+
+// nothing here has a destructor, luaL_error doesn't return
+inline void budget_hook(lua_State *ls, lua_Debug *)
+{
+    budget_state *state = budget_state::of(ls);
+    if (state == nullptr)
+    {
+        // a coroutine created during a budgeted call outlived it
+        lua_sethook(ls, nullptr, 0, 0);
+        return;
+    }
+
+    if (state->exceeded == nullptr)
+    {
+        state->used += budget::hook_step;
+        if (state->limit != 0 && state->used >= state->limit)
+        {
+            state->exceeded = "instruction budget exceeded";
+        }
+        else if (state->timed && budget::clock::now() >= state->deadline)
+        {
+            state->exceeded = "time budget exceeded";
+        }
+        else
+        {
+            return;
+        }
+    }
+
+    lua_sethook(ls, &budget_hook, LUA_MASKCOUNT, 1);
+    luaL_error(ls, "%s", state->exceeded);
+}
+
+// installs the budget hook for its lifetime, restores the enclosing one after
+class budget_scope
+{
+public:
+    budget_scope(lua_State *ls, const budget &b)
+        : ls_(ls), active_(!b.unlimited()), outer_(nullptr)
+    {
+        if (!this->active_)
+        {
+            return;
+        }
+
+        this->outer_ = budget_state::of(ls);
+        this->prev_hook_ = lua_gethook(ls);
+        this->prev_mask_ = lua_gethookmask(ls);
+        this->prev_count_ = lua_gethookcount(ls);
+
+        this->state_.limit = b.instructions;
+        this->state_.used = 0;
+        this->state_.timed = b.time.count() != 0;
+        this->state_.deadline = budget::clock::now() + b.time;
+        this->state_.exceeded = nullptr;
+
+        if (this->outer_ != nullptr)
+        {
+            this->tighten(*this->outer_);
+        }
+
+        lua_pushlightuserdata(ls, &this->state_);
+        lua_rawsetp(ls, LUA_REGISTRYINDEX, budget_state::key());
+        lua_sethook(ls, &budget_hook, LUA_MASKCOUNT, budget::hook_step);
+    }
+
+    ~budget_scope()
+    {
+        if (!this->active_)
+        {
+            return;
+        }
+
+        if (this->outer_ != nullptr)
+        {
+            this->outer_->used += this->state_.used;
+        }
+
+        lua_pushlightuserdata(this->ls_, this->outer_);
+        lua_rawsetp(this->ls_, LUA_REGISTRYINDEX, budget_state::key());
+        lua_sethook(this->ls_, this->prev_hook_, this->prev_mask_, this->prev_count_);
+    }
+
+    budget_scope(const budget_scope &) = delete;
+    budget_scope &operator=(const budget_scope &) = delete;
+
+    bool exceeded() const { return this->active_ && this->state_.exceeded != nullptr; }
+
+private:
+    void tighten(const budget_state &outer)
+    {
+        if (outer.limit != 0)
+        {
+            uint64_t left = outer.used < outer.limit ? outer.limit - outer.used : 1;
+            if (this->state_.limit == 0 || left < this->state_.limit)
+            {
+                this->state_.limit = left;
+            }
+        }
+
+        if (outer.timed && (!this->state_.timed || outer.deadline < this->state_.deadline))
+        {
+            this->state_.timed = true;
+            this->state_.deadline = outer.deadline;
+        }
+    }
+
+    lua_State *ls_;
+    bool active_;
+    budget_state *outer_;
+    budget_state state_;
+    lua_Hook prev_hook_;
+    int prev_mask_;
+    int prev_count_;
+};
+} // namespace impl
+
+} // namespace zlua
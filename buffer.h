@@ -0,0 +1,427 @@
+#pragma once
+#include "common.h"
+#include "register.h"
+#include "span.h"
+#include <string>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// buffer
+// growable byte buffer for building strings and binary payloads without interning
+// every intermediate, registered by the engine as `buffer`
+//   b:append(...) strings, numbers, other buffers
+//   b:pack(fmt, ...) / b:unpack(fmt [, pos]) typed writes/reads
+//   b:reserve(n), b:size(), #b, b:clear()
+//   b:slice(i [, j]) a new buffer, b:tostring([i [, j]]) a lua string, only when asked
+// bound functions read it in place through span<const char> or std::string_view
+////////////////////////////////////////////////////////////////////////////////
+class buffer
+{
+public:
+    using value_type = char;
+
+    buffer() {}
+
+    void append(const char *data, size_t size) { this->data_.append(data, size); }
+    void push_back(char c) { this->data_.push_back(c); }
+
+    void reserve(size_t n) { this->data_.reserve(n); }
+    void resize(size_t n) { this->data_.resize(n); }
+    void clear() { this->data_.clear(); }
+
+    size_t size() const { return this->data_.size(); }
+    size_t capacity() const { return this->data_.capacity(); }
+
+    char *data() { return &this->data_[0]; }
+    const char *data() const { return this->data_.data(); }
+
+    const std::string &str() const { return this->data_; }
+
+    span<char> view() { return span<char>(this->data(), this->size()); }
+    span<const char> view() const { return span<const char>(this->data(), this->size()); }
+
+private:
+    std::string data_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// pack format, a subset of string.pack
+//   < little endian, > big endian, = native
+//   b/B int8, h/H int16, i/I int32, l/L int64, f float, d double
+//   integers out of the range of their option raise "integer overflow"
+//   s string prefixed by its uint32 length, z zero terminated string
+////////////////////////////////////////////////////////////////////////////////
+namespace impl
+{
+inline bool native_little_endian()
+{
+    const uint16_t probe = 1;
+    return *reinterpret_cast<const char *>(&probe) == 1;
+}
+
+inline void pack_bits(buffer &b, uint64_t v, size_t n, bool little)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t shift = 8 * (little ? i : n - 1 - i);
+        b.push_back(static_cast<char>((v >> shift) & 0xff));
+    }
+}
+
+// byte order options, false if opt is not one
+inline bool endian_option(char opt, bool *little)
+{
+    switch (opt)
+    {
+    case '<':
+        *little = true;
+        return true;
+    case '>':
+        *little = false;
+        return true;
+    case '=':
+        *little = native_little_endian();
+        return true;
+    case ' ':
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline uint64_t unpack_bits(const char *p, size_t n, bool little)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t shift = 8 * (little ? i : n - 1 - i);
+        v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << shift;
+    }
+    return v;
+}
+
+// size of an integral/floating option, 0 for others
+inline size_t pack_size(char opt)
+{
+    switch (opt)
+    {
+    case 'b':
+    case 'B':
+        return 1;
+    case 'h':
+    case 'H':
+        return 2;
+    case 'i':
+    case 'I':
+    case 'f':
+        return 4;
+    case 'l':
+    case 'L':
+    case 'd':
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// whether v fits the n byte integral option opt, lower case options are signed
+inline bool integer_fits(char opt, size_t n, lua_Integer v)
+{
+    if (n >= sizeof(lua_Integer))
+    {
+        return true;
+    }
+
+    lua_Integer limit = lua_Integer(1) << (8 * n - 1);
+    if (opt >= 'a' && opt <= 'z')
+    {
+        return v >= -limit && v < limit;
+    }
+
+    return v >= 0 && v < 2 * limit;
+}
+
+// 1-based lua range [i, j] clamped to [0, size), negative indices count from the end
+inline void byte_range(lua_State *ls, size_t size, int pos, size_t *first, size_t *last)
+{
+    lua_Integer len = static_cast<lua_Integer>(size);
+    lua_Integer i = luaL_optinteger(ls, pos, 1);
+    lua_Integer j = luaL_optinteger(ls, pos + 1, -1);
+
+    i = i < 0 ? len + i + 1 : i;
+    i = i < 1 ? 1 : (i > len + 1 ? len + 1 : i);
+    j = j < 0 ? len + j + 1 : j;
+    j = j > len ? len : j;
+
+    *first = static_cast<size_t>(i - 1);
+    *last = i > j ? *first : static_cast<size_t>(j);
+}
+
+// pushes the integral/floating value of option opt stored at p
+inline void push_scalar(lua_State *ls, const char *p, char opt, bool little)
+{
+    size_t n = pack_size(opt);
+    uint64_t bits = unpack_bits(p, n, little);
+    if (opt == 'f')
+    {
+        uint32_t bits32 = static_cast<uint32_t>(bits);
+        float f = 0;
+        memcpy(&f, &bits32, sizeof(f));
+        lua_pushnumber(ls, f);
+    }
+    else if (opt == 'd')
+    {
+        double d = 0;
+        memcpy(&d, &bits, sizeof(d));
+        lua_pushnumber(ls, d);
+    }
+    else if (opt >= 'a' && opt <= 'z' && n < 8)
+    {
+        // lower case options are signed
+        uint64_t mask = uint64_t(1) << (8 * n - 1);
+        lua_pushinteger(ls, static_cast<lua_Integer>((bits ^ mask) - mask));
+    }
+    else
+    {
+        lua_pushinteger(ls, static_cast<lua_Integer>(bits));
+    }
+}
+
+// unpack(fmt [, pos]) over size bytes at data, fmt at index 2, pos at index 3
+// pushes the values and the position after them
+inline int unpack_bytes(lua_State *ls, const char *data, size_t size)
+{
+    const char *fmt = luaL_checkstring(ls, 2);
+    lua_Integer start = luaL_optinteger(ls, 3, 1);
+    ZLUA_ARG_CHECK_THROW(ls, start >= 1 && static_cast<size_t>(start) <= size + 1, 3, "initial position out of data");
+
+    size_t pos = static_cast<size_t>(start - 1);
+    bool little = native_little_endian();
+    int n_results = 0;
+
+    for (; *fmt != '\0'; ++fmt)
+    {
+        char opt = *fmt;
+        size_t n = pack_size(opt);
+
+        if (endian_option(opt, &little))
+        {
+            continue;
+        }
+
+        if (opt == 's')
+        {
+            ZLUA_ARG_CHECK_THROW(ls, size - pos >= 4, 1, "data too short");
+            n = 4 + static_cast<size_t>(unpack_bits(data + pos, 4, little));
+        }
+        else if (opt == 'z')
+        {
+            const char *end = static_cast<const char *>(memchr(data + pos, '\0', size - pos));
+            ZLUA_ARG_CHECK_THROW(ls, end != nullptr, 1, "unfinished string for 'z'");
+            n = static_cast<size_t>(end - (data + pos)) + 1;
+        }
+
+        ZLUA_ARG_CHECK_THROW(ls, n > 0, 2, std::string("invalid format option '") + opt + "'");
+        ZLUA_ARG_CHECK_THROW(ls, size - pos >= n, 1, "data too short");
+        luaL_checkstack(ls, 2, "too many results");
+
+        const char *p = data + pos;
+        pos += n;
+        ++n_results;
+
+        if (opt == 's' || opt == 'z')
+        {
+            opt == 's' ? lua_pushlstring(ls, p + 4, n - 4) : lua_pushlstring(ls, p, n - 1);
+            continue;
+        }
+
+        push_scalar(ls, p, opt, little);
+    }
+
+    lua_pushinteger(ls, static_cast<lua_Integer>(pos + 1));
+    return n_results + 1;
+}
+} // namespace impl
+
+struct buffer_registrar
+{
+    static void reg(lua_State *ls, const char *name)
+    {
+        Registrar<buffer, ctor()>(ls, name)
+            .def("reserve", &buffer::reserve)
+            .def("clear", &buffer::clear)
+            .def("size", &buffer::size)
+            .def("capacity", &buffer::capacity)
+            .def_raw("append", &append)
+            .def_raw("pack", &pack)
+            .def_raw("unpack", &unpack)
+            .def_raw("slice", &slice)
+            .def_raw("tostring", &tostring)
+            //
+            ;
+
+        static const userdata::contiguous_t desc = {type_tag<char>(), &fetch};
+        luaL_getmetatable(ls, type_info<buffer>::metatable_name());
+        set_contiguous(ls, &desc);
+
+        lua_pushstring(ls, "__len");
+        lua_pushcfunction(ls, &size);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "__tostring");
+        lua_pushcfunction(ls, &tostring);
+        lua_rawset(ls, -3);
+
+        lua_pop(ls, 1);
+    }
+
+private:
+    static void fetch(void *ud, void **data, size_t *size)
+    {
+        auto *obj = static_cast<userdata::object_t<buffer> *>(ud);
+        *data = const_cast<char *>(static_cast<const buffer *>(obj->ptr)->data());
+        *size = obj->ptr->size();
+    }
+
+    static buffer *check_buffer(lua_State *ls, int pos, bool writable = false)
+    {
+        auto *obj = static_cast<userdata::object_t<buffer> *>(luaL_checkudata(ls, pos, type_info<buffer>::metatable_name()));
+        ZLUA_ARG_CHECK_THROW(ls, !writable || !obj->is_const, pos, "cannot modify const buffer");
+        return obj->ptr;
+    }
+
+    static int size(lua_State *ls)
+    {
+        lua_pushinteger(ls, static_cast<lua_Integer>(check_buffer(ls, 1)->size()));
+        return 1;
+    }
+
+    // b:append(...), returns b
+    static int append(lua_State *ls)
+    {
+        buffer *b = check_buffer(ls, 1, true);
+        int top = lua_gettop(ls);
+
+        for (int i = 2; i <= top; ++i)
+        {
+            size_t len = 0;
+            if (lua_type(ls, i) == LUA_TSTRING)
+            {
+                const char *s = lua_tolstring(ls, i, &len);
+                b->append(s, len);
+            }
+            else if (lua_type(ls, i) == LUA_TNUMBER)
+            {
+                const char *s = luaL_tolstring(ls, i, &len);
+                b->append(s, len);
+                lua_pop(ls, 1);
+            }
+            else
+            {
+                buffer *other = check_buffer(ls, i);
+                b->append(other->data(), other->size());
+            }
+        }
+
+        lua_settop(ls, 1);
+        return 1;
+    }
+
+    // b:pack(fmt, ...), returns b
+    static int pack(lua_State *ls)
+    {
+        buffer *b = check_buffer(ls, 1, true);
+        const char *fmt = luaL_checkstring(ls, 2);
+        bool little = impl::native_little_endian();
+        int arg = 3;
+
+        for (; *fmt != '\0'; ++fmt)
+        {
+            char opt = *fmt;
+            size_t n = impl::pack_size(opt);
+
+            if (impl::endian_option(opt, &little))
+            {
+                continue;
+            }
+
+            if (opt == 'f')
+            {
+                float f = static_cast<float>(luaL_checknumber(ls, arg++));
+                uint32_t bits = 0;
+                memcpy(&bits, &f, sizeof(bits));
+                impl::pack_bits(*b, bits, n, little);
+            }
+            else if (opt == 'd')
+            {
+                double d = static_cast<double>(luaL_checknumber(ls, arg++));
+                uint64_t bits = 0;
+                memcpy(&bits, &d, sizeof(bits));
+                impl::pack_bits(*b, bits, n, little);
+            }
+            else if (n > 0)
+            {
+                lua_Integer v = luaL_checkinteger(ls, arg++);
+                ZLUA_ARG_CHECK_THROW(ls, impl::integer_fits(opt, n, v), arg - 1, "integer overflow");
+                impl::pack_bits(*b, static_cast<uint64_t>(v), n, little);
+            }
+            else if (opt == 's' || opt == 'z')
+            {
+                size_t len = 0;
+                const char *s = luaL_checklstring(ls, arg++, &len);
+                if (opt == 's')
+                {
+                    ZLUA_ARG_CHECK_THROW(ls, len <= 0xffffffffu, arg - 1, "string too long for 's'");
+                    impl::pack_bits(*b, len, 4, little);
+                }
+
+                b->append(s, len);
+                if (opt == 'z')
+                {
+                    b->push_back('\0');
+                }
+            }
+            else
+            {
+                ZLUA_ARG_CHECK_THROW(ls, false, 2, std::string("invalid format option '") + opt + "'");
+            }
+        }
+
+        lua_settop(ls, 1);
+        return 1;
+    }
+
+    // b:unpack(fmt [, pos]), returns the values and the position after them
+    static int unpack(lua_State *ls)
+    {
+        const buffer *b = check_buffer(ls, 1);
+        return impl::unpack_bytes(ls, b->data(), b->size());
+    }
+
+    // b:slice(i [, j]), a new buffer with bytes i..j
+    static int slice(lua_State *ls)
+    {
+        buffer *b = check_buffer(ls, 1);
+        size_t first = 0, last = 0;
+        impl::byte_range(ls, b->size(), 2, &first, &last);
+
+        auto *sliced = new buffer();
+        sliced->append(static_cast<const buffer *>(b)->data() + first, last - first);
+        stack_op<buffer>::push_new(ls, sliced);
+        return 1;
+    }
+
+    // b:tostring([i [, j]])
+    static int tostring(lua_State *ls)
+    {
+        buffer *b = check_buffer(ls, 1);
+        size_t first = 0, last = 0;
+        impl::byte_range(ls, b->size(), 2, &first, &last);
+
+        lua_pushlstring(ls, static_cast<const buffer *>(b)->data() + first, last - first);
+        return 1;
+    }
+};
+
+} // namespace zlua
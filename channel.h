@@ -0,0 +1,501 @@
+#pragma once
+#include "common.h"
+#include "core.h"
+#include "error.h"
+#include "register.h"
+#include "table.h"
+#include "userdata.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// mpsc_queue
+// unbounded lock-free queue, any number of producers and one consumer (Vyukov's node queue)
+// a push is one allocation and one atomic exchange, a pop touches nothing producers write
+// except the node it takes; items behind a push still in progress are seen once it completes
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class mpsc_queue
+{
+public:
+    mpsc_queue() : head_(new node_t()), tail_(nullptr)
+    {
+        this->tail_ = this->head_.load(std::memory_order_relaxed);
+    }
+
+    ~mpsc_queue()
+    {
+        T value;
+        while (this->pop(value))
+        {
+        }
+        delete this->tail_;
+    }
+
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+    // any thread
+    void push(T &&value)
+    {
+        node_t *node = new node_t(std::move(value));
+        node_t *prev = this->head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // consumer only, false if empty
+    bool pop(T &value)
+    {
+        node_t *next = this->tail_->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+        {
+            return false;
+        }
+
+        // next becomes the stub, its value is moved out
+        value = std::move(next->value);
+        delete this->tail_;
+        this->tail_ = next;
+        return true;
+    }
+
+private:
+    struct node_t
+    {
+        node_t() : next(nullptr) {}
+        explicit node_t(T &&v) : next(nullptr), value(std::move(v)) {}
+
+        std::atomic<node_t *> next;
+        T value;
+    };
+
+    std::atomic<node_t *> head_;
+    node_t *tail_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// message
+// lua values serialized out of one lua state and rebuilt in another
+//   nil, booleans, integers, numbers, strings, tables of those (metatables dropped, no cycles)
+//   and lua-owned objects of registered types, which move: the message takes the c++ pointer,
+//   the sender's object is released (indexing it raises), the receiver's owns the pointer;
+//   member proxies and cursors of a moved object are released with it,
+//   references its methods returned earlier must not be used after the send
+// the receiving state must have the objects' types registered under the same names
+////////////////////////////////////////////////////////////////////////////////
+class message
+{
+public:
+    // tables nested deeper are refused, it also stops cycles
+    const static int max_depth = 32;
+
+    message() : count_(0) {}
+    ~message() { this->clear(); }
+
+    message(message &&rhs) : data_(std::move(rhs.data_)), objects_(std::move(rhs.objects_)), count_(rhs.count_)
+    {
+        rhs.objects_.clear();
+        rhs.count_ = 0;
+    }
+
+    message &operator=(message &&rhs)
+    {
+        if (this != &rhs)
+        {
+            this->clear();
+            this->data_ = std::move(rhs.data_);
+            this->objects_ = std::move(rhs.objects_);
+            this->count_ = rhs.count_;
+            rhs.objects_.clear();
+            rhs.count_ = 0;
+        }
+        return *this;
+    }
+
+    message(const message &) = delete;
+    message &operator=(const message &) = delete;
+
+    // the n values from pos on, objects among them are moved only if all values encode
+    static message pack(lua_State *ls, int pos, int n)
+    {
+        pos = lua_absindex(ls, pos);
+        impl::stack_restorer restorer(ls);
+
+        // the objects to move, in claim order, their views are released once all values encode
+        lua_newtable(ls);
+        int claimed = lua_gettop(ls);
+
+        message m;
+        std::vector<pending_t> pending;
+        for (int i = 0; i < n; ++i)
+        {
+            m.encode(ls, pos + i, 0, claimed, pending);
+        }
+        m.count_ = n;
+
+        for (size_t i = 0; i < pending.size(); ++i)
+        {
+            pending_t &p = pending[i];
+            m.objects_.push_back(object_entry_t{p.transfer, p.obj->ptr});
+            p.obj->ptr = nullptr;
+            p.obj->need_release = false;
+
+            lua_rawgeti(ls, claimed, static_cast<lua_Integer>(i + 1));
+            release_object_views(ls, -1);
+            lua_pop(ls, 1);
+        }
+        return m;
+    }
+
+    // pushes the values into ls, where the objects become lua-owned, returns how many
+    int unpack(lua_State *ls)
+    {
+        ZLUA_CHECK_THROW(ls, lua_checkstack(ls, this->count_ + max_depth * 2 + 4), "message too large for the lua stack");
+        for (auto &o : this->objects_)
+        {
+            bool registered = o.transfer->push_metatable(ls) == LUA_TTABLE;
+            lua_pop(ls, 1);
+            ZLUA_CHECK_THROW(ls, registered, std::string("type ") + o.transfer->metatable_name() + " not registered in the receiving engine");
+        }
+
+        // objects are materialized first, a table holds them while the values refer to them
+        int objects = 0;
+        if (!this->objects_.empty())
+        {
+            lua_createtable(ls, static_cast<int>(this->objects_.size()), 0);
+            objects = lua_gettop(ls);
+            for (size_t i = 0; i < this->objects_.size(); ++i)
+            {
+                this->objects_[i].transfer->push(ls, this->objects_[i].ptr);
+                this->objects_[i].ptr = nullptr;
+                lua_rawseti(ls, objects, static_cast<lua_Integer>(i + 1));
+            }
+        }
+
+        const char *p = this->data_.data();
+        for (int i = 0; i < this->count_; ++i)
+        {
+            decode(ls, p, objects);
+        }
+
+        if (objects != 0)
+        {
+            lua_remove(ls, objects);
+        }
+
+        int n = this->count_;
+        this->clear();
+        return n;
+    }
+
+    int count() const { return this->count_; }
+    size_t bytes() const { return this->data_.size(); }
+    bool empty() const { return this->count_ == 0; }
+
+private:
+    struct object_entry_t
+    {
+        const userdata::transfer_t *transfer;
+        void *ptr;
+    };
+
+    struct pending_t
+    {
+        const userdata::transfer_t *transfer;
+        userdata::object_t<void> *obj;
+    };
+
+    // objects not delivered are deleted with the message
+    void clear()
+    {
+        for (auto &o : this->objects_)
+        {
+            if (o.ptr != nullptr)
+            {
+                o.transfer->destroy(o.ptr);
+            }
+        }
+
+        this->objects_.clear();
+        this->data_.clear();
+        this->count_ = 0;
+    }
+
+    template <typename V>
+    void write(const V &v)
+    {
+        this->data_.append(reinterpret_cast<const char *>(&v), sizeof(v));
+    }
+
+    template <typename V>
+    static V read(const char *&p)
+    {
+        V v;
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+
+    void encode(lua_State *ls, int idx, int depth, int claimed, std::vector<pending_t> &pending)
+    {
+        switch (lua_type(ls, idx))
+        {
+        case LUA_TNIL:
+            this->data_ += 'n';
+            break;
+        case LUA_TBOOLEAN:
+            this->data_ += lua_toboolean(ls, idx) ? 't' : 'f';
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(ls, idx))
+            {
+                this->data_ += 'i';
+                this->write(lua_tointeger(ls, idx));
+            }
+            else
+            {
+                this->data_ += 'd';
+                this->write(lua_tonumber(ls, idx));
+            }
+            break;
+        case LUA_TSTRING:
+        {
+            size_t len = 0;
+            const char *s = lua_tolstring(ls, idx, &len);
+            this->data_ += 's';
+            this->write(len);
+            this->data_.append(s, len);
+            break;
+        }
+        case LUA_TTABLE:
+            ZLUA_CHECK_THROW(ls, depth < max_depth, "can't send tables nested deeper than " + std::to_string(max_depth) + " or cyclic");
+            ZLUA_CHECK_THROW(ls, lua_checkstack(ls, 3), "lua stack exhausted while sending");
+            this->data_ += 'T';
+            lua_pushnil(ls);
+            while (lua_next(ls, idx) != 0)
+            {
+                int top = lua_gettop(ls);
+                this->encode(ls, top - 1, depth + 1, claimed, pending);
+                this->encode(ls, top, depth + 1, claimed, pending);
+                lua_pop(ls, 1);
+            }
+            this->data_ += 'e';
+            break;
+        case LUA_TUSERDATA:
+            this->data_ += 'o';
+            this->write(static_cast<uint32_t>(claim(ls, idx, claimed, pending)));
+            break;
+        default:
+            ZLUA_CHECK_THROW(ls, false, std::string("can't send a ") + luaL_typename(ls, idx));
+        }
+    }
+
+    // index of the object at idx among the moved ones, the same object twice is moved once
+    static size_t claim(lua_State *ls, int idx, int claimed, std::vector<pending_t> &pending)
+    {
+        auto *obj = static_cast<userdata::object_t<void> *>(lua_touserdata(ls, idx));
+        for (size_t i = 0; i < pending.size(); ++i)
+        {
+            if (pending[i].obj == obj)
+            {
+                return i;
+            }
+        }
+
+        const userdata::transfer_t *transfer = nullptr;
+        if (lua_getmetatable(ls, idx) != 0)
+        {
+            lua_rawgetp(ls, -1, transfer_key());
+            transfer = static_cast<const userdata::transfer_t *>(lua_touserdata(ls, -1));
+            lua_pop(ls, 2);
+        }
+
+        ZLUA_CHECK_THROW(ls, transfer != nullptr, "can't send userdata that is not a registered object");
+        ZLUA_CHECK_THROW(ls, obj->ptr != nullptr, "can't send a released object");
+        ZLUA_CHECK_THROW(ls, obj->need_release && !obj->is_cursor && !obj->is_const, "only lua-owned non-const objects can be sent, they move");
+
+        pending.push_back(pending_t{transfer, obj});
+        lua_pushvalue(ls, idx);
+        lua_rawseti(ls, claimed, static_cast<lua_Integer>(pending.size()));
+        return pending.size() - 1;
+    }
+
+    static void decode(lua_State *ls, const char *&p, int objects)
+    {
+        switch (*p++)
+        {
+        case 'n':
+            lua_pushnil(ls);
+            break;
+        case 't':
+            lua_pushboolean(ls, 1);
+            break;
+        case 'f':
+            lua_pushboolean(ls, 0);
+            break;
+        case 'i':
+            lua_pushinteger(ls, read<lua_Integer>(p));
+            break;
+        case 'd':
+            lua_pushnumber(ls, read<lua_Number>(p));
+            break;
+        case 's':
+        {
+            size_t len = read<size_t>(p);
+            lua_pushlstring(ls, p, len);
+            p += len;
+            break;
+        }
+        case 'T':
+            lua_newtable(ls);
+            while (*p != 'e')
+            {
+                decode(ls, p, objects);
+                decode(ls, p, objects);
+                lua_rawset(ls, -3);
+            }
+            ++p;
+            break;
+        case 'o':
+            lua_rawgeti(ls, objects, static_cast<lua_Integer>(read<uint32_t>(p)) + 1);
+            break;
+        }
+    }
+
+    std::string data_;
+    std::vector<object_entry_t> objects_;
+    int count_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// channel
+// handle of a queue of messages shared by engines on any threads, copies share the queue
+//   zlua::channel work;
+//   producer.set_channel("work", work); consumer.set_channel("work", work);
+//   work:send(id, {x = 1, y = 2}, job)          -- in any producer, job is moved
+//   work:drain(function(id, pos, job) ... end)  -- in the consumer, every queued message
+// any number of engines send, one engine at a time receives
+////////////////////////////////////////////////////////////////////////////////
+class channel
+{
+public:
+    channel() : queue_(std::make_shared<mpsc_queue<message>>()) {}
+
+    void send(message &&m) { this->queue_->push(std::move(m)); }
+
+    // sends the n values from pos on
+    void send(lua_State *ls, int pos, int n) { this->send(message::pack(ls, pos, n)); }
+
+    // consumer only, false if nothing is queued
+    bool receive(message &m) { return this->queue_->pop(m); }
+
+    // consumer only, appends up to max queued messages to out, returns how many
+    size_t drain(std::vector<message> &out, size_t max = SIZE_MAX)
+    {
+        size_t n = 0;
+        message m;
+        while (n < max && this->queue_->pop(m))
+        {
+            out.push_back(std::move(m));
+            ++n;
+        }
+        return n;
+    }
+
+private:
+    std::shared_ptr<mpsc_queue<message>> queue_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// lua side of channel, registered by the engine as `channel`
+//   ch:send(...) queues the values as one message
+//   ch:receive() the values of the oldest message, nothing if none is queued
+//   ch:drain(f [, max]) calls f(values...) for each queued message, up to max, returns how many
+//     ran; an error in f is raised after the messages already taken were handled
+////////////////////////////////////////////////////////////////////////////////
+struct channel_registrar
+{
+    static void reg(lua_State *ls, const char *name)
+    {
+        Registrar<channel, ctor()>(ls, name)
+            .def_raw("send", &send)
+            .def_raw("receive", &receive)
+            .def_raw("drain", &drain)
+            //
+            ;
+    }
+
+    // pushes an object sharing ch's queue
+    static void push(lua_State *ls, const channel &ch)
+    {
+        stack_op<channel>::push_new(ls, new channel(ch));
+    }
+
+private:
+    static channel *check_channel(lua_State *ls)
+    {
+        auto *obj = static_cast<userdata::object_t<channel> *>(luaL_checkudata(ls, 1, type_info<channel>::metatable_name()));
+        ZLUA_ARG_CHECK_THROW(ls, obj->ptr != nullptr, 1, "released channel");
+        return obj->ptr;
+    }
+
+    static int send(lua_State *ls)
+    {
+        channel *ch = check_channel(ls);
+        ZLUA_CHECK_THROW(ls, lua_gettop(ls) > 1, "nothing to send");
+        ch->send(ls, 2, lua_gettop(ls) - 1);
+        return 0;
+    }
+
+    static int receive(lua_State *ls)
+    {
+        channel *ch = check_channel(ls);
+        message m;
+        return ch->receive(m) ? m.unpack(ls) : 0;
+    }
+
+    // no c++ object lives in this frame when lua_error runs
+    static int drain(lua_State *ls)
+    {
+        channel *ch = check_channel(ls);
+        luaL_checktype(ls, 2, LUA_TFUNCTION);
+        lua_Integer max = luaL_optinteger(ls, 3, -1); // -1 takes all
+        lua_settop(ls, 2);
+
+        lua_Integer n = 0;
+        bool failed = false;
+        while ((max < 0 || n < max) && !failed)
+        {
+            int nargs = 0;
+            {
+                message m;
+                if (!ch->receive(m))
+                {
+                    break;
+                }
+
+                lua_pushvalue(ls, 2);
+                nargs = m.unpack(ls);
+            }
+
+            ++n;
+            failed = lua_pcall(ls, nargs, 0, 0) != LUA_OK;
+        }
+
+        if (failed)
+        {
+            return lua_error(ls);
+        }
+
+        lua_pushinteger(ls, n);
+        return 1;
+    }
+};
+
+} // namespace zlua
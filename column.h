@@ -0,0 +1,255 @@
+#pragma once
+#include "common.h"
+#include "array.h"
+#include "meta.h"
+#include "span.h"
+#include "stack.h"
+#include "userdata.h"
+#include <memory>
+#include <string>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// column
+// reads/writes one registered field across a contiguous run of objects in a single call
+// numeric fields go through typed arrays, everything else through lua tables
+// integers that don't fit the other side (uint64_t above INT64_MAX, -1 into unsigned...)
+// raise instead of wrapping
+////////////////////////////////////////////////////////////////////////////////
+
+// integer representation of P, the underlying type of enums
+template <typename P, typename Enabled = void>
+struct column_int
+{
+    using type = P;
+};
+
+template <typename P>
+struct column_int<P, typename std::enable_if<std::is_enum<P>::value>::type>
+{
+    using type = typename std::underlying_type<P>::type;
+};
+
+// element type of the typed array used for field type P, void for lua table
+// uint32_t goes to int64 to keep its whole range
+template <typename P, typename Enabled = void>
+struct column_type
+{
+    using type = void;
+};
+
+template <typename P>
+struct column_type<P, typename std::enable_if<is_integral_type<P>::value>::type>
+{
+    using int_t = typename column_int<P>::type;
+    using type = typename std::conditional<(sizeof(int_t) < sizeof(int32_t)) || (sizeof(int_t) == sizeof(int32_t) && std::is_signed<int_t>::value), int32_t, int64_t>::type;
+};
+
+template <typename P>
+struct column_type<P, typename std::enable_if<std::is_floating_point<P>::value>::type>
+{
+    using type = typename std::conditional<std::is_same<P, float>::value, float, double>::type;
+};
+
+namespace impl
+{
+template <typename I>
+typename std::enable_if<std::is_signed<I>::value, bool>::type is_negative(I v) { return v < 0; }
+
+template <typename I>
+typename std::enable_if<!std::is_signed<I>::value, bool>::type is_negative(I) { return false; }
+
+// whether v keeps its value converted to To, floating point conversions always do
+template <typename To, typename From>
+typename std::enable_if<std::is_floating_point<To>::value || std::is_floating_point<From>::value, bool>::type
+column_fits(From)
+{
+    return true;
+}
+
+template <typename To, typename From>
+typename std::enable_if<!std::is_floating_point<To>::value && !std::is_floating_point<From>::value, bool>::type
+column_fits(From v)
+{
+    using to_t = typename column_int<To>::type;
+    using from_t = typename column_int<From>::type;
+
+    from_t f = static_cast<from_t>(v);
+    to_t t = static_cast<to_t>(f);
+    return static_cast<from_t>(t) == f && is_negative(t) == is_negative(f);
+}
+
+template <typename T, typename P, typename C = typename column_type<P>::type>
+struct column_op
+{
+    // member m of the object at p
+    template <typename M>
+    static P *at(const char *p, const M &m) { return userdata::member_of(reinterpret_cast<T *>(const_cast<char *>(p)), m); }
+
+    template <typename M>
+    static void gather(lua_State *ls, const M &m, const char *first, size_t stride, size_t n)
+    {
+        std::unique_ptr<array<C>> arr(new array<C>(n));
+        C *dst = arr->data();
+        for (size_t i = 0; i < n; ++i)
+        {
+            const P &v = *at(first + i * stride, m);
+            ZLUA_CHECK_THROW(ls, column_fits<C>(v), "column value " + std::to_string(i + 1) + " is out of the range of the typed array");
+            dst[i] = static_cast<C>(v);
+        }
+
+        stack_op<array<C>>::push_new(ls, arr.release());
+    }
+
+    template <typename M>
+    static void scatter(lua_State *ls, const M &m, char *first, size_t stride, size_t n, int pos)
+    {
+        void *data = nullptr;
+        size_t size = 0;
+        bool is_const = false;
+        if (!fetch_contiguous(ls, pos, type_tag<C>(), &data, &size, &is_const))
+        {
+            column_op<T, P, void>::scatter(ls, m, first, stride, n, pos);
+            return;
+        }
+
+        ZLUA_ARG_CHECK_THROW(ls, size == n, pos, "column size mismatch");
+        const C *src = static_cast<const C *>(data);
+
+        // checked first, a value out of range leaves every object as it was
+        for (size_t i = 0; i < n; ++i)
+        {
+            ZLUA_ARG_CHECK_THROW(ls, column_fits<P>(src[i]), pos, "column value " + std::to_string(i + 1) + " is out of the range of the field");
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            *at(first + i * stride, m) = static_cast<P>(src[i]);
+        }
+    }
+};
+
+template <typename T, typename P>
+struct column_op<T, P, void>
+{
+    // member m of the object at p
+    template <typename M>
+    static P *at(const char *p, const M &m) { return userdata::member_of(reinterpret_cast<T *>(const_cast<char *>(p)), m); }
+
+    template <typename M>
+    static void gather(lua_State *ls, const M &m, const char *first, size_t stride, size_t n)
+    {
+        lua_createtable(ls, static_cast<int>(n), 0);
+        for (size_t i = 0; i < n; ++i)
+        {
+            stack_op<P>::push(ls, *static_cast<const P *>(at(first + i * stride, m)));
+            lua_rawseti(ls, -2, static_cast<lua_Integer>(i + 1));
+        }
+    }
+
+    template <typename M>
+    static void scatter(lua_State *ls, const M &m, char *first, size_t stride, size_t n, int pos)
+    {
+        ZLUA_ARG_CHECK_THROW(ls, lua_istable(ls, pos), pos, "column values must be a table or typed array");
+        ZLUA_ARG_CHECK_THROW(ls, lua_rawlen(ls, pos) == n, pos, "column size mismatch");
+
+        pos = lua_absindex(ls, pos);
+        for (size_t i = 0; i < n; ++i)
+        {
+            lua_rawgeti(ls, pos, static_cast<lua_Integer>(i + 1));
+            stack_op<P>::peek(ls, *at(first + i * stride, m), -1);
+            lua_pop(ls, 1);
+        }
+    }
+};
+} // namespace impl
+
+// M is P T::* or userdata::member_path<T, ...> with leaf P
+template <typename T, typename P, typename M = P T::*>
+int gather_property_function(lua_State *ls, void *raw_property, const char *first, size_t stride, size_t n)
+{
+    auto *property = static_cast<userdata::property_t<M> *>(raw_property);
+    impl::column_op<T, P>::gather(ls, property->ptr, first, stride, n);
+    return 1;
+}
+
+template <typename T, typename P, typename M = P T::*>
+void scatter_property_function(lua_State *ls, void *raw_property, char *first, size_t stride, size_t n, int pos)
+{
+    auto *property = static_cast<userdata::property_t<M> *>(raw_property);
+    impl::column_op<T, P>::scatter(ls, property->ptr, first, stride, n, pos);
+}
+
+// looks up field `key` registered on T or one of its bases
+// offset receives the distance from T to the base declaring it
+template <typename T>
+userdata::property_base_t *find_property(lua_State *ls, const char *key, size_t *offset)
+{
+    *offset = 0;
+
+    luaL_getmetatable(ls, type_info<T>::metatable_name());
+    lua_pushstring(ls, key);
+    lua_rawget(ls, -2);
+    auto *property = lua_type(ls, -1) == LUA_TUSERDATA ? static_cast<userdata::property_base_t *>(lua_touserdata(ls, -1)) : nullptr;
+    lua_pop(ls, 2);
+
+    if (property != nullptr)
+    {
+        return property;
+    }
+
+    for (auto &info : type_info<T>::get_inheritance_info())
+    {
+        luaL_getmetatable(ls, ("zlua." + info.name).c_str());
+        lua_pushstring(ls, key);
+        lua_rawget(ls, -2);
+        property = lua_type(ls, -1) == LUA_TUSERDATA ? static_cast<userdata::property_base_t *>(lua_touserdata(ls, -1)) : nullptr;
+        lua_pop(ls, 2);
+
+        if (property != nullptr)
+        {
+            *offset = info.offset;
+            return property;
+        }
+    }
+
+    return nullptr;
+}
+
+// C is a contiguous container of T with data() and size()
+template <typename C, typename T = typename C::value_type>
+struct column_registrar
+{
+    // c:column(name)
+    static int gather(lua_State *ls)
+    {
+        auto *obj = static_cast<userdata::object_t<C> *>(luaL_checkudata(ls, 1, type_info<C>::metatable_name()));
+        const char *key = luaL_checkstring(ls, 2);
+
+        size_t offset = 0;
+        auto *property = find_property<T>(ls, key, &offset);
+        ZLUA_ARG_CHECK_THROW(ls, property != nullptr, 2, "no field '" + std::string(key) + "' registered on " + type_info<T>::name());
+
+        const char *first = reinterpret_cast<const char *>(obj->ptr->data()) + offset;
+        return property->gather_handler(ls, property->property, first, sizeof(T), obj->ptr->size());
+    }
+
+    // c:set_column(name, values)
+    static int scatter(lua_State *ls)
+    {
+        auto *obj = static_cast<userdata::object_t<C> *>(luaL_checkudata(ls, 1, type_info<C>::metatable_name()));
+        ZLUA_ARG_CHECK_THROW(ls, !obj->is_const, 1, "cannot modify const " + std::string(type_info<C>::name()));
+        const char *key = luaL_checkstring(ls, 2);
+
+        size_t offset = 0;
+        auto *property = find_property<T>(ls, key, &offset);
+        ZLUA_ARG_CHECK_THROW(ls, property != nullptr, 2, "no field '" + std::string(key) + "' registered on " + type_info<T>::name());
+
+        char *first = reinterpret_cast<char *>(const_cast<T *>(obj->ptr->data())) + offset;
+        property->scatter_handler(ls, property->property, first, sizeof(T), obj->ptr->size(), 3);
+        return 0;
+    }
+};
+
+} // namespace zlua
@@ -2,6 +2,8 @@
 #include "error.h"
 #include <lua/lua.hpp>
 #include <lua/lualib.h>
+#include <cassert>
+#include <cstring>
 #include <iostream>
 using std::boolalpha;
 using std::cout;
@@ -12,19 +14,21 @@ using std::endl;
 namespace zlua
 {
 
+namespace impl
+{
+// T out of "... [T = T]"
+inline std::string pretty_type_name(const std::string &pretty)
+{
+    size_t beg = pretty.find("[T =") + 5;
+    size_t end = pretty.rfind("]");
+    return pretty.substr(beg, end - beg);
+}
+} // namespace impl
+
 template <typename T>
 const static std::string &type_name()
 {
-    static std::string name;
-
-    if (name.empty())
-    {
-        name = __PRETTY_FUNCTION__;
-        size_t beg = name.find("[T =") + 5;
-        size_t end = name.rfind("]");
-        name = name.substr(beg, end - beg);
-    }
-
+    static const std::string name = impl::pretty_type_name(__PRETTY_FUNCTION__);
     return name;
 }
 } // namespace zlua
\ No newline at end of file
@@ -1,17 +1,128 @@
 #pragma once
 #include "common.h"
 #include "error.h"
+#include "marshal.h"
 #include "util.h"
 #include "userdata.h"
 
 namespace zlua
 {
-template <typename T>
-int metatable_index_function(lua_State *ls)
+////////////////////////////////////////////////////////////////////////////////
+// qualified globals
+// "array.float" lives in global table `array` under key `float`
+// intermediate tables are created on demand when setting
+////////////////////////////////////////////////////////////////////////////////
+inline void push_qualified_global(lua_State *ls, const char *name)
 {
-    auto *ud = static_cast<userdata::object_t<T> *>(lua_touserdata(ls, 1));
-    const char *key = luaL_checkstring(ls, 2);
+    const char *dot = strchr(name, '.');
+    if (dot == nullptr)
+    {
+        lua_getglobal(ls, name);
+        return;
+    }
+
+    lua_pushglobaltable(ls);
+    const char *beg = name;
+    while (dot != nullptr && lua_istable(ls, -1))
+    {
+        lua_pushlstring(ls, beg, dot - beg);
+        lua_rawget(ls, -2);
+        lua_remove(ls, -2);
+
+        beg = dot + 1;
+        dot = strchr(beg, '.');
+    }
 
+    if (!lua_istable(ls, -1))
+    {
+        lua_pop(ls, 1);
+        lua_pushnil(ls);
+        return;
+    }
+
+    lua_getfield(ls, -1, beg);
+    lua_remove(ls, -2);
+}
+
+// pops the value on top of stack and stores it in `name`
+inline void set_qualified_global(lua_State *ls, const char *name)
+{
+    const char *dot = strchr(name, '.');
+    if (dot == nullptr)
+    {
+        lua_setglobal(ls, name);
+        return;
+    }
+
+    lua_pushglobaltable(ls);
+    const char *beg = name;
+    while (dot != nullptr)
+    {
+        lua_pushlstring(ls, beg, dot - beg);
+        if (lua_rawget(ls, -2) != LUA_TTABLE)
+        {
+            lua_pop(ls, 1);
+            lua_newtable(ls);
+            lua_pushlstring(ls, beg, dot - beg);
+            lua_pushvalue(ls, -2);
+            lua_rawset(ls, -4);
+        }
+        lua_remove(ls, -2);
+
+        beg = dot + 1;
+        dot = strchr(beg, '.');
+    }
+
+    lua_insert(ls, -2);
+    lua_setfield(ls, -2, beg);
+    lua_pop(ls, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// threads
+// handles (table, function, lua_impl) keep the main thread, the thread that made them may
+// be a coroutine collected later, and do their work on the running thread of that state
+// the scheduler and batch calls record the task or item they resume in the extra space of
+// the main thread (lua_getextraspace), lua code that runs outside of them runs on main
+////////////////////////////////////////////////////////////////////////////////
+namespace impl
+{
+inline lua_State *main_thread(lua_State *ls)
+{
+    lua_rawgeti(ls, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    lua_State *main = lua_tothread(ls, -1);
+    lua_pop(ls, 1);
+    return main;
+}
+
+inline lua_State *&running_slot(lua_State *main)
+{
+    return *static_cast<lua_State **>(lua_getextraspace(main));
+}
+
+// the thread lua code of main's state runs on now, main itself outside of tasks
+inline lua_State *running_thread(lua_State *main)
+{
+    lua_State *running = running_slot(main);
+    return running != nullptr ? running : main;
+}
+
+// co is the running thread of main for the life of the guard
+struct running_guard
+{
+    running_guard(lua_State *main, lua_State *co) : main_(main), outer_(running_slot(main)) { running_slot(main) = co; }
+    ~running_guard() { running_slot(this->main_) = this->outer_; }
+
+    lua_State *main_;
+    lua_State *outer_;
+};
+} // namespace impl
+
+// pushes the metatable entry of key for the object at index 1, searching the bases of T
+// when found in a base, ud->offset is set to that base for the handler to consume
+template <typename T>
+int push_metatable_entry(lua_State *ls, userdata::object_t<T> *ud, const char *key)
+{
     auto n = luaL_getmetafield(ls, 1, key);
 
     if (n == LUA_TNIL && type_info<T>::is_inherited())
@@ -34,6 +145,17 @@ int metatable_index_function(lua_State *ls)
         }
     }
 
+    return n;
+}
+
+template <typename T>
+int metatable_index_function(lua_State *ls)
+{
+    auto *ud = static_cast<userdata::object_t<T> *>(lua_touserdata(ls, 1));
+    const char *key = luaL_checkstring(ls, 2);
+    ZLUA_ARG_CHECK_THROW(ls, ud->ptr != nullptr, 1, "index on a released object or finished cursor");
+
+    auto n = push_metatable_entry<T>(ls, ud, key);
     ZLUA_ARG_CHECK_THROW(ls, (n != LUA_TNIL), 1, (__PRETTY_FUNCTION__ + std::string("index nil ") + key).c_str());
 
     if (lua_isuserdata(ls, -1))
@@ -50,10 +172,11 @@ int metatable_index_function(lua_State *ls)
 template <typename T>
 int metatable_newindex_function(lua_State *ls)
 {
-    luaL_checkudata(ls, 1, type_info<T>::metatable_name());
+    auto *ud = static_cast<userdata::object_t<T> *>(luaL_checkudata(ls, 1, type_info<T>::metatable_name()));
     const char *key = luaL_checkstring(ls, 2);
+    ZLUA_ARG_CHECK_THROW(ls, ud->ptr != nullptr, 1, "newindex on a released object or finished cursor");
 
-    int n = luaL_getmetafield(ls, 1, key);
+    int n = push_metatable_entry<T>(ls, ud, key);
     ZLUA_ARG_CHECK_THROW(ls, (n != LUA_TNIL), 1, "newindex nil");
 
     if (lua_isuserdata(ls, -1))
@@ -64,34 +187,307 @@ int metatable_newindex_function(lua_State *ls)
     }
     else
     {
-        // pop
+        // not a field, nothing consumes a base offset found for it
+        ud->offset = 0;
     }
 
     return 0;
 }
 
-template <typename T, typename P>
-int access_property_function(lua_State *ls, void *raw_property, const char *key)
+////////////////////////////////////////////////////////////////////////////////
+// member proxies
+// obj.member where member is a bound class yields a proxy object pointing into obj's storage
+// one proxy per (object, member), cached in a weak-keyed registry table and repointed
+// on every access, so obj.a.b.c allocates nothing after the first read
+// the proxy anchors its parent through its uservalue
+////////////////////////////////////////////////////////////////////////////////
+template <typename P>
+struct is_proxy_member
+{
+    const static bool value =
+        std::is_class<P>::value &&
+        !std::is_same<P, std::string>::value &&
+        !is_tuple_type<P>::value &&
+        !is_pair_type<P>::value &&
+        !is_optional_type<P>::value &&
+        !is_span_type<P>::value &&
+        !is_string_view_type<P>::value &&
+        !is_lua_ref_type<P>::value &&
+        !is_reference_wrapper<P>::value;
+};
+
+inline const void *member_proxy_cache_key()
+{
+    static const char key = 0;
+    return &key;
+}
+
+// pushes the weak-keyed registry table under key, created on first use
+inline void push_weak_registry_table(lua_State *ls, const void *key)
 {
-    using property_t = userdata::property_t<P T::*>;
-    auto *property = static_cast<property_t *>(raw_property);
+    if (lua_rawgetp(ls, LUA_REGISTRYINDEX, key) != LUA_TTABLE)
+    {
+        lua_pop(ls, 1);
+        lua_newtable(ls);
 
+        lua_createtable(ls, 0, 1);
+        lua_pushstring(ls, "k");
+        lua_setfield(ls, -2, "__mode");
+        lua_setmetatable(ls, -2);
+
+        lua_pushvalue(ls, -1);
+        lua_rawsetp(ls, LUA_REGISTRYINDEX, key);
+    }
+}
+
+// pushes the proxy table of the object at index 1, {[property] = proxy}
+inline void push_member_proxies(lua_State *ls)
+{
+    push_weak_registry_table(ls, member_proxy_cache_key());
+
+    lua_pushvalue(ls, 1);
+    if (lua_rawget(ls, -2) != LUA_TTABLE)
+    {
+        lua_pop(ls, 1);
+        lua_createtable(ls, 0, 2);
+        lua_pushvalue(ls, 1);
+        lua_pushvalue(ls, -2);
+        lua_rawset(ls, -4);
+    }
+
+    lua_remove(ls, -2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// object views
+// cursors point into the storage of the object they anchor; they are
+// recorded per object in a weak registry table {[object] = {[view] = true}} so that an object
+// whose c++ pointer is taken away (zlua::channel) can release them with its member proxies
+////////////////////////////////////////////////////////////////////////////////
+inline const void *object_views_key()
+{
+    static const char key = 0;
+    return &key;
+}
+
+// records the userdata at view as pointing into the object at parent
+inline void add_object_view(lua_State *ls, int view, int parent)
+{
+    view = lua_absindex(ls, view);
+    parent = lua_absindex(ls, parent);
+
+    push_weak_registry_table(ls, object_views_key());
+    lua_pushvalue(ls, parent);
+    if (lua_rawget(ls, -2) != LUA_TTABLE)
+    {
+        lua_pop(ls, 1);
+        lua_newtable(ls);
+        lua_createtable(ls, 0, 1);
+        lua_pushstring(ls, "k");
+        lua_setfield(ls, -2, "__mode");
+        lua_setmetatable(ls, -2);
+
+        lua_pushvalue(ls, parent);
+        lua_pushvalue(ls, -2);
+        lua_rawset(ls, -4);
+    }
+
+    lua_pushvalue(ls, view);
+    lua_pushboolean(ls, 1);
+    lua_rawset(ls, -3);
+    lua_pop(ls, 2);
+}
+
+// releases the member proxies and views of the object at idx, and theirs, indexing them raises
+inline void release_object_views(lua_State *ls, int idx)
+{
+    ZLUA_CHECK_THROW(ls, lua_checkstack(ls, 6), "lua stack exhausted while releasing views");
+    idx = lua_absindex(ls, idx);
+
+    // proxies are the values of an object's entry, views the keys
+    const void *keys[] = {member_proxy_cache_key(), object_views_key()};
+    for (int k = 0; k < 2; ++k)
+    {
+        if (lua_rawgetp(ls, LUA_REGISTRYINDEX, keys[k]) == LUA_TTABLE)
+        {
+            lua_pushvalue(ls, idx);
+            if (lua_rawget(ls, -2) == LUA_TTABLE)
+            {
+                lua_pushvalue(ls, idx);
+                lua_pushnil(ls);
+                lua_rawset(ls, -4);
+
+                lua_pushnil(ls);
+                while (lua_next(ls, -2) != 0)
+                {
+                    int view = lua_absindex(ls, k == 0 ? -1 : -2);
+                    if (lua_type(ls, view) == LUA_TUSERDATA)
+                    {
+                        static_cast<userdata::object_t<void> *>(lua_touserdata(ls, view))->ptr = nullptr;
+                        release_object_views(ls, view);
+                    }
+                    lua_pop(ls, 1);
+                }
+            }
+            lua_pop(ls, 1);
+        }
+        lua_pop(ls, 1);
+    }
+}
+
+namespace impl
+{
+template <typename P, typename Enabled = void>
+struct member_op
+{
+    static void push(lua_State *ls, P *member, bool, bool, const void *)
+    {
+        stack_op<P>::push(ls, *member);
+    }
+};
+
+template <typename P>
+struct member_op<P, typename std::enable_if<is_proxy_member<P>::value>::type>
+{
+    static void push(lua_State *ls, P *member, bool is_const, bool is_cursor, const void *property)
+    {
+        push_member_proxies(ls);
+
+        if (lua_rawgetp(ls, -1, property) == LUA_TUSERDATA)
+        {
+            // parent may have been repointed (cursor) since the proxy was made
+            static_cast<userdata::object_t<P> *>(lua_touserdata(ls, -1))->ptr = member;
+            lua_remove(ls, -2);
+            return;
+        }
+        lua_pop(ls, 1);
+
+        void *proxy = lua_newuserdata(ls, sizeof(userdata::object_t<P>));
+        if (is_const)
+        {
+            new (proxy) userdata::object_t<const P>;
+        }
+        else
+        {
+            new (proxy) userdata::object_t<P>;
+        }
+        static_cast<userdata::object_t<P> *>(proxy)->ptr = member;
+        static_cast<userdata::object_t<P> *>(proxy)->is_cursor = is_cursor;
+        push_metatable<P>(ls);
+        lua_setmetatable(ls, -2);
+
+        lua_pushvalue(ls, 1);
+        lua_setuservalue(ls, -2);
+
+        lua_pushvalue(ls, -1);
+        lua_rawsetp(ls, -3, property);
+        lua_remove(ls, -2);
+    }
+};
+
+// object at index 1, adjusted to the base declaring the property
+template <typename T>
+T *property_owner(lua_State *ls, bool *is_const = nullptr, bool *is_cursor = nullptr)
+{
     auto *obj = static_cast<userdata::object_t<T> *>(lua_touserdata(ls, 1));
-    stack_op<P>::push(ls, obj->ptr->*(property->ptr));
+    T *t = reinterpret_cast<T *>((char *)obj->ptr + obj->offset);
+    obj->offset = 0;
+
+    if (is_const != nullptr)
+    {
+        *is_const = obj->is_const;
+    }
+    if (is_cursor != nullptr)
+    {
+        *is_cursor = obj->is_cursor;
+    }
+    return t;
+}
+} // namespace impl
+
+// M is P T::* or userdata::member_path<T, ...>
+template <typename T, typename M>
+int access_member_function(lua_State *ls, void *raw_property, const char *)
+{
+    auto *property = static_cast<userdata::property_t<M> *>(raw_property);
+
+    bool is_const = false;
+    bool is_cursor = false;
+    T *t = impl::property_owner<T>(ls, &is_const, &is_cursor);
+
+    auto *member = userdata::member_of(t, property->ptr);
+    impl::member_op<base_type_t<decltype(*member)>>::push(ls, member, is_const, is_cursor, raw_property);
     return 1;
 }
 
-template <typename T, typename P>
-int write_property_function(lua_State *ls, void *raw_property, const char *key)
+template <typename T, typename M>
+int write_member_function(lua_State *ls, void *raw_property, const char *key)
 {
-    using property_t = userdata::property_t<P T::*>;
-    auto *property = static_cast<property_t *>(raw_property);
+    auto *property = static_cast<userdata::property_t<M> *>(raw_property);
 
-    auto *obj = static_cast<userdata::object_t<T> *>(lua_touserdata(ls, 1));
-    stack_op<P>::pop(ls, obj->ptr->*(property->ptr));
+    bool is_const = false;
+    T *t = impl::property_owner<T>(ls, &is_const);
+    ZLUA_ARG_CHECK_THROW(ls, !is_const, 1, std::string("cannot assign ") + key + " of const " + type_info<T>::name());
+
+    auto *member = userdata::member_of(t, property->ptr);
+    stack_op<base_type_t<decltype(*member)>>::pop(ls, *member);
     return 0;
 }
 
+namespace impl
+{
+// field values in marshalled tables, class fields with registered fields nest as tables
+template <typename P, typename Enabled = void>
+struct field_op
+{
+    static void push(lua_State *ls, const P &p) { stack_op<P>::push(ls, p); }
+};
+
+template <typename P>
+struct field_op<P, typename std::enable_if<is_proxy_member<P>::value>::type>
+{
+    static void push(lua_State *ls, const P &p)
+    {
+        if (push_fields<P>(ls))
+        {
+            lua_pop(ls, 1);
+            marshal<P>::to_table(ls, p);
+            return;
+        }
+
+        stack_op<P>::push(ls, P(p));
+    }
+};
+} // namespace impl
+
+template <typename T, typename M>
+void get_member_function(lua_State *ls, void *raw_property, const void *obj)
+{
+    auto *property = static_cast<userdata::property_t<M> *>(raw_property);
+    auto *member = userdata::member_of(static_cast<T *>(const_cast<void *>(obj)), property->ptr);
+    impl::field_op<base_type_t<decltype(*member)>>::push(ls, *member);
+}
+
+template <typename T, typename M>
+void set_member_function(lua_State *ls, void *raw_property, void *obj, int pos)
+{
+    auto *property = static_cast<userdata::property_t<M> *>(raw_property);
+    auto *member = userdata::member_of(static_cast<T *>(obj), property->ptr);
+    stack_op<base_type_t<decltype(*member)>>::peek(ls, *member, pos);
+}
+
+template <typename T, typename P>
+int access_property_function(lua_State *ls, void *raw_property, const char *key)
+{
+    return access_member_function<T, P T::*>(ls, raw_property, key);
+}
+
+template <typename T, typename P>
+int write_property_function(lua_State *ls, void *raw_property, const char *key)
+{
+    return write_member_function<T, P T::*>(ls, raw_property, key);
+}
+
 template <typename T, typename R, typename... Args>
 int lua_function_forwarder(lua_State *ls)
 {
@@ -102,18 +498,58 @@ int lua_function_forwarder(lua_State *ls)
     obj_wrapper->offset = 0;
 
     method_t *func_wrapper = static_cast<method_t *>(lua_touserdata(ls, lua_upvalueindex(1)));
-    assert(!obj_wrapper->is_const || func_wrapper->is_const && "const object can't call non-const member function");
+    assert(!obj_wrapper->is_const || (func_wrapper->is_const && "const object can't call non-const member function"));
 
     using wrapped_tuple_t = pack_tuple_t<Args...>;
     wrapped_tuple_t params;
-    stack_op<wrapped_tuple_t>::pop(ls, params);
+    stack_op<wrapped_tuple_t>::pop(ls, params, -1, lua_gettop(ls) - 1);
+
+    return wrapped_tuple_invoke<T, R, decltype(params), Args...>::call(ls, func_wrapper->ptr, t, params);
+}
+
+// member function bound through out_params, outputs pushed after the return values
+template <typename T, typename R, typename... Args>
+int lua_out_params_forwarder(lua_State *ls)
+{
+    using method_t = userdata::method_t<R (T::*)(Args...)>;
+
+    userdata::object_t<T> *obj_wrapper = static_cast<userdata::object_t<T> *>(lua_touserdata(ls, 1));
+    T *t = reinterpret_cast<T *>(((char *)obj_wrapper->ptr + obj_wrapper->offset));
+    obj_wrapper->offset = 0;
+
+    method_t *func_wrapper = static_cast<method_t *>(lua_touserdata(ls, lua_upvalueindex(1)));
+    assert(!obj_wrapper->is_const || (func_wrapper->is_const && "const object can't call non-const member function"));
+
+    using wrapped_tuple_t = out_pack_tuple_t<Args...>;
+    wrapped_tuple_t params;
+    impl::out_params_op<sequence_t<Args...>>::template read<Args...>(ls, params);
+
+    int n = wrapped_tuple_invoke<T, R, wrapped_tuple_t, Args...>::call(ls, func_wrapper->ptr, t, params);
+    return n + impl::out_params_op<sequence_t<Args...>>::template push<Args...>(ls, params);
+}
+
+// free function registered as method of T, Self is T or const T
+template <typename T, typename Self, typename R, typename... Args>
+int lua_extension_forwarder(lua_State *ls)
+{
+    using function_t = userdata::function_t<R (*)(Self &, Args...)>;
+
+    userdata::object_t<T> *obj_wrapper = static_cast<userdata::object_t<T> *>(lua_touserdata(ls, 1));
+    Self *t = reinterpret_cast<Self *>(((char *)obj_wrapper->ptr + obj_wrapper->offset));
+    obj_wrapper->offset = 0;
 
-    wrapped_tuple_invoke<T, R, decltype(params), Args...>::call(ls, func_wrapper->ptr, t, params);
-    return element_size<R>::value;
+    function_t *func_wrapper = static_cast<function_t *>(lua_touserdata(ls, lua_upvalueindex(1)));
+    assert(!obj_wrapper->is_const || (std::is_const<Self>::value && "const object can't call non-const member function"));
+
+    using wrapped_tuple_t = pack_tuple_t<Args...>;
+    wrapped_tuple_t params;
+    stack_op<wrapped_tuple_t>::pop(ls, params, -1, lua_gettop(ls) - 1);
+
+    return wrapped_tuple_invoke<Self, R, decltype(params), Args...>::call(ls, func_wrapper->ptr, t, params);
 }
 
 template <typename T, typename... Args>
-int lua_object_creator(lua_State *ls)
+typename std::enable_if<!std::is_abstract<T>::value, int>::type lua_object_creator(lua_State *ls)
 {
     using wrapped_tuple_t = pack_tuple_t<Args...>;
     wrapped_tuple_t params;
@@ -125,12 +561,47 @@ int lua_object_creator(lua_State *ls)
     return 1;
 }
 
+// abstract types (interfaces) are registered for their methods, T.new only raises
+template <typename T, typename... Args>
+typename std::enable_if<std::is_abstract<T>::value, int>::type lua_object_creator(lua_State *)
+{
+    throw exception(std::string("cannot create ") + type_info<T>::name() + ", it is abstract");
+}
+
 template <typename T, typename... Args>
 int (*fetch_creator(void (*)(Args...)))(lua_State *)
 {
     return &lua_object_creator<T, Args...>;
 }
 
+// transfer descriptor of T, set in its metatable by Registrar
+template <typename T>
+struct object_transfer
+{
+    static const userdata::transfer_t *get()
+    {
+        static const userdata::transfer_t transfer = {&type_info<T>::metatable_name, &push_metatable<T>, &push, &destroy, &base_offset};
+        return &transfer;
+    }
+
+private:
+    static void push(lua_State *ls, void *ptr) { stack_op<T>::push_new(ls, static_cast<T *>(ptr)); }
+    static void destroy(void *ptr) { delete static_cast<T *>(ptr); }
+
+    static bool base_offset(const char *base, size_t *offset)
+    {
+        for (auto &info : type_info<T>::get_inheritance_info())
+        {
+            if (info.name == base)
+            {
+                *offset = info.offset;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
 template <typename T>
 int lua_object_deleter(lua_State *ls)
 {
@@ -0,0 +1,129 @@
+#pragma once
+#include "common.h"
+#include "core.h"
+#include "meta.h"
+#include "stack.h"
+#include "userdata.h"
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// cursor
+// for e in c:each() do ... end
+// one cursor userdata per loop, repointed at every element instead of pushing a new object
+//   the cursor is only valid inside the loop body, it is repointed by the next step
+//   and detached (any access throws) once the loop ends
+//   e:pin() copies the current element into a regular, lua-owned object
+// null pointers in pointer containers are skipped
+////////////////////////////////////////////////////////////////////////////////
+template <typename C>
+struct cursor_access;
+
+template <typename T>
+struct cursor_access<std::vector<T>>
+{
+    using element_t = T;
+    static T *get(std::vector<T> &c, size_t i) { return &c[i]; }
+    static size_t size(const std::vector<T> &c) { return c.size(); }
+};
+
+template <typename T>
+struct cursor_access<std::vector<T *>>
+{
+    using element_t = T;
+    static T *get(std::vector<T *> &c, size_t i) { return c[i]; }
+    static size_t size(const std::vector<T *> &c) { return c.size(); }
+};
+
+template <typename C>
+struct cursor_registrar
+{
+    using access_t = cursor_access<C>;
+    using element_t = typename access_t::element_t;
+
+    struct iteration_t
+    {
+        size_t next;
+        userdata::object_t<element_t> *cursor;
+    };
+
+    // c:each()
+    static int each(lua_State *ls)
+    {
+        auto *obj = static_cast<userdata::object_t<C> *>(luaL_checkudata(ls, 1, type_info<C>::metatable_name()));
+
+        auto *iteration = static_cast<iteration_t *>(lua_newuserdata(ls, sizeof(iteration_t)));
+        iteration->next = 0;
+
+        // keep constness of the container, cursor starts detached
+        void *cursor = lua_newuserdata(ls, sizeof(userdata::object_t<element_t>));
+        if (obj->is_const)
+        {
+            new (cursor) userdata::object_t<const element_t>;
+        }
+        else
+        {
+            new (cursor) userdata::object_t<element_t>;
+        }
+        iteration->cursor = static_cast<userdata::object_t<element_t> *>(cursor);
+        iteration->cursor->ptr = nullptr;
+        iteration->cursor->is_cursor = true;
+        luaL_setmetatable(ls, type_info<element_t>::metatable_name());
+
+        // the cursor anchors the container, and is released with it
+        lua_pushvalue(ls, 1);
+        lua_setuservalue(ls, -2);
+        add_object_view(ls, -1, 1);
+
+        // the container itself is read at every step, it may have been released meanwhile
+        lua_pushvalue(ls, 1);
+        lua_pushcclosure(ls, &next, 3);
+        return 1;
+    }
+
+private:
+    static int next(lua_State *ls)
+    {
+        auto *iteration = static_cast<iteration_t *>(lua_touserdata(ls, lua_upvalueindex(1)));
+        auto *owner = static_cast<userdata::object_t<C> *>(lua_touserdata(ls, lua_upvalueindex(3)));
+        ZLUA_CHECK_THROW(ls, owner->ptr != nullptr, "iterating a released container");
+        C &container = *owner->ptr;
+
+        while (iteration->next < access_t::size(container))
+        {
+            element_t *e = access_t::get(container, iteration->next++);
+            if (e != nullptr)
+            {
+                iteration->cursor->ptr = e;
+                lua_pushvalue(ls, lua_upvalueindex(2));
+                return 1;
+            }
+        }
+
+        iteration->cursor->ptr = nullptr;
+        lua_pushnil(ls);
+        return 1;
+    }
+};
+
+// obj:pin(), a copy of the current element for cursors, the object itself otherwise
+// the copy doesn't alias the container, it stays valid whatever happens to it
+template <typename T>
+int lua_object_pin(lua_State *ls)
+{
+    auto *obj = static_cast<userdata::object_t<T> *>(lua_touserdata(ls, 1));
+    if (obj == nullptr || !obj->is_cursor)
+    {
+        lua_settop(ls, 1);
+        return 1;
+    }
+
+    ZLUA_ARG_CHECK_THROW(ls, obj->ptr != nullptr, 1, "pin on a finished cursor");
+    ZLUA_ARG_CHECK_THROW(ls, std::is_copy_constructible<T>::value, 1, std::string("cannot pin ") + type_info<T>::name() + ", not copy constructible");
+
+    lua_settop(ls, 1);
+    return lua_object_cloner_wrapper<T>::clone(ls);
+}
+
+} // namespace zlua
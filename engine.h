@@ -1,6 +1,14 @@
 #pragma once
 #include "common.h"
 #include "register.h"
+#include "array.h"
+#include "buffer.h"
+#include "channel.h"
+#include "function.h"
+#include "interface.h"
+#include "map.h"
+#include "mmap.h"
+#include "table.h"
 #include <string>
 // #include <utility>
 
@@ -11,7 +19,7 @@ class Engine
 {
 public:
     Engine(lua_State *ls = nullptr)
-        : ls_(ls)
+        : ls_(ls), dtor_release_(false)
     {
         if (this->ls_ == nullptr)
         {
@@ -20,6 +28,9 @@ public:
             reg_basic_types();
             dtor_release_ = true;
         }
+
+        this->scheduler_.attach(this->ls_);
+        reg_async();
     }
 
     ~Engine()
@@ -58,6 +69,20 @@ public:
         return true;
     }
 
+    // runs the file within budget b, errors throw zlua::call_error
+    bool load_file(const std::string &file_name, const budget &b)
+    {
+        if (luaL_loadfile(this->ls_, file_name.c_str()) != LUA_OK)
+        {
+            std::string err = lua_tostring(this->ls_, -1);
+            lua_pop(this->ls_, 1);
+            throw call_error(err);
+        }
+
+        impl::budgeted_call<void>(this->ls_, b);
+        return true;
+    }
+
     template <typename T, typename C, typename... Bases>
     Registrar<T, C, Bases...> reg(const char *name)
     {
@@ -70,6 +95,182 @@ public:
         return std::move(EnumRegistrar<E>(this->ls_, name));
     }
 
+    // T is a zlua::lua_impl trampoline, methods name its slots in order
+    // lua implements the interface with name.implement(obj)
+    // the registrar returned is the interface's, its methods are def'd there
+    template <typename T>
+    Registrar<typename T::interface_t, ctor()> reg_interface(const char *name, std::initializer_list<const char *> methods)
+    {
+        Registrar<typename T::interface_t, ctor()> registrar(this->ls_, name);
+        interface_registrar<T>::reg(this->ls_, name, methods);
+        return registrar;
+    }
+
+    // M is std::map or std::unordered_map, bound as a live view
+    template <typename M>
+    void reg_map(const char *name)
+    {
+        map_registrar<M>::reg(this->ls_, name);
+    }
+
+    // exposes a C++ callable to lua as functor.<name>
+    // F is a zlua::functor, e.g. zlua::comparator<Role>
+    template <typename F, typename Fn>
+    void reg_functor(const char *name, Fn fn)
+    {
+        functor_registrar<F>::reg(this->ls_, name, F(std::move(fn)));
+    }
+
+    // handle of global table `name`, empty if there is none
+    table get_table(const char *name)
+    {
+        return table::global(this->ls_, name);
+    }
+
+    table new_table(int narr = 0, int nrec = 0)
+    {
+        return table::create(this->ls_, narr, nrec);
+    }
+
+    // calls global function `name` (dotted names walk tables), R may be void or a std::tuple
+    // lua errors throw zlua::call_error, hot paths hold a get_function handle instead
+    template <typename R, typename... Args>
+    R call(const char *name, Args &&... args)
+    {
+        lua_State *ls = impl::running_thread(this->ls_);
+        push_qualified_global(ls, name);
+        if (!lua_isfunction(ls, -1))
+        {
+            lua_pop(ls, 1);
+            throw call_error(std::string("no function '") + name + "'");
+        }
+
+        return impl::protected_call<R>(ls, std::forward<Args>(args)...);
+    }
+
+    // call within budget b, running out of it throws zlua::call_error with error_code::budget_exceeded
+    template <typename R, typename... Args>
+    R call(const budget &b, const char *name, Args &&... args)
+    {
+        lua_State *ls = impl::running_thread(this->ls_);
+        push_qualified_global(ls, name);
+        if (!lua_isfunction(ls, -1))
+        {
+            lua_pop(ls, 1);
+            throw call_error(std::string("no function '") + name + "'");
+        }
+
+        return impl::budgeted_call<R>(ls, b, std::forward<Args>(args)...);
+    }
+
+    // handle of global function `name` resolved once, empty if there is none
+    template <typename Sig>
+    function<Sig> get_function(const char *name)
+    {
+        push_qualified_global(this->ls_, name);
+        function<Sig> f(this->ls_, -1);
+        lua_pop(this->ls_, 1);
+        return f;
+    }
+
+    // outputs[i] = fn(inputs[i]) for every item in one crossing, returns the number that succeeded
+    // failed items are appended to errors and leave their output untouched
+    template <typename Sig, typename In, typename Out>
+    size_t call_batch(const function<Sig> &fn, span<In> inputs, span<Out> outputs, std::vector<batch_error> *errors = nullptr)
+    {
+        ZLUA_CHECK_THROW(this->ls_, fn.valid(), "batch call through an empty function handle");
+        lua_State *ls = impl::running_thread(this->ls_);
+        fn.push(ls);
+        return impl::batch_call(ls, inputs, outputs, errors);
+    }
+
+    template <typename In, typename Out>
+    size_t call_batch(const char *name, span<In> inputs, span<Out> outputs, std::vector<batch_error> *errors = nullptr)
+    {
+        lua_State *ls = impl::running_thread(this->ls_);
+        push_qualified_global(ls, name);
+        if (!lua_isfunction(ls, -1))
+        {
+            lua_pop(ls, 1);
+            throw call_error(std::string("no function '") + name + "'");
+        }
+
+        return impl::batch_call(ls, inputs, outputs, errors);
+    }
+
+    // starts global function `name` as a task, async calls in it suspend instead of blocking
+    // errors before its first suspension throw zlua::call_error
+    template <typename... Args>
+    void spawn(const char *name, Args &&... args)
+    {
+        push_qualified_global(this->ls_, name);
+        if (!lua_isfunction(this->ls_, -1))
+        {
+            lua_pop(this->ls_, 1);
+            throw call_error(std::string("no function '") + name + "'");
+        }
+
+        int expand[] = {0, (stack_op<typename std::decay<Args>::type>::push(this->ls_, std::forward<Args>(args)), 0)...};
+        (void)expand;
+
+        std::string err;
+        if (!this->scheduler_.spawn(this->ls_, static_cast<int>(sizeof...(Args)), &err))
+        {
+            throw call_error(err);
+        }
+    }
+
+    // resumes the tasks whose async calls completed, timers expired or events were signalled
+    // returns how many were resumed, errors of tasks that fail are appended to errors
+    size_t poll(std::vector<std::string> *errors = nullptr)
+    {
+        return this->scheduler_.poll(errors);
+    }
+
+    // polls until deadline or until no task is left, sleeping while no task is due
+    size_t run_until(std::chrono::steady_clock::time_point deadline, std::vector<std::string> *errors = nullptr)
+    {
+        return this->scheduler_.run_until(deadline, errors);
+    }
+
+    // wakes the tasks waiting in async.wait(name) with args, they run at the next poll
+    template <typename... Args>
+    size_t signal(const char *name, Args &&... args)
+    {
+        int expand[] = {0, (stack_op<typename std::decay<Args>::type>::push(this->ls_, std::forward<Args>(args)), 0)...};
+        (void)expand;
+        return this->scheduler_.signal(this->ls_, name, static_cast<int>(sizeof...(Args)));
+    }
+
+    // tasks suspended on async calls, yields, timers or events
+    size_t pending_tasks() const
+    {
+        return this->scheduler_.pending();
+    }
+
+    // key string interned once, for hot table reads
+    table_key make_key(const char *key)
+    {
+        return table_key(this->ls_, key);
+    }
+
+#ifdef ZLUA_MMAP
+    // maps path read-only into global `name`
+    // the pages are shared with every engine of the process mapping the same file
+    void map_file(const char *name, const std::string &path)
+    {
+        mapped_view_registrar::push(this->ls_, mapped_view::open(path));
+        set_qualified_global(this->ls_, name);
+    }
+#endif
+
+    // ch into global `name`, engines given copies of one channel share its queue
+    void set_channel(const char *name, const channel &ch)
+    {
+        channel_registrar::push(this->ls_, ch);
+        set_qualified_global(this->ls_, name);
+    }
+
 private:
     void reg_basic_types()
     {
@@ -89,12 +290,44 @@ private:
             .def("atc", (int &(std::vector<int>::*)(size_t)) & std::vector<int>::at)
             .def("clear", &std::vector<int>::clear)
             .def("size", &std::vector<int>::size)
+            .def("sort", &parallel::sort<int>)
+            .def("stable_sort", &parallel::stable_sort<int>)
+            .def("reduce", &parallel::reduce<int>)
+            .def("transform", &parallel::transform<int>)
+            .def("partition", &parallel::partition<int>)
             //
             ;
+
+        array_registrar<int32_t>::reg(this->ls_, "array.int32");
+        array_registrar<int64_t>::reg(this->ls_, "array.int64");
+        array_registrar<float>::reg(this->ls_, "array.float");
+        array_registrar<double>::reg(this->ls_, "array.double");
+
+        buffer_registrar::reg(this->ls_, "buffer");
+#ifdef ZLUA_MMAP
+        mapped_view_registrar::reg(this->ls_, "mapped");
+#endif
+        channel_registrar::reg(this->ls_, "channel");
+    }
+
+    // async.spawn(f, ...), async.sleep(seconds), async.wait(name), async.signal(name, ...)
+    void reg_async()
+    {
+        lua_newtable(this->ls_);
+        lua_pushcfunction(this->ls_, &lua_async_spawn);
+        lua_setfield(this->ls_, -2, "spawn");
+        lua_pushcfunction(this->ls_, &lua_async_sleep);
+        lua_setfield(this->ls_, -2, "sleep");
+        lua_pushcfunction(this->ls_, &lua_async_wait);
+        lua_setfield(this->ls_, -2, "wait");
+        lua_pushcfunction(this->ls_, &lua_async_signal);
+        lua_setfield(this->ls_, -2, "signal");
+        lua_setglobal(this->ls_, "async");
     }
 
     lua_State *ls_;
     bool dtor_release_;
+    async_scheduler scheduler_;
 };
 
 } // namespace zlua
\ No newline at end of file
@@ -40,4 +40,24 @@ private:
     char msg_[128];
 };
 
+enum class error_code
+{
+    runtime,         // error raised by the lua code
+    budget_exceeded, // the call ran out of its zlua::budget
+};
+
+// error raised by lua code called from c++, keeps the whole message and traceback
+class call_error : public exception
+{
+public:
+    call_error(const std::string &msg, error_code code = error_code::runtime) : exception(""), msg_(msg), code_(code) {}
+    virtual const char *what() const noexcept { return this->msg_.c_str(); }
+
+    error_code code() const { return this->code_; }
+
+private:
+    std::string msg_;
+    error_code code_;
+};
+
 } // namespace zlua
\ No newline at end of file
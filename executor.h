@@ -0,0 +1,263 @@
+#pragma once
+#include "common.h"
+#include "engine.h"
+#include "schema.h"
+#include "thread_pool.h"
+#include "traits.h"
+#include "util.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// Executor
+// one engine per worker thread, built from a schema, running script calls with work stealing
+//   zlua::Executor executor(64, schema);
+//   std::future<double> score = executor.submit<double>("score", user_id, weights);
+//   std::future<void> flush = executor.submit_to<void>(3, "flush");     -- only worker 3 runs it
+// every worker has a deque: it takes its own work from the back and idle workers steal from
+// the front of the others, tasks submitted from a worker go to its own deque
+// a task runs start to end on one engine, no lua state is ever touched by two threads;
+// arguments are copied into the task and pushed on the worker, the result is copied out,
+// so neither may be a lua handle (zlua::table, zlua::function), lua errors throw from future::get
+// the destructor runs every queued task before joining the workers
+////////////////////////////////////////////////////////////////////////////////
+class Executor
+{
+public:
+    using task_t = std::function<void(Engine &)>;
+
+    Executor(size_t n, const Schema &schema)
+        : workers_(n), stopped_(false), stealable_(0), next_(0)
+    {
+        ZLUA_CHECK_THROW(nullptr, n > 0, "executor without workers");
+        thread_pool::shared().parallel_for(n, [this, &schema](size_t i) {
+            this->workers_[i].engine = schema.build();
+        });
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            this->workers_[i].thread = std::thread([this, i] { this->run(i); });
+        }
+    }
+
+    ~Executor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->stopped_ = true;
+        }
+
+        this->cond_.notify_all();
+        for (auto &worker : this->workers_)
+        {
+            worker.thread.join();
+        }
+    }
+
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    size_t size() const { return this->workers_.size(); }
+
+    // global function `name`(args...) on any engine
+    template <typename R, typename... Args>
+    std::future<R> submit(const char *name, Args &&... args)
+    {
+        return this->enqueue<R>(-1, name, std::forward<Args>(args)...);
+    }
+
+    // global function `name`(args...) on the engine of worker, never stolen
+    template <typename R, typename... Args>
+    std::future<R> submit_to(size_t worker, const char *name, Args &&... args)
+    {
+        ZLUA_CHECK_THROW(nullptr, worker < this->size(), "no worker " + std::to_string(worker));
+        return this->enqueue<R>(static_cast<int>(worker), name, std::forward<Args>(args)...);
+    }
+
+    // index of the calling worker thread of this executor, -1 from other threads
+    int worker_index() const
+    {
+        return current().owner == this ? current().index : -1;
+    }
+
+private:
+    struct worker_t
+    {
+        std::unique_ptr<Engine> engine;
+        std::thread thread;
+
+        std::mutex mutex;
+        std::deque<task_t> tasks;  // own work at the back, stolen from the front
+        std::deque<task_t> pinned; // affinity tasks, only run here
+        size_t pinned_count = 0;   // guarded by the executor's mutex_, for waiting
+    };
+
+    struct current_t
+    {
+        const Executor *owner;
+        int index;
+    };
+
+    static current_t &current()
+    {
+        static thread_local current_t c = {nullptr, -1};
+        return c;
+    }
+
+    // name(args...) with the arguments copied at submission
+    template <typename R, typename Seq, typename... Ts>
+    struct call_t;
+
+    template <typename R, size_t... S, typename... Ts>
+    struct call_t<R, sequence<S...>, Ts...>
+    {
+        R operator()(Engine &engine)
+        {
+            return engine.call<R>(this->name.c_str(), std::get<S>(this->args)...);
+        }
+
+        std::string name;
+        std::tuple<Ts...> args;
+    };
+
+    template <typename R, typename... Args>
+    std::future<R> enqueue(int worker, const char *name, Args &&... args)
+    {
+        static_assert(!is_lua_ref_type<R>::value, "lua handles can't leave the engine of the task");
+        static_assert(!has_lua_ref_type<typename std::decay<Args>::type...>::value, "lua handles can't be passed to another engine");
+
+        using call_type = call_t<R, sequence_t<Args...>, typename std::decay<Args>::type...>;
+        auto task = std::make_shared<std::packaged_task<R(Engine &)>>(
+            call_type{name, std::make_tuple(std::forward<Args>(args)...)});
+        std::future<R> future = task->get_future();
+
+        this->push(worker, [task](Engine &engine) { (*task)(engine); });
+        return future;
+    }
+
+    void push(int worker, task_t task)
+    {
+        bool pinned = worker >= 0;
+        if (!pinned)
+        {
+            worker = this->worker_index();
+            if (worker < 0)
+            {
+                worker = static_cast<int>(this->next_.fetch_add(1) % this->size());
+            }
+        }
+
+        // counted first, so a worker that takes it early never sees a count below zero
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            ++(pinned ? this->workers_[worker].pinned_count : this->stealable_);
+        }
+
+        {
+            worker_t &w = this->workers_[worker];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            (pinned ? w.pinned : w.tasks).push_back(std::move(task));
+        }
+
+        // pinned work wakes everyone so its worker is among them
+        if (pinned)
+        {
+            this->cond_.notify_all();
+        }
+        else
+        {
+            this->cond_.notify_one();
+        }
+    }
+
+    // next task for worker i: its pinned ones, its own newest, then the oldest of another
+    bool take(size_t i, task_t &task)
+    {
+        {
+            worker_t &w = this->workers_[i];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (!w.pinned.empty())
+            {
+                task = std::move(w.pinned.front());
+                w.pinned.pop_front();
+                this->taken(&w.pinned_count);
+                return true;
+            }
+
+            if (!w.tasks.empty())
+            {
+                task = std::move(w.tasks.back());
+                w.tasks.pop_back();
+                this->taken(&this->stealable_);
+                return true;
+            }
+        }
+
+        for (size_t k = 1; k < this->size(); ++k)
+        {
+            worker_t &victim = this->workers_[(i + k) % this->size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                this->taken(&this->stealable_);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void taken(size_t *count)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        --*count;
+    }
+
+    void run(size_t i)
+    {
+        current().owner = this;
+        current().index = static_cast<int>(i);
+
+        worker_t &w = this->workers_[i];
+        task_t task;
+        for (;;)
+        {
+            if (this->take(i, task))
+            {
+                task(*w.engine);
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            if (this->stopped_ && this->stealable_ == 0 && w.pinned_count == 0)
+            {
+                return;
+            }
+
+            this->cond_.wait(lock, [this, &w] { return this->stopped_ || this->stealable_ > 0 || w.pinned_count > 0; });
+        }
+    }
+
+    std::vector<worker_t> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stopped_;
+    size_t stealable_;
+    std::atomic<size_t> next_;
+};
+
+} // namespace zlua
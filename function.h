@@ -0,0 +1,382 @@
+#pragma once
+#include "common.h"
+#include "budget.h"
+#include "error.h"
+#include "span.h"
+#include "stack.h"
+#include "table.h"
+#include <functional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// function
+// lua function callable from c++, held by registry reference
+//   void on_event(zlua::function<bool(Event &, int)> handler) { handlers_.push_back(handler); }
+//   handler(e, 3)
+// a call pushes the referenced function, pushes arguments with stack_op and lua_pcall's it,
+// nothing is allocated and no global is looked up; errors throw zlua::call_error with traceback
+// parameters may also be std::function<R(Args...)>, which wraps a zlua::function
+// handles must not outlive the lua state they were made from
+////////////////////////////////////////////////////////////////////////////////
+namespace impl
+{
+// message handler of protected calls, a light c function so pushing it allocates nothing
+inline int traceback_handler(lua_State *ls)
+{
+    const char *msg = lua_tostring(ls, 1);
+    if (msg == nullptr)
+    {
+        msg = lua_pushfstring(ls, "(error object is a %s value)", luaL_typename(ls, 1));
+    }
+
+    luaL_traceback(ls, ls, msg, 1);
+    return 1;
+}
+
+// results of a protected call, R decoded from the top count values
+template <typename R>
+struct call_result
+{
+    static_assert(!std::is_reference<R>::value, "lua function results are returned by value");
+    static_assert(!std::is_pointer<R>::value || !is_string_type<base_type_t<R>>::value, "return std::string instead, the lua string may be collected");
+
+    const static int count = 1;
+
+    static R get(lua_State *ls)
+    {
+        R r{};
+        stack_op<R>::peek(ls, r, -1);
+        return r;
+    }
+};
+
+template <>
+struct call_result<void>
+{
+    const static int count = 0;
+
+    static void get(lua_State *) {}
+};
+
+template <typename... Ts>
+struct call_result<std::tuple<Ts...>>
+{
+    const static int count = sizeof...(Ts);
+
+    static std::tuple<Ts...> get(lua_State *ls)
+    {
+        std::tuple<Ts...> t;
+        tuple_op<sizeof...(Ts)>::pop(ls, t, 0);
+        return t;
+    }
+};
+
+// calls the function at func with the values already above it followed by args
+// the stack is left as it was below the function
+template <typename R, typename... Args>
+R protected_call_at(lua_State *ls, int func, Args &&... args)
+{
+    stack_restorer restorer(ls, func - 1);
+
+    lua_pushcfunction(ls, &traceback_handler);
+    lua_insert(ls, func);
+
+    int expand[] = {0, (stack_op<typename std::decay<Args>::type>::push(ls, std::forward<Args>(args)), 0)...};
+    (void)expand;
+
+    if (lua_pcall(ls, lua_gettop(ls) - func - 1, call_result<R>::count, func) != LUA_OK)
+    {
+        throw call_error(lua_tostring(ls, -1));
+    }
+
+    return call_result<R>::get(ls);
+}
+
+// calls the function on top of stack with args
+template <typename R, typename... Args>
+R protected_call(lua_State *ls, Args &&... args)
+{
+    return protected_call_at<R>(ls, lua_gettop(ls), std::forward<Args>(args)...);
+}
+
+// same within budget b, running out of it throws call_error with error_code::budget_exceeded
+template <typename R, typename... Args>
+R budgeted_call(lua_State *ls, const budget &b, Args &&... args)
+{
+    budget_scope scope(ls, b);
+    try
+    {
+        return protected_call_at<R>(ls, lua_gettop(ls), std::forward<Args>(args)...);
+    }
+    catch (const call_error &e)
+    {
+        if (!scope.exceeded())
+        {
+            throw;
+        }
+        throw call_error(e.what(), error_code::budget_exceeded);
+    }
+}
+} // namespace impl
+
+template <typename R, typename... Args>
+class function<R(Args...)>
+{
+public:
+    function() : ls_(nullptr), ref_(LUA_NOREF) {}
+
+    // references the function at pos, nil gives an empty handle
+    // the handle keeps the main thread, the coroutine a handler was passed from may be gone
+    function(lua_State *ls, int pos)
+        : ls_(nullptr), ref_(LUA_NOREF)
+    {
+        if (lua_isnoneornil(ls, pos))
+        {
+            return;
+        }
+
+        ZLUA_ARG_CHECK_THROW(ls, lua_isfunction(ls, pos), pos, "not a function");
+        lua_pushvalue(ls, pos);
+        this->ls_ = impl::main_thread(ls);
+        this->ref_ = luaL_ref(ls, LUA_REGISTRYINDEX);
+    }
+
+    ~function() { this->reset(); }
+
+    function(const function &rhs) : ls_(nullptr), ref_(LUA_NOREF)
+    {
+        if (rhs.valid())
+        {
+            lua_State *ls = impl::running_thread(rhs.ls_);
+            rhs.push(ls);
+            this->ls_ = rhs.ls_;
+            this->ref_ = luaL_ref(ls, LUA_REGISTRYINDEX);
+        }
+    }
+
+    function(function &&rhs) : ls_(rhs.ls_), ref_(rhs.ref_)
+    {
+        rhs.ls_ = nullptr;
+        rhs.ref_ = LUA_NOREF;
+    }
+
+    function &operator=(function rhs)
+    {
+        std::swap(this->ls_, rhs.ls_);
+        std::swap(this->ref_, rhs.ref_);
+        return *this;
+    }
+
+    bool valid() const { return this->ls_ != nullptr; }
+    explicit operator bool() const { return this->valid(); }
+    lua_State *state() const { return this->ls_; }
+
+    // pushes the function, nil for an empty handle
+    void push(lua_State *ls) const
+    {
+        if (this->valid())
+        {
+            lua_rawgeti(ls, LUA_REGISTRYINDEX, this->ref_);
+        }
+        else
+        {
+            lua_pushnil(ls);
+        }
+    }
+
+    // objects passed by reference reach lua as views, by value as copies
+    // runs on the running thread, a handler called from a task runs within that task
+    R operator()(Args... args) const
+    {
+        ZLUA_CHECK_THROW(this->ls_, this->valid(), "call through an empty function handle");
+        lua_State *ls = impl::running_thread(this->ls_);
+        this->push(ls);
+        return impl::protected_call<R>(ls, std::forward<Args>(args)...);
+    }
+
+    // call within budget b
+    R call(const budget &b, Args... args) const
+    {
+        ZLUA_CHECK_THROW(this->ls_, this->valid(), "call through an empty function handle");
+        lua_State *ls = impl::running_thread(this->ls_);
+        this->push(ls);
+        return impl::budgeted_call<R>(ls, b, std::forward<Args>(args)...);
+    }
+
+private:
+    void reset()
+    {
+        if (this->ls_ != nullptr)
+        {
+            luaL_unref(impl::running_thread(this->ls_), LUA_REGISTRYINDEX, this->ref_);
+            this->ls_ = nullptr;
+            this->ref_ = LUA_NOREF;
+        }
+    }
+
+    lua_State *ls_;
+    int ref_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// batch calls
+// one lua function over many inputs: the function is pushed once and every item runs on
+// the same worker coroutine, tuple inputs spread into several arguments
+// a failing item is reported and skipped, its output is left untouched; a zlua::exception
+// thrown by a bound function only unwinds the worker, which is replaced for the next item
+////////////////////////////////////////////////////////////////////////////////
+struct batch_error
+{
+    size_t index;
+    std::string message;
+};
+
+namespace impl
+{
+template <typename In>
+struct batch_input
+{
+    const static int count = 1;
+
+    static void push(lua_State *ls, const In &in) { stack_op<In>::push(ls, in); }
+};
+
+template <typename... Ts>
+struct batch_input<std::tuple<Ts...>>
+{
+    const static int count = sizeof...(Ts);
+
+    static void push(lua_State *ls, const std::tuple<Ts...> &in)
+    {
+        std::tuple<Ts...> t(in);
+        stack_op<std::tuple<Ts...>>::push(ls, t);
+    }
+};
+
+// runs the function at func of ls on co with in, decodes its result into out
+// false with err set if the item failed, co can't run another item then
+template <typename In, typename Out>
+bool batch_item(lua_State *ls, lua_State *co, int func, const In &in, Out &out, std::string *err)
+{
+    try
+    {
+        lua_pushvalue(ls, func);
+        lua_xmove(ls, co, 1);
+        batch_input<In>::push(co, in);
+
+        int status = lua_resume(co, ls, batch_input<In>::count);
+        if (status == LUA_YIELD)
+        {
+            *err = "attempt to yield from a batch call";
+            return false;
+        }
+
+        if (status != LUA_OK)
+        {
+            const char *msg = lua_tostring(co, -1);
+            luaL_traceback(ls, co, msg != nullptr ? msg : "(error object is not a string)", 0);
+            *err = lua_tostring(ls, -1);
+            lua_pop(ls, 1);
+            return false;
+        }
+
+        lua_settop(co, call_result<Out>::count);
+        out = call_result<Out>::get(co);
+        lua_settop(co, 0);
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        *err = e.what();
+        return false;
+    }
+}
+
+// calls the function on top of stack once per input, returns the number of items that succeeded
+template <typename In, typename Out>
+size_t batch_call(lua_State *ls, span<In> inputs, span<Out> outputs, std::vector<batch_error> *errors)
+{
+    using input_t = typename std::remove_const<In>::type;
+
+    int func = lua_gettop(ls);
+    stack_restorer restorer(ls, func - 1);
+    ZLUA_CHECK_THROW(ls, outputs.size() >= inputs.size(), "batch outputs smaller than inputs");
+
+    lua_State *co = lua_newthread(ls);
+    int worker = lua_gettop(ls);
+
+    // handles used by bound functions the items call run on the worker
+    running_guard running(main_thread(ls), co);
+
+    size_t succeeded = 0;
+    std::string err;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        if (batch_item<input_t, Out>(ls, co, func, inputs[i], outputs[i], &err))
+        {
+            ++succeeded;
+            continue;
+        }
+
+        if (errors != nullptr)
+        {
+            errors->push_back(batch_error{i, err});
+        }
+        co = lua_newthread(ls);
+        lua_replace(ls, worker);
+        running_slot(running.main_) = co;
+    }
+
+    return succeeded;
+}
+} // namespace impl
+
+template <typename Sig>
+struct stack_op<function<Sig>>
+{
+    static void push(lua_State *ls, const function<Sig> &f)
+    {
+        f.push(ls);
+    }
+
+    static void peek(lua_State *ls, function<Sig> &f, int pos = -1)
+    {
+        f = function<Sig>(ls, pos);
+    }
+
+    static void pop(lua_State *ls, function<Sig> &f, int pos = -1)
+    {
+        peek(ls, f, pos);
+        lua_remove(ls, pos);
+    }
+};
+
+// nil gives an empty std::function
+template <typename Sig>
+struct stack_op<std::function<Sig>>
+{
+    static void peek(lua_State *ls, std::function<Sig> &f, int pos = -1)
+    {
+        function<Sig> handle(ls, pos);
+        if (handle.valid())
+        {
+            f = std::move(handle);
+        }
+        else
+        {
+            f = nullptr;
+        }
+    }
+
+    static void pop(lua_State *ls, std::function<Sig> &f, int pos = -1)
+    {
+        peek(ls, f, pos);
+        lua_remove(ls, pos);
+    }
+};
+
+} // namespace zlua
@@ -0,0 +1,73 @@
+#pragma once
+#include "common.h"
+#include "core.h"
+#include "meta.h"
+#include "stack.h"
+#include <functional>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// functor
+// C++ callable registered under a name and handed to lua as an opaque object
+// lua can pass it back to registered functions (e.g. vector:sort(functor.by_age))
+// but never call it nor replace it with a lua closure,
+// so it is safe to invoke from any thread
+////////////////////////////////////////////////////////////////////////////////
+template <typename Sig>
+class functor;
+
+template <typename R, typename... Args>
+class functor<R(Args...)>
+{
+public:
+    functor() {}
+
+    template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, functor>::value>::type>
+    functor(F f) : f_(std::move(f)) {}
+
+    R operator()(Args... args) const { return this->f_(std::forward<Args>(args)...); }
+
+    explicit operator bool() const { return static_cast<bool>(this->f_); }
+
+private:
+    std::function<R(Args...)> f_;
+};
+
+template <typename T>
+using comparator = functor<bool(const T &, const T &)>;
+
+template <typename T>
+using predicate = functor<bool(const T &)>;
+
+template <typename T>
+using reducer = functor<T(const T &, const T &)>;
+
+template <typename T>
+using transformer = functor<T(const T &)>;
+
+template <typename F>
+struct functor_registrar
+{
+    // stores f as global functor.<name>
+    static void reg(lua_State *ls, const char *name, F &&f)
+    {
+        if (!type_info<F>::is_registered())
+        {
+            type_info<F>::set_name(("functor<" + type_name<F>() + ">").c_str());
+        }
+
+        if (luaL_newmetatable(ls, type_info<F>::metatable_name()) != 0)
+        {
+            lua_pushstring(ls, "__gc");
+            lua_pushcfunction(ls, &lua_object_deleter<F>);
+            lua_rawset(ls, -3);
+        }
+        lua_pop(ls, 1);
+
+        stack_op<F>::push_new(ls, new F(std::move(f)));
+        set_qualified_global(ls, (std::string("functor.") + name).c_str());
+    }
+};
+
+} // namespace zlua
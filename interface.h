@@ -0,0 +1,233 @@
+#pragma once
+#include "common.h"
+#include "error.h"
+#include "function.h"
+#include "meta.h"
+#include "register.h"
+#include "stack.h"
+#include "table.h"
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// lua_impl
+// c++ interface I implemented by a lua table or class instance, through a trampoline
+//   struct LuaStrategy : zlua::lua_impl<LuaStrategy, Strategy>
+//   {
+//       int decide(int tick) override { return this->call<int>(0, tick); }
+//       std::string name() const override { return this->overridden(1) ? this->call<std::string>(1) : Strategy::name(); }
+//   };
+//   engine.reg_interface<LuaStrategy>("Strategy", {"decide", "name"}).def("decide", &Strategy::decide);
+//   local s = Strategy.implement(obj)      -- zlua::implement<LuaStrategy>(table) from c++
+// the interface is registered as name, the trampoline as name.impl with the interface as its base,
+// so implementations reach Strategy * parameters and Strategy methods at the right offset
+// slot i is the i-th method name, looked up in the object (through its metatable) once
+// when bound and called with the object as self; slots it lacks cost no lua call
+// the object is held by registry reference for the life of the trampoline, calls run on the
+// running thread, within the task that calls the trampoline
+////////////////////////////////////////////////////////////////////////////////
+template <typename Derived, typename I>
+class lua_impl : public I
+{
+public:
+    using interface_t = I;
+
+    lua_impl() : ls_(nullptr), self_(LUA_NOREF) {}
+
+    ~lua_impl() { this->reset(); }
+
+    lua_impl(const lua_impl &rhs) : I(rhs), ls_(nullptr), self_(LUA_NOREF)
+    {
+        this->copy_refs(rhs);
+    }
+
+    lua_impl &operator=(const lua_impl &rhs)
+    {
+        if (this != &rhs)
+        {
+            I::operator=(rhs);
+            this->reset();
+            this->copy_refs(rhs);
+        }
+        return *this;
+    }
+
+    // method names by slot, set by reg_interface
+    static std::vector<std::string> &methods()
+    {
+        static std::vector<std::string> names;
+        return names;
+    }
+
+    // resolves every slot in the table/object at pos
+    void bind(lua_State *ls, int pos)
+    {
+        pos = lua_absindex(ls, pos);
+        ZLUA_ARG_CHECK_THROW(ls, lua_istable(ls, pos) || lua_isuserdata(ls, pos), pos, "not a table or object");
+        this->reset();
+
+        const std::vector<std::string> &names = methods();
+        this->refs_.assign(names.size(), LUA_NOREF);
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            lua_getfield(ls, pos, names[i].c_str());
+            if (lua_isfunction(ls, -1))
+            {
+                this->refs_[i] = luaL_ref(ls, LUA_REGISTRYINDEX);
+            }
+            else
+            {
+                lua_pop(ls, 1);
+            }
+        }
+
+        lua_pushvalue(ls, pos);
+        this->self_ = luaL_ref(ls, LUA_REGISTRYINDEX);
+        this->ls_ = impl::main_thread(ls);
+    }
+
+    bool bound() const { return this->ls_ != nullptr; }
+
+    // pushes the implementing object, nil when unbound
+    void push_self(lua_State *ls) const
+    {
+        if (this->bound())
+        {
+            lua_rawgeti(ls, LUA_REGISTRYINDEX, this->self_);
+        }
+        else
+        {
+            lua_pushnil(ls);
+        }
+    }
+
+protected:
+    bool overridden(size_t slot) const
+    {
+        return slot < this->refs_.size() && this->refs_[slot] != LUA_NOREF;
+    }
+
+    // self:<method slot>(args...), lua errors throw zlua::call_error
+    template <typename R, typename... Args>
+    R call(size_t slot, Args &&... args) const
+    {
+        if (!this->overridden(slot))
+        {
+            throw call_error(slot < methods().size() ? "'" + methods()[slot] + "' is not implemented in lua"
+                                                     : "slot " + std::to_string(slot) + " has no method name");
+        }
+
+        lua_State *ls = impl::running_thread(this->ls_);
+        lua_rawgeti(ls, LUA_REGISTRYINDEX, this->refs_[slot]);
+        int func = lua_gettop(ls);
+        lua_rawgeti(ls, LUA_REGISTRYINDEX, this->self_);
+        return impl::protected_call_at<R>(ls, func, std::forward<Args>(args)...);
+    }
+
+private:
+    void copy_refs(const lua_impl &rhs)
+    {
+        if (rhs.ls_ != nullptr)
+        {
+            lua_State *ls = impl::running_thread(rhs.ls_);
+            this->ls_ = rhs.ls_;
+            this->self_ = copy_ref(ls, rhs.self_);
+            for (int ref : rhs.refs_)
+            {
+                this->refs_.push_back(copy_ref(ls, ref));
+            }
+        }
+    }
+
+    static int copy_ref(lua_State *ls, int ref)
+    {
+        if (ref == LUA_NOREF)
+        {
+            return LUA_NOREF;
+        }
+
+        lua_rawgeti(ls, LUA_REGISTRYINDEX, ref);
+        return luaL_ref(ls, LUA_REGISTRYINDEX);
+    }
+
+    void reset()
+    {
+        if (this->ls_ != nullptr)
+        {
+            lua_State *ls = impl::running_thread(this->ls_);
+            for (int ref : this->refs_)
+            {
+                luaL_unref(ls, LUA_REGISTRYINDEX, ref);
+            }
+            luaL_unref(ls, LUA_REGISTRYINDEX, this->self_);
+        }
+
+        this->ls_ = nullptr;
+        this->self_ = LUA_NOREF;
+        this->refs_.clear();
+    }
+
+    lua_State *ls_;
+    int self_;
+    std::vector<int> refs_;
+};
+
+// trampoline T bound to the table t
+template <typename T>
+std::unique_ptr<T> implement(const table &t)
+{
+    lua_State *ls = t.state();
+    ZLUA_CHECK_THROW(ls, t.valid(), "implement through an empty table handle");
+
+    impl::stack_restorer restorer(ls);
+    std::unique_ptr<T> p(new T());
+    t.push(ls);
+    p->bind(ls, -1);
+    return p;
+}
+
+// T.implement(obj) for a trampoline T registered as a class
+template <typename T>
+struct interface_registrar
+{
+    using interface_t = typename T::interface_t;
+
+    // the interface is registered as name already
+    static void reg(lua_State *ls, const char *name, std::initializer_list<const char *> methods)
+    {
+        std::string impl_name = std::string(name) + ".impl";
+        Registrar<T, ctor(), interface_t>(ls, impl_name.c_str());
+
+        {
+            // slots are named once per process, by the first engine
+            std::lock_guard<std::mutex> lock(register_counter::mutex());
+            if (T::methods().empty())
+            {
+                T::methods().assign(methods.begin(), methods.end());
+            }
+        }
+
+        push_qualified_global(ls, name);
+        lua_pushstring(ls, "implement");
+        lua_pushcfunction(ls, &implement);
+        lua_rawset(ls, -3);
+        lua_pop(ls, 1);
+    }
+
+private:
+    // the trampoline is owned by the returned object
+    static int implement(lua_State *ls)
+    {
+        T *t = new T();
+        stack_op<T>::push_new(ls, t);
+        t->bind(ls, 1);
+        return 1;
+    }
+};
+
+} // namespace zlua
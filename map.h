@@ -0,0 +1,342 @@
+#pragma once
+#include "common.h"
+#include "register.h"
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// map_registrar
+// binds std::map/std::unordered_map as live views, nothing is copied to lua tables
+//   m[key], m[key] = v, m[key] = nil (erase), #m,
+//   pairs(m) walking the C++ container, m:find(key), m:erase(key), m:size(), m:clear()
+// entries come first: m.size is the entry "size" of a string keyed map that has one,
+// the methods stay reachable as getmetatable(m).size(m)
+// changes made through views while pairs(m) runs are safe: std::map walks go on in key order,
+// std::unordered_map walks go on from the next key, and raise if that key was erased;
+// changes made by C++ code during a walk are not tracked
+////////////////////////////////////////////////////////////////////////////////
+namespace impl
+{
+inline const void *map_versions_key()
+{
+    static const char key = 0;
+    return &key;
+}
+
+// count of inserts, erasures and clears made through views of the map at m in this state
+inline lua_Integer map_version(lua_State *ls, const void *m)
+{
+    lua_Integer version = 0;
+    if (lua_rawgetp(ls, LUA_REGISTRYINDEX, map_versions_key()) == LUA_TTABLE)
+    {
+        lua_rawgetp(ls, -1, m);
+        version = lua_tointeger(ls, -1);
+        lua_pop(ls, 1);
+    }
+    lua_pop(ls, 1);
+    return version;
+}
+
+inline void touch_map(lua_State *ls, const void *m)
+{
+    if (lua_rawgetp(ls, LUA_REGISTRYINDEX, map_versions_key()) != LUA_TTABLE)
+    {
+        lua_pop(ls, 1);
+        lua_newtable(ls);
+        lua_pushvalue(ls, -1);
+        lua_rawsetp(ls, LUA_REGISTRYINDEX, map_versions_key());
+    }
+
+    lua_rawgetp(ls, -1, m);
+    lua_Integer version = lua_tointeger(ls, -1) + 1;
+    lua_pop(ls, 1);
+    lua_pushinteger(ls, version);
+    lua_rawsetp(ls, -2, m);
+    lua_pop(ls, 1);
+}
+
+// where a walk goes on once the map changed under it
+template <typename M>
+struct map_reseek
+{
+    static typename M::iterator at(M &m, const typename M::key_type &next)
+    {
+        return m.lower_bound(next);
+    }
+};
+
+template <typename K, typename V, typename H, typename E, typename A>
+struct map_reseek<std::unordered_map<K, V, H, E, A>>
+{
+    static typename std::unordered_map<K, V, H, E, A>::iterator at(std::unordered_map<K, V, H, E, A> &m, const K &next)
+    {
+        auto it = m.find(next);
+        ZLUA_CHECK_THROW(nullptr, it != m.end() || m.empty(), "the next key of pairs() was erased during the loop");
+        return it;
+    }
+};
+} // namespace impl
+
+template <typename M>
+struct map_registrar
+{
+    using map_t = M;
+    using key_t = typename M::key_type;
+    using value_t = typename M::mapped_type;
+    using iterator_t = typename M::iterator;
+
+    // pairs(m) keeps the iterator to the next element, its key while there is one,
+    // and the version of the map it was taken at
+    struct iteration_t
+    {
+        iterator_t it;
+        key_t next;
+        bool more;
+        lua_Integer version;
+    };
+
+    static void reg(lua_State *ls, const char *name)
+    {
+        Registrar<map_t, ctor()>(ls, name);
+
+        if (luaL_newmetatable(ls, iteration_metatable_name()) != 0)
+        {
+            lua_pushstring(ls, "__gc");
+            lua_pushcfunction(ls, &iteration_gc);
+            lua_rawset(ls, -3);
+        }
+        lua_pop(ls, 1);
+
+        luaL_getmetatable(ls, type_info<map_t>::metatable_name());
+
+        lua_pushstring(ls, "__index");
+        lua_pushcfunction(ls, &index);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "__newindex");
+        lua_pushcfunction(ls, &newindex);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "__len");
+        lua_pushcfunction(ls, &size);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "__pairs");
+        lua_pushcfunction(ls, &pairs);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "find");
+        lua_pushcfunction(ls, &find);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "erase");
+        lua_pushcfunction(ls, &erase);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "size");
+        lua_pushcfunction(ls, &size);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "clear");
+        lua_pushcfunction(ls, &clear);
+        lua_rawset(ls, -3);
+
+        lua_pop(ls, 1);
+    }
+
+private:
+    static map_t *check_map(lua_State *ls, bool writable = false)
+    {
+        auto *obj = static_cast<userdata::object_t<map_t> *>(luaL_checkudata(ls, 1, type_info<map_t>::metatable_name()));
+        ZLUA_ARG_CHECK_THROW(ls, !writable || !obj->is_const, 1, "cannot modify const " + std::string(type_info<map_t>::name()));
+        return obj->ptr;
+    }
+
+    static const char *iteration_metatable_name()
+    {
+        static const std::string name = std::string(type_info<map_t>::metatable_name()) + ".pairs";
+        return name.c_str();
+    }
+
+    // entries first, methods for string keys no entry takes
+    static int index(lua_State *ls)
+    {
+        map_t *m = check_map(ls);
+
+        if (lua_type(ls, 2) != LUA_TSTRING)
+        {
+            return find(ls);
+        }
+
+        if (is_string_type<key_t>::value)
+        {
+            key_t key;
+            stack_op<key_t>::peek(ls, key, 2);
+            auto it = m->find(key);
+            if (it != m->end())
+            {
+                stack_op<value_t>::push(ls, it->second);
+                return 1;
+            }
+        }
+
+        const char *k = lua_tostring(ls, 2);
+        if (std::strncmp(k, "__", 2) != 0 && luaL_getmetafield(ls, 1, k) != LUA_TNIL)
+        {
+            return 1;
+        }
+
+        if (is_string_type<key_t>::value)
+        {
+            lua_pushnil(ls);
+            return 1;
+        }
+
+        return find(ls);
+    }
+
+    static int newindex(lua_State *ls)
+    {
+        map_t *m = check_map(ls, true);
+
+        key_t key;
+        stack_op<key_t>::peek(ls, key, 2);
+
+        if (lua_isnil(ls, 3) != 0)
+        {
+            if (m->erase(key) > 0)
+            {
+                impl::touch_map(ls, m);
+            }
+            return 0;
+        }
+
+        value_t value;
+        stack_op<value_t>::peek(ls, value, 3);
+        auto it = m->find(key);
+        if (it != m->end())
+        {
+            it->second = std::move(value);
+            return 0;
+        }
+
+        m->emplace(std::move(key), std::move(value));
+        impl::touch_map(ls, m);
+        return 0;
+    }
+
+    static int find(lua_State *ls)
+    {
+        map_t *m = check_map(ls);
+
+        key_t key;
+        stack_op<key_t>::peek(ls, key, 2);
+
+        auto it = m->find(key);
+        if (it == m->end())
+        {
+            lua_pushnil(ls);
+        }
+        else
+        {
+            stack_op<value_t>::push(ls, it->second);
+        }
+
+        return 1;
+    }
+
+    static int erase(lua_State *ls)
+    {
+        map_t *m = check_map(ls, true);
+
+        key_t key;
+        stack_op<key_t>::peek(ls, key, 2);
+
+        bool erased = m->erase(key) > 0;
+        if (erased)
+        {
+            impl::touch_map(ls, m);
+        }
+
+        lua_pushboolean(ls, erased ? 1 : 0);
+        return 1;
+    }
+
+    static int size(lua_State *ls)
+    {
+        lua_pushinteger(ls, static_cast<lua_Integer>(check_map(ls)->size()));
+        return 1;
+    }
+
+    static int clear(lua_State *ls)
+    {
+        map_t *m = check_map(ls, true);
+        m->clear();
+        impl::touch_map(ls, m);
+        return 0;
+    }
+
+    static int pairs(lua_State *ls)
+    {
+        map_t *m = check_map(ls);
+
+        auto *iteration = static_cast<iteration_t *>(lua_newuserdata(ls, sizeof(iteration_t)));
+        new (iteration) iteration_t{m->begin(), key_t(), !m->empty(), impl::map_version(ls, m)};
+        luaL_setmetatable(ls, iteration_metatable_name());
+        if (iteration->more)
+        {
+            iteration->next = iteration->it->first;
+        }
+
+        // the closure keeps the map userdata alive while iterating
+        lua_pushvalue(ls, 1);
+        lua_pushcclosure(ls, &next, 2);
+        lua_pushvalue(ls, 1);
+        lua_pushnil(ls);
+        return 3;
+    }
+
+    static int next(lua_State *ls)
+    {
+        auto *iteration = static_cast<iteration_t *>(lua_touserdata(ls, lua_upvalueindex(1)));
+        map_t *m = static_cast<userdata::object_t<map_t> *>(lua_touserdata(ls, lua_upvalueindex(2)))->ptr;
+        ZLUA_CHECK_THROW(ls, m != nullptr, "iterating a released map");
+
+        lua_Integer version = impl::map_version(ls, m);
+        if (iteration->more && version != iteration->version)
+        {
+            iteration->it = impl::map_reseek<map_t>::at(*m, iteration->next);
+            iteration->more = iteration->it != m->end();
+        }
+        iteration->version = version;
+
+        if (!iteration->more)
+        {
+            lua_pushnil(ls);
+            return 1;
+        }
+
+        auto it = iteration->it++;
+        iteration->more = iteration->it != m->end();
+        if (iteration->more)
+        {
+            iteration->next = iteration->it->first;
+        }
+
+        stack_op<key_t>::push(ls, it->first);
+        stack_op<value_t>::push(ls, it->second);
+        return 2;
+    }
+
+    static int iteration_gc(lua_State *ls)
+    {
+        static_cast<iteration_t *>(lua_touserdata(ls, 1))->~iteration_t();
+        return 0;
+    }
+};
+
+} // namespace zlua
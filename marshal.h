@@ -0,0 +1,192 @@
+#pragma once
+#include "common.h"
+#include "error.h"
+#include "meta.h"
+#include "userdata.h"
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// marshal
+// converts objects to lua tables and back through the fields registered with def(name, &T::m)
+// every type keeps its field list in the registry of each lua state as
+//   {key, property, offset, key, property, offset, ...}
+// keys are interned once at registration, conversions only index with them
+// fields of class type nest: their value is a table converted the same way
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+const void *fields_key()
+{
+    static const char key = 0;
+    return &key;
+}
+
+// pushes the field list of T, returns false with nothing pushed if T has no fields
+template <typename T>
+bool push_fields(lua_State *ls, bool create = false)
+{
+    if (lua_rawgetp(ls, LUA_REGISTRYINDEX, fields_key<T>()) == LUA_TTABLE)
+    {
+        return true;
+    }
+    lua_pop(ls, 1);
+
+    if (!create)
+    {
+        return false;
+    }
+
+    lua_newtable(ls);
+    lua_pushvalue(ls, -1);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, fields_key<T>());
+    return true;
+}
+
+template <typename T>
+void add_field(lua_State *ls, const char *key, userdata::property_base_t *property, size_t offset = 0)
+{
+    push_fields<T>(ls, true);
+    auto n = static_cast<lua_Integer>(lua_rawlen(ls, -1));
+
+    lua_pushstring(ls, key);
+    lua_rawseti(ls, -2, n + 1);
+    lua_pushlightuserdata(ls, property);
+    lua_rawseti(ls, -2, n + 2);
+    lua_pushinteger(ls, static_cast<lua_Integer>(offset));
+    lua_rawseti(ls, -2, n + 3);
+
+    lua_pop(ls, 1);
+}
+
+// fields registered on Base so far become fields of T
+template <typename T, typename Base>
+void inherit_fields(lua_State *ls)
+{
+    if (!push_fields<Base>(ls))
+    {
+        return;
+    }
+
+    size_t base_offset = calc_base_offset<T, Base>();
+    auto n = static_cast<lua_Integer>(lua_rawlen(ls, -1));
+    for (lua_Integer i = 1; i <= n; i += 3)
+    {
+        lua_rawgeti(ls, -1, i);
+        lua_rawgeti(ls, -2, i + 1);
+        lua_rawgeti(ls, -3, i + 2);
+
+        auto *property = static_cast<userdata::property_base_t *>(lua_touserdata(ls, -2));
+        size_t offset = static_cast<size_t>(lua_tointeger(ls, -1));
+        add_field<T>(ls, lua_tostring(ls, -3), property, base_offset + offset);
+
+        lua_pop(ls, 3);
+    }
+
+    lua_pop(ls, 1);
+}
+
+template <typename T>
+struct marshal
+{
+    // pushes a new table holding every field of t
+    static void to_table(lua_State *ls, const T &t)
+    {
+        ZLUA_CHECK_THROW(ls, push_fields<T>(ls), std::string("no fields registered on ") + type_info<T>::name());
+        int fields = lua_gettop(ls);
+        auto n = static_cast<lua_Integer>(lua_rawlen(ls, fields));
+
+        lua_createtable(ls, 0, static_cast<int>(n / 3));
+        for (lua_Integer i = 1; i <= n; i += 3)
+        {
+            lua_rawgeti(ls, fields, i);
+
+            userdata::property_base_t *property = nullptr;
+            size_t offset = 0;
+            field_at(ls, fields, i, &property, &offset);
+
+            property->get_handler(ls, property->property, reinterpret_cast<const char *>(&t) + offset);
+            lua_rawset(ls, -3);
+        }
+
+        lua_remove(ls, fields);
+    }
+
+    // assigns the fields present in the table at pos, others are left untouched
+    static void from_table(lua_State *ls, int pos, T &t)
+    {
+        pos = lua_absindex(ls, pos);
+        ZLUA_ARG_CHECK_THROW(ls, push_fields<T>(ls), pos, std::string("no fields registered on ") + type_info<T>::name());
+        int fields = lua_gettop(ls);
+        auto n = static_cast<lua_Integer>(lua_rawlen(ls, fields));
+
+        for (lua_Integer i = 1; i <= n; i += 3)
+        {
+            lua_rawgeti(ls, fields, i);
+            if (lua_rawget(ls, pos) == LUA_TNIL)
+            {
+                lua_pop(ls, 1);
+                continue;
+            }
+
+            userdata::property_base_t *property = nullptr;
+            size_t offset = 0;
+            field_at(ls, fields, i, &property, &offset);
+
+            property->set_handler(ls, property->property, reinterpret_cast<char *>(&t) + offset, -1);
+            lua_pop(ls, 1);
+        }
+
+        lua_remove(ls, fields);
+    }
+
+private:
+    static void field_at(lua_State *ls, int fields, lua_Integer i, userdata::property_base_t **property, size_t *offset)
+    {
+        lua_rawgeti(ls, fields, i + 1);
+        lua_rawgeti(ls, fields, i + 2);
+        *property = static_cast<userdata::property_base_t *>(lua_touserdata(ls, -2));
+        *offset = static_cast<size_t>(lua_tointeger(ls, -1));
+        lua_pop(ls, 2);
+    }
+};
+
+// default constructed target for conversions that need to create the object
+template <typename T>
+typename std::enable_if<std::is_default_constructible<T>::value, T *>::type new_marshal_target(lua_State *)
+{
+    return new T();
+}
+
+template <typename T>
+typename std::enable_if<!std::is_default_constructible<T>::value, T *>::type new_marshal_target(lua_State *)
+{
+    ZLUA_CHECK_THROW(nullptr, false, std::string("cannot convert table to ") + type_info<T>::name() + ", not default constructible");
+    return nullptr;
+}
+
+// obj:assign{...}, returns obj
+template <typename T>
+int lua_object_assign(lua_State *ls)
+{
+    auto *obj = static_cast<userdata::object_t<T> *>(luaL_checkudata(ls, 1, type_info<T>::metatable_name()));
+    ZLUA_ARG_CHECK_THROW(ls, obj->ptr != nullptr, 1, "assign on a released object or finished cursor");
+    ZLUA_ARG_CHECK_THROW(ls, !obj->is_const, 1, std::string("cannot assign const ") + type_info<T>::name());
+    luaL_checktype(ls, 2, LUA_TTABLE);
+
+    marshal<T>::from_table(ls, 2, *obj->ptr);
+    lua_settop(ls, 1);
+    return 1;
+}
+
+// obj:to_table()
+template <typename T>
+int lua_object_to_table(lua_State *ls)
+{
+    auto *obj = static_cast<userdata::object_t<T> *>(luaL_checkudata(ls, 1, type_info<T>::metatable_name()));
+    ZLUA_ARG_CHECK_THROW(ls, obj->ptr != nullptr, 1, "to_table on a released object or finished cursor");
+
+    marshal<T>::to_table(ls, *obj->ptr);
+    return 1;
+}
+
+} // namespace zlua
@@ -1,16 +1,35 @@
 #pragma once
 #include "common.h"
 #include "traits.h"
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <vector>
 
 namespace zlua
 {
+////////////////////////////////////////////////////////////////////////////////
+// type registry
+// type_info<T> is process wide: the first registration of T (in any engine, on any thread)
+// names it, later ones under the same name only build T's metatable and type table in
+// their own lua state, so every engine registers the same types independently
+// writes happen once under register_counter::mutex(), lookups read without locking
+// T's bases are fixed when its first registration ends, lookups only see that frozen list
+////////////////////////////////////////////////////////////////////////////////
 struct register_counter
 {
-    static int type_id_cnt;
+    static std::atomic<int> &type_id_cnt()
+    {
+        static std::atomic<int> cnt(0);
+        return cnt;
+    }
+
+    static std::mutex &mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
 };
-int register_counter::type_id_cnt = 0;
 
 template <typename Derived, typename Base>
 size_t calc_base_offset()
@@ -21,6 +40,14 @@ size_t calc_base_offset()
     return diff;
 }
 
+// unique address per type, usable as a lightweight runtime type tag
+template <typename T>
+const void *type_tag()
+{
+    static const char tag = 0;
+    return &tag;
+}
+
 template <typename T>
 class type_info;
 
@@ -39,12 +66,20 @@ struct inherit_helper;
 template <typename T, typename Base>
 struct inherit_helper<T, Base>
 {
+    // inheriting again, from another engine, is a no-op
+    // a base not declared by the first registration of T is refused
     static void inherit()
     {
-        // TODO throw
         assert((std::is_base_of<Base, T>::value) && "provided type is not base type");
         assert(type_info<Base>::is_registered() && "inherited base type is not registered");
-        assert(!type_info<T>::is_inherited_from(type_info<Base>::name()) && "already inherited");
+
+        std::lock_guard<std::mutex> lock(register_counter::mutex());
+        if (type_info<T>::is_inherited_from(type_info<Base>::name()))
+        {
+            return;
+        }
+
+        ZLUA_CHECK_THROW(nullptr, !type_info<T>::is_frozen(), std::string("bases of ") + type_info<T>::name() + " are fixed by its first registration");
 
         inheritance_info info;
         info.name = type_info<Base>::name();
@@ -77,24 +112,45 @@ class type_info
 {
 public:
     // basics
-    static void set_name(const char *name)
+    // names T for the whole process, false if it already has another name
+    static bool set_name(const char *name)
     {
+        std::lock_guard<std::mutex> lock(register_counter::mutex());
+        if (is_registered())
+        {
+            return name_ == name;
+        }
+
         name_ = name;
         metatable_name_ = "zlua." + name_;
-        type_idx_ = ++register_counter::type_id_cnt;
+        type_idx_ = ++register_counter::type_id_cnt();
+        registered_.store(true, std::memory_order_release);
+        return true;
     }
 
     static const char *name() { return name_.c_str(); }
     static const char *metatable_name() { return metatable_name_.c_str(); }
     static int type_idx() { return type_idx_; }
 
-    static bool is_registered() { return !name_.empty(); }
+    static bool is_registered() { return registered_.load(std::memory_order_acquire); }
 
     // inheritance
+    // the list is built under register_counter::mutex() until freeze(), which the first
+    // registration of T calls when it ends; it never changes after, so lookups need no lock
     template <typename... Bases>
     static void inherit_from() { impl::inherit_helper<T, Bases...>::inherit(); }
     static void add_inheritance_info(const inheritance_info &info) { inheritance_info_.push_back(info); }
-    static bool is_inherited() { return !inheritance_info_.empty(); }
+    static bool is_inherited() { return !get_inheritance_info().empty(); }
+
+    static void freeze()
+    {
+        std::lock_guard<std::mutex> lock(register_counter::mutex());
+        frozen_.store(true, std::memory_order_release);
+    }
+
+    static bool is_frozen() { return frozen_.load(std::memory_order_acquire); }
+
+    // called with register_counter::mutex() held, or once frozen
     static bool is_inherited_from(const std::string &name)
     {
         for (auto &curr : inheritance_info_)
@@ -108,13 +164,30 @@ public:
 
         return false;
     }
-    static const std::vector<inheritance_info> &get_inheritance_info() { return inheritance_info_; }
+    // empty until frozen
+    static const std::vector<inheritance_info> &get_inheritance_info()
+    {
+        static const std::vector<inheritance_info> none;
+        return is_frozen() ? inheritance_info_ : none;
+    }
+
+    // whether some lua state returns T by value as tables, the metatable of each state tells for it
+    static void set_return_as_table(bool b) { return_as_table_.store(b, std::memory_order_relaxed); }
+    static bool return_as_table() { return return_as_table_.load(std::memory_order_relaxed); }
+
+    // registers T in a lua state the first time it is needed there (vector.T)
+    static void set_on_demand(void (*reg)(lua_State *)) { on_demand_.store(reg, std::memory_order_release); }
+    static void (*on_demand())(lua_State *) { return on_demand_.load(std::memory_order_acquire); }
 
 private:
     static std::string name_;
     static std::string metatable_name_;
     static std::vector<inheritance_info> inheritance_info_;
     static int type_idx_;
+    static std::atomic<bool> registered_;
+    static std::atomic<bool> frozen_;
+    static std::atomic<bool> return_as_table_;
+    static std::atomic<void (*)(lua_State *)> on_demand_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -131,6 +204,32 @@ std::vector<inheritance_info> type_info<T>::inheritance_info_;
 template <typename T>
 int type_info<T>::type_idx_ = 0;
 
+template <typename T>
+std::atomic<bool> type_info<T>::registered_(false);
+
+template <typename T>
+std::atomic<bool> type_info<T>::frozen_(false);
+
+template <typename T>
+std::atomic<bool> type_info<T>::return_as_table_(false);
+
+template <typename T>
+std::atomic<void (*)(lua_State *)> type_info<T>::on_demand_(nullptr);
+
+// pushes the metatable of T in ls, registering T there first if it is registered on demand
+template <typename T>
+int push_metatable(lua_State *ls)
+{
+    int type = luaL_getmetatable(ls, type_info<T>::metatable_name());
+    if (type == LUA_TNIL && type_info<T>::on_demand() != nullptr)
+    {
+        lua_pop(ls, 1);
+        type_info<T>::on_demand()(ls);
+        type = luaL_getmetatable(ls, type_info<T>::metatable_name());
+    }
+    return type;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
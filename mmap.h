@@ -0,0 +1,336 @@
+#pragma once
+
+// file mappings need posix mmap, define ZLUA_NO_MMAP to leave them out
+#if !defined(ZLUA_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define ZLUA_MMAP 1
+#endif
+
+#ifdef ZLUA_MMAP
+#include "common.h"
+#include "buffer.h"
+#include "register.h"
+#include "span.h"
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include <utility>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// mapped files
+// read-only file mappings shared by every engine of the process
+// the same file (device, inode) is mapped once and unmapped with its last view
+// a file whose size or modification time changed since is mapped anew, views of the
+// old mapping keep it
+////////////////////////////////////////////////////////////////////////////////
+class file_mapping
+{
+public:
+    ~file_mapping()
+    {
+        if (this->data_ != nullptr)
+        {
+            munmap(const_cast<char *>(this->data_), this->size_);
+        }
+    }
+
+    file_mapping(const file_mapping &) = delete;
+    file_mapping &operator=(const file_mapping &) = delete;
+
+    const char *data() const { return this->data_; }
+    size_t size() const { return this->size_; }
+
+    // maps path, or shares the mapping another engine already made
+    static std::shared_ptr<const file_mapping> open(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        ZLUA_CHECK_THROW(nullptr, fd >= 0, "cannot open '" + path + "' for mapping");
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            ZLUA_CHECK_THROW(nullptr, false, "cannot stat '" + path + "'");
+        }
+
+        key_t key(static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), static_cast<uint64_t>(st.st_size), mtime_ns(st));
+        std::lock_guard<std::mutex> lock(mutex());
+        prune();
+
+        auto &cached = cache()[key];
+        std::shared_ptr<const file_mapping> mapping = cached.lock();
+        if (mapping == nullptr)
+        {
+            std::shared_ptr<file_mapping> created(new file_mapping());
+            created->size_ = static_cast<size_t>(st.st_size);
+            if (created->size_ > 0)
+            {
+                void *p = mmap(nullptr, created->size_, PROT_READ, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED)
+                {
+                    ::close(fd);
+                    ZLUA_CHECK_THROW(nullptr, false, "cannot map '" + path + "'");
+                }
+                created->data_ = static_cast<const char *>(p);
+            }
+
+            mapping = created;
+            cached = mapping;
+        }
+
+        ::close(fd);
+        return mapping;
+    }
+
+private:
+    // device, inode, size, modification time
+    using key_t = std::tuple<uint64_t, uint64_t, uint64_t, uint64_t>;
+
+    file_mapping() : data_(nullptr), size_(0) {}
+
+    static uint64_t mtime_ns(const struct stat &st)
+    {
+#if defined(__APPLE__)
+        const struct timespec &t = st.st_mtimespec;
+#else
+        const struct timespec &t = st.st_mtim;
+#endif
+        return static_cast<uint64_t>(t.tv_sec) * 1000000000u + static_cast<uint64_t>(t.tv_nsec);
+    }
+
+    // drops entries of mappings whose last view is gone, under mutex()
+    static void prune()
+    {
+        auto &c = cache();
+        for (auto it = c.begin(); it != c.end();)
+        {
+            it = it->second.expired() ? c.erase(it) : std::next(it);
+        }
+    }
+
+    static std::mutex &mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::map<key_t, std::weak_ptr<const file_mapping>> &cache()
+    {
+        static std::map<key_t, std::weak_ptr<const file_mapping>> c;
+        return c;
+    }
+
+    const char *data_;
+    size_t size_;
+};
+
+// bytes [offset, offset + size) of a mapping, keeps the mapping alive
+class mapped_view
+{
+public:
+    using value_type = char;
+
+    mapped_view() : data_(nullptr), size_(0) {}
+
+    explicit mapped_view(std::shared_ptr<const file_mapping> mapping)
+        : data_(mapping->data()), size_(mapping->size()), mapping_(std::move(mapping)) {}
+
+    static mapped_view open(const std::string &path) { return mapped_view(file_mapping::open(path)); }
+
+    const char *data() const { return this->data_; }
+    size_t size() const { return this->size_; }
+
+    mapped_view slice(size_t offset, size_t count) const
+    {
+        offset = offset < this->size_ ? offset : this->size_;
+        count = count < this->size_ - offset ? count : this->size_ - offset;
+
+        mapped_view view(*this);
+        view.data_ += offset;
+        view.size_ = count;
+        return view;
+    }
+
+    span<const char> view() const { return span<const char>(this->data_, this->size_); }
+
+private:
+    const char *data_;
+    size_t size_;
+    std::shared_ptr<const file_mapping> mapping_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// lua side of mapped_view, registered by the engine as `mapped`, always const
+//   #v, v:size(), v:unpack(fmt [, pos]) bounds-checked typed reads (buffer:unpack formats)
+//   v:slice(i [, j]) a view sharing the mapping, v:tostring([i [, j]]) copies out
+//   v:search(record_size, key_pos, key_fmt, key) binary search over fixed-size records
+//     sorted by key, returns the 1-based record index or nil, plus the insertion index
+// bound functions read views in place through span<const char> or std::string_view
+////////////////////////////////////////////////////////////////////////////////
+struct mapped_view_registrar
+{
+    static void reg(lua_State *ls, const char *name)
+    {
+        Registrar<mapped_view, ctor()>(ls, name)
+            .def("size", &mapped_view::size)
+            .def_raw("unpack", &unpack)
+            .def_raw("slice", &slice)
+            .def_raw("tostring", &tostring)
+            .def_raw("search", &search)
+            //
+            ;
+
+        static const userdata::contiguous_t desc = {type_tag<char>(), &fetch};
+        luaL_getmetatable(ls, type_info<mapped_view>::metatable_name());
+        set_contiguous(ls, &desc);
+
+        lua_pushstring(ls, "__len");
+        lua_pushcfunction(ls, &size);
+        lua_rawset(ls, -3);
+
+        lua_pop(ls, 1);
+    }
+
+    // pushes a const object owning a copy of view
+    static void push(lua_State *ls, const mapped_view &view)
+    {
+        using object_t = userdata::object_t<const mapped_view>;
+        auto *obj = static_cast<object_t *>(lua_newuserdata(ls, sizeof(object_t)));
+        new (obj) object_t;
+        obj->ptr = new mapped_view(view);
+        obj->need_release = true;
+        luaL_setmetatable(ls, type_info<mapped_view>::metatable_name());
+    }
+
+private:
+    static void fetch(void *ud, void **data, size_t *size)
+    {
+        auto *obj = static_cast<userdata::object_t<const mapped_view> *>(ud);
+        *data = const_cast<char *>(obj->ptr->data());
+        *size = obj->ptr->size();
+    }
+
+    static const mapped_view *check_view(lua_State *ls)
+    {
+        return static_cast<userdata::object_t<const mapped_view> *>(luaL_checkudata(ls, 1, type_info<mapped_view>::metatable_name()))->ptr;
+    }
+
+    static int size(lua_State *ls)
+    {
+        lua_pushinteger(ls, static_cast<lua_Integer>(check_view(ls)->size()));
+        return 1;
+    }
+
+    static int unpack(lua_State *ls)
+    {
+        const mapped_view *v = check_view(ls);
+        return impl::unpack_bytes(ls, v->data(), v->size());
+    }
+
+    static int slice(lua_State *ls)
+    {
+        const mapped_view *v = check_view(ls);
+        size_t first = 0, last = 0;
+        impl::byte_range(ls, v->size(), 2, &first, &last);
+
+        push(ls, v->slice(first, last - first));
+        return 1;
+    }
+
+    static int tostring(lua_State *ls)
+    {
+        const mapped_view *v = check_view(ls);
+        size_t first = 0, last = 0;
+        impl::byte_range(ls, v->size(), 2, &first, &last);
+
+        lua_pushlstring(ls, v->data() + first, last - first);
+        return 1;
+    }
+
+    // <0, 0, >0 as the key stored at p compares to the key at index 5
+    static int compare_key(lua_State *ls, const char *p, char opt, bool little)
+    {
+        if (opt == 'f' || opt == 'd')
+        {
+            impl::push_scalar(ls, p, opt, little);
+            double k = lua_tonumber(ls, -1);
+            lua_pop(ls, 1);
+
+            double key = luaL_checknumber(ls, 5);
+            return k < key ? -1 : (key < k ? 1 : 0);
+        }
+
+        lua_Integer key = luaL_checkinteger(ls, 5);
+        if (opt == 'L')
+        {
+            uint64_t k = impl::unpack_bits(p, 8, little);
+            uint64_t ukey = static_cast<uint64_t>(key);
+            return k < ukey ? -1 : (ukey < k ? 1 : 0);
+        }
+
+        impl::push_scalar(ls, p, opt, little);
+        lua_Integer k = lua_tointeger(ls, -1);
+        lua_pop(ls, 1);
+        return k < key ? -1 : (key < k ? 1 : 0);
+    }
+
+    // v:search(record_size, key_pos, key_fmt, key)
+    static int search(lua_State *ls)
+    {
+        const mapped_view *v = check_view(ls);
+        lua_Integer record_size = luaL_checkinteger(ls, 2);
+        lua_Integer key_pos = luaL_checkinteger(ls, 3);
+        const char *fmt = luaL_checkstring(ls, 4);
+
+        bool little = impl::native_little_endian();
+        while (impl::endian_option(*fmt, &little))
+        {
+            ++fmt;
+        }
+
+        char opt = *fmt;
+        size_t key_size = impl::pack_size(opt);
+        ZLUA_ARG_CHECK_THROW(ls, key_size > 0 && fmt[1] == '\0', 4, "key format must be a single numeric option");
+        ZLUA_ARG_CHECK_THROW(ls, record_size > 0, 2, "record size must be positive");
+        ZLUA_ARG_CHECK_THROW(ls, key_pos >= 1 && static_cast<size_t>(key_pos - 1) + key_size <= static_cast<size_t>(record_size), 3, "key out of record");
+
+        size_t lo = 0;
+        size_t hi = v->size() / static_cast<size_t>(record_size);
+        const char *first_key = v->data() + (key_pos - 1);
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (compare_key(ls, first_key + mid * static_cast<size_t>(record_size), opt, little) < 0)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        bool found = lo < v->size() / static_cast<size_t>(record_size) &&
+                     compare_key(ls, first_key + lo * static_cast<size_t>(record_size), opt, little) == 0;
+        if (found)
+        {
+            lua_pushinteger(ls, static_cast<lua_Integer>(lo + 1));
+        }
+        else
+        {
+            lua_pushnil(ls);
+        }
+        lua_pushinteger(ls, static_cast<lua_Integer>(lo + 1));
+        return 2;
+    }
+};
+
+} // namespace zlua
+#endif // ZLUA_MMAP
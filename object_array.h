@@ -0,0 +1,249 @@
+#pragma once
+#include "common.h"
+#include "column.h"
+#include "core.h"
+#include "cursor.h"
+#include "meta.h"
+#include "span.h"
+#include "stack.h"
+#include "util.h"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// object_array
+// n objects of T constructed in one contiguous block, created from lua by T.new_array(n, ...)
+// the block is one userdata with one finalizer, arr[i] (1-based) yields views into it
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class object_array
+{
+public:
+    using value_type = T;
+
+    // largest n the block can hold without its byte size overflowing
+    static size_t max_size() { return (SIZE_MAX - extra_alignment) / sizeof(T); }
+
+    // every element is constructed from the same params
+    template <typename... Args>
+    object_array(size_t n, std::tuple<Args...> &params)
+        : raw_(nullptr), data_(nullptr), size_(0)
+    {
+        ZLUA_CHECK_THROW(nullptr, n <= max_size(), "object array of " + std::to_string(n) + " elements too large");
+        this->raw_ = allocate(n);
+        this->data_ = aligned(this->raw_);
+
+        try
+        {
+            for (; this->size_ < n; ++this->size_)
+            {
+                tuple_construct_at<T>(this->data_ + this->size_, params);
+            }
+        }
+        catch (...)
+        {
+            this->destroy();
+            throw;
+        }
+    }
+
+    ~object_array() { this->destroy(); }
+
+    object_array(const object_array &) = delete;
+    object_array &operator=(const object_array &) = delete;
+
+    T *data() { return this->data_; }
+    const T *data() const { return this->data_; }
+    size_t size() const { return this->size_; }
+
+    T &operator[](size_t i) { return this->data_[i]; }
+    const T &operator[](size_t i) const { return this->data_[i]; }
+
+    span<T> view() { return span<T>(this->data_, this->size_); }
+    span<const T> view() const { return span<const T>(this->data_, this->size_); }
+
+private:
+    void destroy()
+    {
+        while (this->size_ > 0)
+        {
+            this->data_[--this->size_].~T();
+        }
+
+        deallocate(this->raw_);
+        this->raw_ = nullptr;
+        this->data_ = nullptr;
+    }
+
+    // over-aligned T uses aligned operator new (c++17), before that it gets slack to align in
+#if __cplusplus >= 201703L
+    const static size_t extra_alignment = 0;
+
+    static void *allocate(size_t n)
+    {
+        if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            return ::operator new(n * sizeof(T), std::align_val_t(alignof(T)));
+        }
+        return ::operator new(n * sizeof(T));
+    }
+
+    static void deallocate(void *p)
+    {
+        if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+            return;
+        }
+        ::operator delete(p);
+    }
+#else
+    const static size_t extra_alignment = alignof(T) > alignof(std::max_align_t) ? alignof(T) - 1 : 0;
+
+    static void *allocate(size_t n) { return ::operator new(n * sizeof(T) + extra_alignment); }
+    static void deallocate(void *p) { ::operator delete(p); }
+#endif
+
+    static T *aligned(void *raw)
+    {
+        uintptr_t p = reinterpret_cast<uintptr_t>(raw);
+        p = (p + alignof(T) - 1) & ~static_cast<uintptr_t>(alignof(T) - 1);
+        return reinterpret_cast<T *>(p);
+    }
+
+    void *raw_;
+    T *data_;
+    size_t size_;
+};
+
+template <typename T>
+struct cursor_access<object_array<T>>
+{
+    using element_t = T;
+    static T *get(object_array<T> &c, size_t i) { return &c[i]; }
+    static size_t size(const object_array<T> &c) { return c.size(); }
+};
+
+template <typename T>
+struct object_array_registrar
+{
+    using array_t = object_array<T>;
+
+    // T.new_array(n, ...), ctor params follow n
+    template <typename... Args>
+    static int create(lua_State *ls)
+    {
+        lua_Integer n = luaL_checkinteger(ls, 1);
+        ZLUA_ARG_CHECK_THROW(ls, n >= 0, 1, "negative array size");
+        ZLUA_ARG_CHECK_THROW(ls, static_cast<uint64_t>(n) <= array_t::max_size(), 1, "array size too large");
+
+        using wrapped_tuple_t = pack_tuple_t<Args...>;
+        wrapped_tuple_t params;
+        stack_op<wrapped_tuple_t>::pop(ls, params, -1, lua_gettop(ls) - 1);
+
+        stack_op<array_t>::push_new(ls, new array_t(static_cast<size_t>(n), params));
+        return 1;
+    }
+
+    template <typename... Args>
+    static lua_CFunction fetch_creator(void (*)(Args...))
+    {
+        return &create<Args...>;
+    }
+
+    // prepares metatable of T[] in this lua state
+    static void reg(lua_State *ls)
+    {
+        if (!type_info<array_t>::is_registered())
+        {
+            type_info<array_t>::set_name((std::string(type_info<T>::name()) + "[]").c_str());
+        }
+
+        if (luaL_newmetatable(ls, type_info<array_t>::metatable_name()) == 0)
+        {
+            lua_pop(ls, 1);
+            return;
+        }
+
+        lua_pushstring(ls, "__index");
+        lua_pushcfunction(ls, &index);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "__len");
+        lua_pushcfunction(ls, &size);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "__gc");
+        lua_pushcfunction(ls, &lua_object_deleter<array_t>);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "size");
+        lua_pushcfunction(ls, &size);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "each");
+        lua_pushcfunction(ls, &cursor_registrar<array_t>::each);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "column");
+        lua_pushcfunction(ls, &column_registrar<array_t>::gather);
+        lua_rawset(ls, -3);
+
+        lua_pushstring(ls, "set_column");
+        lua_pushcfunction(ls, &column_registrar<array_t>::scatter);
+        lua_rawset(ls, -3);
+
+        static const userdata::contiguous_t desc = {type_tag<T>(), &fetch};
+        set_contiguous(ls, &desc);
+
+        lua_pop(ls, 1);
+    }
+
+private:
+    static void fetch(void *ud, void **data, size_t *size)
+    {
+        auto *obj = static_cast<userdata::object_t<array_t> *>(ud);
+        *data = obj->ptr->data();
+        *size = obj->ptr->size();
+    }
+
+    static array_t *check_array(lua_State *ls)
+    {
+        return static_cast<userdata::object_t<array_t> *>(luaL_checkudata(ls, 1, type_info<array_t>::metatable_name()))->ptr;
+    }
+
+    static int size(lua_State *ls)
+    {
+        lua_pushinteger(ls, static_cast<lua_Integer>(check_array(ls)->size()));
+        return 1;
+    }
+
+    static int index(lua_State *ls)
+    {
+        array_t *arr = check_array(ls);
+
+        if (lua_type(ls, 2) == LUA_TSTRING)
+        {
+            if (luaL_getmetafield(ls, 1, lua_tostring(ls, 2)) == LUA_TNIL)
+            {
+                lua_pushnil(ls);
+            }
+            return 1;
+        }
+
+        lua_Integer i = luaL_checkinteger(ls, 2);
+        ZLUA_ARG_CHECK_THROW(ls, i >= 1 && static_cast<size_t>(i) <= arr->size(), 2, "object array index out of range");
+
+        // the view anchors the block, so it stays valid however long the script keeps it
+        stack_op<T>::push(ls, &(*arr)[static_cast<size_t>(i - 1)]);
+        lua_pushvalue(ls, 1);
+        lua_setuservalue(ls, -2);
+        return 1;
+    }
+};
+
+} // namespace zlua
@@ -0,0 +1,380 @@
+#pragma once
+#include "common.h"
+#include "error.h"
+#include "meta.h"
+#include "traits.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// overload
+// several functions under one name, def("f", &T::f1).def("f", &T::f2)
+// registering a name again turns it into a dispatcher whose table is built at registration:
+//   candidates are bucketed by argument count, a count with a single candidate calls it directly
+//   otherwise every argument's lua type is matched against the kinds the parameter accepts,
+//   exact kinds (integer for int, float for double, own metatable for objects) win,
+//   ties go to the first registered
+////////////////////////////////////////////////////////////////////////////////
+namespace overload
+{
+enum kind : unsigned short
+{
+    k_nil = 1 << 0,
+    k_boolean = 1 << 1,
+    k_integer = 1 << 2,
+    k_float = 1 << 3,
+    k_string = 1 << 4,
+    k_table = 1 << 5,
+    k_userdata = 1 << 6,
+    k_lightuserdata = 1 << 7,
+    k_function = 1 << 8,
+    k_thread = 1 << 9,
+    k_number = k_integer | k_float,
+    k_any = 0xffff,
+};
+
+// parameters past this are not looked at when choosing
+const int max_args = 8;
+
+struct param_t
+{
+    unsigned short accept;
+    unsigned short exact;
+    const char *(*metatable_name)();
+};
+
+struct candidate_t
+{
+    int arity;
+    int upvalue;
+    param_t params[max_args];
+};
+
+// upvalue 1 of a dispatcher, candidates sorted by argument count
+struct table_t
+{
+    int first[max_args + 2];
+    int count[max_args + 2];
+    candidate_t candidates[1];
+};
+
+inline unsigned short kind_of(lua_State *ls, int pos)
+{
+    switch (lua_type(ls, pos))
+    {
+    case LUA_TNIL:
+        return k_nil;
+    case LUA_TBOOLEAN:
+        return k_boolean;
+    case LUA_TNUMBER:
+        return lua_isinteger(ls, pos) ? k_integer : k_float;
+    case LUA_TSTRING:
+        return k_string;
+    case LUA_TTABLE:
+        return k_table;
+    case LUA_TUSERDATA:
+        return k_userdata;
+    case LUA_TLIGHTUSERDATA:
+        return k_lightuserdata;
+    case LUA_TFUNCTION:
+        return k_function;
+    default:
+        return k_thread;
+    }
+}
+
+inline int bucket_of(int argc)
+{
+    return argc < max_args + 1 ? argc : max_args + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// kinds a parameter of type P accepts, mirrors what stack_op<P>::peek takes
+template <typename P, typename Enabled = void>
+struct param_kind
+{
+    static param_t get() { return {k_any, 0, nullptr}; }
+};
+
+template <typename P>
+struct param_kind<P, typename std::enable_if<is_integral_type<base_type_t<P>>::value>::type>
+{
+    static param_t get() { return {k_integer, k_integer, nullptr}; }
+};
+
+template <typename P>
+struct param_kind<P, typename std::enable_if<std::is_floating_point<base_type_t<P>>::value>::type>
+{
+    static param_t get() { return {k_number, k_float, nullptr}; }
+};
+
+template <typename P>
+struct param_kind<P, typename std::enable_if<std::is_same<bool, base_type_t<P>>::value>::type>
+{
+    static param_t get() { return {k_boolean, k_boolean, nullptr}; }
+};
+
+// numbers convert to strings, const char* takes nil
+template <typename P>
+struct param_kind<P, typename std::enable_if<is_string_type<base_type_t<P>>::value>::type>
+{
+    static param_t get()
+    {
+        unsigned short nil = std::is_pointer<typename std::decay<P>::type>::value ? k_nil : 0;
+        return {static_cast<unsigned short>(k_string | k_number | nil), k_string, nullptr};
+    }
+};
+
+template <typename P>
+struct param_kind<P, typename std::enable_if<is_string_view_type<base_type_t<P>>::value>::type>
+{
+    static param_t get() { return {k_string | k_number | k_userdata, k_string, nullptr}; }
+};
+
+template <typename P>
+struct param_kind<P, typename std::enable_if<is_span_type<base_type_t<P>>::value>::type>
+{
+    static param_t get() { return {k_userdata | k_nil, k_userdata, nullptr}; }
+};
+
+template <typename P>
+struct param_kind<P, typename std::enable_if<std::is_same<table, base_type_t<P>>::value>::type>
+{
+    static param_t get() { return {k_table | k_nil, k_table, nullptr}; }
+};
+
+template <typename P>
+struct param_kind<P, typename std::enable_if<is_lua_function_type<base_type_t<P>>::value>::type>
+{
+    static param_t get() { return {k_function | k_nil, k_function, nullptr}; }
+};
+
+#if __cplusplus >= 201703L
+template <typename P>
+struct param_kind<P, typename std::enable_if<is_optional_type<base_type_t<P>>::value>::type>
+{
+    static param_t get()
+    {
+        param_t p = param_kind<typename base_type_t<P>::value_type>::get();
+        p.accept |= k_nil;
+        return p;
+    }
+};
+#endif
+
+// objects: tables convert for values and const references/pointers, pointers take nil
+template <typename P>
+struct param_kind<P, typename std::enable_if<
+                         std::is_class<base_type_t<P>>::value &&
+                         !std::is_same<base_type_t<P>, std::string>::value &&
+                         !is_tuple_type<base_type_t<P>>::value &&
+                         !is_pair_type<base_type_t<P>>::value &&
+                         !is_optional_type<base_type_t<P>>::value &&
+                         !is_span_type<base_type_t<P>>::value &&
+                         !is_string_view_type<base_type_t<P>>::value &&
+                         !is_lua_ref_type<base_type_t<P>>::value>::type>
+{
+    using Base = base_type_t<P>;
+    using U = typename std::remove_reference<P>::type;
+
+    static param_t get()
+    {
+        const bool is_pointer = std::is_pointer<U>::value;
+        const bool is_const = std::is_const<typename std::remove_pointer<U>::type>::value;
+        const bool by_value = !is_pointer && !std::is_reference<P>::value;
+
+        unsigned short accept = k_userdata;
+        accept |= is_pointer ? k_nil : 0;
+        accept |= (is_const || by_value) ? k_table : 0;
+        return {accept, k_userdata, &type_info<Base>::metatable_name};
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// signature of a function taking Args from lua, after the object for methods
+// out params (zlua::out_params) are not read from lua, SkipOut leaves them out
+template <bool SkipOut, typename... Args>
+candidate_t signature_of(bool method)
+{
+    const param_t params[] = {param_t{k_any, 0, nullptr}, param_kind<Args>::get()...};
+    const bool out[] = {false, (SkipOut && is_out_param<Args>::value)...};
+
+    candidate_t c{};
+    c.arity = 0;
+    for (size_t i = method ? 0 : 1; i < sizeof(params) / sizeof(params[0]); ++i)
+    {
+        if (!out[i])
+        {
+            if (c.arity < max_args)
+            {
+                c.params[c.arity] = params[i];
+            }
+            ++c.arity;
+        }
+    }
+
+    return c;
+}
+
+template <typename... Args>
+candidate_t signature(bool method)
+{
+    return signature_of<false, Args...>(method);
+}
+
+template <typename... Args>
+candidate_t out_params_signature(bool method)
+{
+    return signature_of<true, Args...>(method);
+}
+
+// score of c for the arguments on stack, -1 if some argument can't be taken
+inline int match(lua_State *ls, const candidate_t &c)
+{
+    int score = 0;
+    int n = c.arity < max_args ? c.arity : max_args;
+    for (int i = 0; i < n; ++i)
+    {
+        const param_t &p = c.params[i];
+        unsigned short k = kind_of(ls, i + 1);
+        if ((p.accept & k) == 0)
+        {
+            return -1;
+        }
+
+        if ((p.exact & k) != 0)
+        {
+            score += 2;
+            if (p.metatable_name != nullptr && lua_getmetatable(ls, i + 1) != 0)
+            {
+                luaL_getmetatable(ls, p.metatable_name());
+                score += lua_rawequal(ls, -1, -2) ? 1 : 0;
+                lua_pop(ls, 2);
+            }
+        }
+    }
+
+    return score;
+}
+
+// continuation of a candidate that yielded (async functions)
+inline int dispatched(lua_State *ls, int, lua_KContext)
+{
+    return lua_gettop(ls);
+}
+
+inline int dispatch(lua_State *ls)
+{
+    auto *dispatch_table = static_cast<const table_t *>(lua_touserdata(ls, lua_upvalueindex(1)));
+    int argc = lua_gettop(ls);
+    int bucket = bucket_of(argc);
+
+    const candidate_t *first = dispatch_table->candidates + dispatch_table->first[bucket];
+    const candidate_t *last = first + dispatch_table->count[bucket];
+
+    int upvalue = 0;
+    if (dispatch_table->count[bucket] == 1 && first->arity == argc)
+    {
+        upvalue = first->upvalue;
+    }
+    else
+    {
+        int best = -1;
+        for (const candidate_t *c = first; c != last; ++c)
+        {
+            int score = c->arity == argc ? match(ls, *c) : -1;
+            if (score > best)
+            {
+                best = score;
+                upvalue = c->upvalue;
+            }
+        }
+    }
+
+    if (upvalue == 0)
+    {
+        std::string args;
+        for (int i = 1; i <= argc; ++i)
+        {
+            args += (i > 1 ? ", " : "") + std::string(luaL_typename(ls, i));
+        }
+        ZLUA_CHECK_THROW(ls, false, "no overload takes (" + args + ")");
+    }
+
+    lua_pushvalue(ls, lua_upvalueindex(upvalue));
+    lua_insert(ls, 1);
+    lua_callk(ls, argc, LUA_MULTRET, 0, &dispatched);
+    return lua_gettop(ls);
+}
+
+// pushes the dispatch table of sigs, the i-th function goes in upvalue i + 2
+inline void push_table(lua_State *ls, const std::vector<candidate_t> &sigs)
+{
+    std::vector<candidate_t> sorted(sigs);
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        sorted[i].upvalue = static_cast<int>(i) + 2;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const candidate_t &a, const candidate_t &b) { return bucket_of(a.arity) < bucket_of(b.arity); });
+
+    size_t size = sizeof(table_t) + (sorted.size() - 1) * sizeof(candidate_t);
+    auto *dispatch_table = static_cast<table_t *>(lua_newuserdata(ls, size));
+    memset(dispatch_table, 0, size);
+
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        int bucket = bucket_of(sorted[i].arity);
+        if (dispatch_table->count[bucket]++ == 0)
+        {
+            dispatch_table->first[bucket] = static_cast<int>(i);
+        }
+        dispatch_table->candidates[i] = sorted[i];
+    }
+}
+
+// t[name] = the function on top of stack, with t right below it, pops the function
+// sigs are the signatures of every function set under name so far, the new one last
+inline void set_function(lua_State *ls, const char *name, const std::vector<candidate_t> &sigs)
+{
+    int f = lua_gettop(ls);
+    int t = f - 1;
+    if (sigs.size() < 2)
+    {
+        lua_pushstring(ls, name);
+        lua_insert(ls, -2);
+        lua_rawset(ls, t);
+        return;
+    }
+
+    ZLUA_CHECK_THROW(ls, sigs.size() < 255, std::string("too many overloads of ") + name);
+
+    // the previous value is the single function or the dispatcher holding them
+    lua_pushstring(ls, name);
+    lua_rawget(ls, t);
+    int prev = lua_gettop(ls);
+
+    lua_pushstring(ls, name);
+    push_table(ls, sigs);
+    if (sigs.size() == 2)
+    {
+        lua_pushvalue(ls, prev);
+    }
+    else
+    {
+        for (size_t i = 0; i + 1 < sigs.size(); ++i)
+        {
+            lua_getupvalue(ls, prev, static_cast<int>(i) + 2);
+        }
+    }
+    lua_pushvalue(ls, f);
+    lua_pushcclosure(ls, &dispatch, static_cast<int>(sigs.size()) + 1);
+    lua_rawset(ls, t);
+
+    lua_settop(ls, t);
+}
+} // namespace overload
+
+} // namespace zlua
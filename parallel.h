@@ -0,0 +1,204 @@
+#pragma once
+#include "common.h"
+#include "functor.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// parallel
+// algorithms over bound containers, run on thread_pool::shared()
+// when the container is at least threshold() elements long, sequentially otherwise
+// only registered C++ functors are accepted, lua is never entered off-thread
+////////////////////////////////////////////////////////////////////////////////
+namespace parallel
+{
+inline size_t &threshold()
+{
+    static size_t value = 1 << 14;
+    return value;
+}
+
+namespace impl
+{
+struct chunk_t
+{
+    size_t first;
+    size_t last;
+};
+
+// splits [0, n) into at most one chunk per thread, none shorter than threshold()/2
+inline std::vector<chunk_t> split(size_t n)
+{
+    size_t max_chunks = thread_pool::shared().size() + 1;
+    size_t min_chunk = std::max<size_t>(threshold() / 2, 1);
+    size_t count = std::max<size_t>(std::min(max_chunks, n / min_chunk), 1);
+
+    std::vector<chunk_t> chunks(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        chunks[i].first = n * i / count;
+        chunks[i].last = n * (i + 1) / count;
+    }
+
+    return chunks;
+}
+
+inline bool is_parallel(size_t n)
+{
+    return n >= threshold() && thread_pool::shared().size() > 0;
+}
+
+// sorts chunks in parallel, then merges neighbours pairwise
+template <typename T, typename Sort>
+void merge_sort(std::vector<T> &v, const comparator<T> &cmp, Sort sort_chunk)
+{
+    auto chunks = split(v.size());
+    auto begin = v.begin();
+
+    thread_pool::shared().parallel_for(chunks.size(), [&](size_t i) {
+        sort_chunk(begin + chunks[i].first, begin + chunks[i].last);
+    });
+
+    while (chunks.size() > 1)
+    {
+        std::vector<chunk_t> merged((chunks.size() + 1) / 2);
+        thread_pool::shared().parallel_for(merged.size(), [&](size_t i) {
+            if (2 * i + 1 < chunks.size())
+            {
+                const chunk_t &l = chunks[2 * i];
+                const chunk_t &r = chunks[2 * i + 1];
+                std::inplace_merge(begin + l.first, begin + r.first, begin + r.last, std::cref(cmp));
+                merged[i] = chunk_t{l.first, r.last};
+            }
+            else
+            {
+                merged[i] = chunks[2 * i];
+            }
+        });
+
+        chunks.swap(merged);
+    }
+}
+} // namespace impl
+
+template <typename T>
+void sort(std::vector<T> &v, const comparator<T> &cmp)
+{
+    ZLUA_CHECK_THROW(nullptr, static_cast<bool>(cmp), "sort with empty comparator");
+    if (!impl::is_parallel(v.size()))
+    {
+        std::sort(v.begin(), v.end(), std::cref(cmp));
+        return;
+    }
+
+    using iter_t = typename std::vector<T>::iterator;
+    impl::merge_sort(v, cmp, [&cmp](iter_t first, iter_t last) { std::sort(first, last, std::cref(cmp)); });
+}
+
+template <typename T>
+void stable_sort(std::vector<T> &v, const comparator<T> &cmp)
+{
+    ZLUA_CHECK_THROW(nullptr, static_cast<bool>(cmp), "stable_sort with empty comparator");
+    if (!impl::is_parallel(v.size()))
+    {
+        std::stable_sort(v.begin(), v.end(), std::cref(cmp));
+        return;
+    }
+
+    // inplace_merge keeps the left run first on ties, so merging sorted runs stays stable
+    using iter_t = typename std::vector<T>::iterator;
+    impl::merge_sort(v, cmp, [&cmp](iter_t first, iter_t last) { std::stable_sort(first, last, std::cref(cmp)); });
+}
+
+// op must be associative, chunks are folded separately then combined in order
+template <typename T>
+T reduce(const std::vector<T> &v, const T &init, const reducer<T> &op)
+{
+    ZLUA_CHECK_THROW(nullptr, static_cast<bool>(op), "reduce with empty reducer");
+    if (!impl::is_parallel(v.size()))
+    {
+        T ret = init;
+        for (auto &e : v)
+        {
+            ret = op(ret, e);
+        }
+        return ret;
+    }
+
+    auto chunks = impl::split(v.size());
+    std::vector<std::unique_ptr<T>> partials(chunks.size());
+    thread_pool::shared().parallel_for(chunks.size(), [&](size_t i) {
+        std::unique_ptr<T> acc(new T(v[chunks[i].first]));
+        for (size_t j = chunks[i].first + 1; j < chunks[i].last; ++j)
+        {
+            *acc = op(*acc, v[j]);
+        }
+        partials[i] = std::move(acc);
+    });
+
+    T ret = init;
+    for (auto &partial : partials)
+    {
+        ret = op(ret, *partial);
+    }
+    return ret;
+}
+
+// in place, v[i] = op(v[i])
+template <typename T>
+void transform(std::vector<T> &v, const transformer<T> &op)
+{
+    ZLUA_CHECK_THROW(nullptr, static_cast<bool>(op), "transform with empty transformer");
+    if (!impl::is_parallel(v.size()))
+    {
+        for (auto &e : v)
+        {
+            e = op(e);
+        }
+        return;
+    }
+
+    auto chunks = impl::split(v.size());
+    thread_pool::shared().parallel_for(chunks.size(), [&](size_t i) {
+        for (size_t j = chunks[i].first; j < chunks[i].last; ++j)
+        {
+            v[j] = op(v[j]);
+        }
+    });
+}
+
+// moves elements satisfying pred to the front, returns their count
+// relative order is not preserved
+template <typename T>
+size_t partition(std::vector<T> &v, const predicate<T> &pred)
+{
+    ZLUA_CHECK_THROW(nullptr, static_cast<bool>(pred), "partition with empty predicate");
+    if (!impl::is_parallel(v.size()))
+    {
+        return std::partition(v.begin(), v.end(), std::cref(pred)) - v.begin();
+    }
+
+    auto chunks = impl::split(v.size());
+    auto begin = v.begin();
+    std::vector<size_t> mids(chunks.size());
+    thread_pool::shared().parallel_for(chunks.size(), [&](size_t i) {
+        mids[i] = std::partition(begin + chunks[i].first, begin + chunks[i].last, std::cref(pred)) - begin;
+    });
+
+    // pull the leading run of every chunk down next to the previous ones
+    size_t pos = mids[0];
+    for (size_t i = 1; i < chunks.size(); ++i)
+    {
+        std::rotate(begin + pos, begin + chunks[i].first, begin + mids[i]);
+        pos += mids[i] - chunks[i].first;
+    }
+
+    return pos;
+}
+
+} // namespace parallel
+} // namespace zlua
@@ -0,0 +1,193 @@
+#pragma once
+#include "common.h"
+#include "engine.h"
+#include "schema.h"
+#include "thread_pool.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// EnginePool
+// n engines built from one schema in parallel, lent out one thread at a time
+//   zlua::EnginePool pool(std::thread::hardware_concurrency(), schema);
+//   {
+//       zlua::EnginePool::lease engine = pool.checkout();
+//       engine->call<void>("tick", dt);
+//   } // returned here
+// checkout prefers the engine the calling thread had last, then one no thread has used,
+// so a worker keeps hitting the same lua state and its caches
+////////////////////////////////////////////////////////////////////////////////
+class EnginePool
+{
+public:
+    class lease
+    {
+        friend class EnginePool;
+
+    public:
+        lease() : pool_(nullptr), idx_(0) {}
+        ~lease() { this->release(); }
+
+        lease(lease &&rhs) : pool_(rhs.pool_), idx_(rhs.idx_) { rhs.pool_ = nullptr; }
+
+        lease &operator=(lease &&rhs)
+        {
+            if (this != &rhs)
+            {
+                this->release();
+                this->pool_ = rhs.pool_;
+                this->idx_ = rhs.idx_;
+                rhs.pool_ = nullptr;
+            }
+            return *this;
+        }
+
+        lease(const lease &) = delete;
+        lease &operator=(const lease &) = delete;
+
+        bool valid() const { return this->pool_ != nullptr; }
+        explicit operator bool() const { return this->valid(); }
+
+        Engine &operator*() const { return *this->get(); }
+        Engine *operator->() const { return this->get(); }
+        Engine *get() const { return this->pool_ != nullptr ? this->pool_->slots_[this->idx_].engine.get() : nullptr; }
+
+        // index of the engine in its pool
+        size_t index() const { return this->idx_; }
+
+        // gives the engine back early
+        void release()
+        {
+            if (this->pool_ != nullptr)
+            {
+                this->pool_->give_back(this->idx_);
+                this->pool_ = nullptr;
+            }
+        }
+
+    private:
+        lease(EnginePool *pool, size_t idx) : pool_(pool), idx_(idx) {}
+
+        EnginePool *pool_;
+        size_t idx_;
+    };
+
+    // builds n engines from schema on the shared thread pool
+    // the first exception thrown by a build is rethrown here
+    EnginePool(size_t n, const Schema &schema) : slots_(n)
+    {
+        thread_pool::shared().parallel_for(n, [this, &schema](size_t i) {
+            this->slots_[i].engine = schema.build();
+        });
+    }
+
+    EnginePool(const EnginePool &) = delete;
+    EnginePool &operator=(const EnginePool &) = delete;
+
+    size_t size() const { return this->slots_.size(); }
+
+    // engine i, for setup before the pool is used, not lent out
+    Engine &at(size_t i) { return *this->slots_[i].engine; }
+
+    // blocks until an engine is free
+    lease checkout()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        size_t idx = 0;
+        this->cond_.wait(lock, [this, &idx] { return this->pick(idx); });
+        return this->lend(idx);
+    }
+
+    // an empty lease if every engine is out
+    lease try_checkout()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        size_t idx = 0;
+        return this->pick(idx) ? this->lend(idx) : lease();
+    }
+
+    size_t available() const
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        size_t n = 0;
+        for (auto &slot : this->slots_)
+        {
+            n += slot.busy ? 0 : 1;
+        }
+        return n;
+    }
+
+private:
+    struct slot_t
+    {
+        slot_t() : busy(false) {}
+
+        std::unique_ptr<Engine> engine;
+        bool busy;
+        std::thread::id last;
+    };
+
+    // free engine for the calling thread, by affinity, called with mutex_ held
+    bool pick(size_t &idx) const
+    {
+        const std::thread::id self = std::this_thread::get_id();
+        const size_t none = this->slots_.size();
+        size_t unused = none;
+        size_t other = none;
+
+        for (size_t i = 0; i < this->slots_.size(); ++i)
+        {
+            const slot_t &slot = this->slots_[i];
+            if (slot.busy)
+            {
+                continue;
+            }
+
+            if (slot.last == self)
+            {
+                idx = i;
+                return true;
+            }
+
+            if (slot.last == std::thread::id())
+            {
+                unused = unused == none ? i : unused;
+            }
+            else
+            {
+                other = other == none ? i : other;
+            }
+        }
+
+        idx = unused != none ? unused : other;
+        return idx != none;
+    }
+
+    lease lend(size_t idx)
+    {
+        this->slots_[idx].busy = true;
+        this->slots_[idx].last = std::this_thread::get_id();
+        return lease(this, idx);
+    }
+
+    void give_back(size_t idx)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->slots_[idx].busy = false;
+        }
+
+        this->cond_.notify_all();
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<slot_t> slots_;
+};
+
+} // namespace zlua
@@ -1,7 +1,16 @@
 #pragma once
 #include "common.h"
+#include "array.h"
+#include "async.h"
+#include "column.h"
 #include "core.h"
+#include "cursor.h"
 #include "meta.h"
+#include "object_array.h"
+#include "overload.h"
+#include "parallel.h"
+#include <map>
+#include <string>
 #include <vector>
 
 namespace zlua
@@ -9,14 +18,99 @@ namespace zlua
 class Engine;
 template <typename T, typename Ctor, typename... Bases>
 class Registrar;
+template <typename T>
+struct ptr_vector_registrar;
+
+namespace impl
+{
+// vector.T and vector.T* are registered in a state the first time they are needed there,
+// lua reading vector.T runs the registering function left under "pending" in vector's metatable
+inline int vector_index(lua_State *ls)
+{
+    lua_settop(ls, 2);
+    lua_getmetatable(ls, 1);
+    lua_pushstring(ls, "pending");
+    lua_rawget(ls, -2);
+    lua_pushvalue(ls, 2);
+    if (lua_rawget(ls, -2) != LUA_TFUNCTION)
+    {
+        lua_pushnil(ls);
+        return 1;
+    }
+
+    lua_call(ls, 0, 0);
+    lua_pushvalue(ls, 2);
+    lua_rawget(ls, 1);
+    return 1;
+}
+
+// pushes the global table vector, created on first use
+inline void push_vector_table(lua_State *ls)
+{
+    if (lua_getglobal(ls, "vector") == LUA_TTABLE)
+    {
+        return;
+    }
+    lua_pop(ls, 1);
+
+    lua_newtable(ls);
+    lua_createtable(ls, 0, 2);
+    lua_pushcfunction(ls, &vector_index);
+    lua_setfield(ls, -2, "__index");
+    lua_newtable(ls);
+    lua_setfield(ls, -2, "pending");
+    lua_setmetatable(ls, -2);
+
+    lua_pushvalue(ls, -1);
+    lua_setglobal(ls, "vector");
+}
+
+inline void add_pending_vector(lua_State *ls, const std::string &name, lua_CFunction reg)
+{
+    push_vector_table(ls);
+    if (lua_getmetatable(ls, -1) != 0)
+    {
+        lua_pushstring(ls, "pending");
+        lua_rawget(ls, -2);
+        lua_pushcfunction(ls, reg);
+        lua_setfield(ls, -2, name.c_str());
+        lua_pop(ls, 2);
+    }
+    lua_pop(ls, 1);
+}
+} // namespace impl
 
 template <typename T, typename Enabled = void>
 struct vector_registrar
 {
     using vec_t = std::vector<T>;
 
+    static void fetch(void *ud, void **data, size_t *size)
+    {
+        auto *obj = static_cast<userdata::object_t<vec_t> *>(ud);
+        *data = const_cast<T *>(obj->ptr->data());
+        *size = obj->ptr->size();
+    }
+
+    // on registration of T
+    static void prepare(lua_State *ls)
+    {
+        type_info<vec_t>::set_on_demand(&reg);
+        type_info<std::vector<T *>>::set_on_demand(&ptr_vector_registrar<T>::reg);
+
+        impl::add_pending_vector(ls, type_info<T>::name(), &lua_reg);
+        impl::add_pending_vector(ls, std::string(type_info<T>::name()) + "*", &ptr_vector_registrar<T>::lua_reg);
+    }
+
     static void reg(lua_State *ls)
     {
+        if (luaL_getmetatable(ls, type_info<vec_t>::metatable_name()) != LUA_TNIL)
+        {
+            lua_pop(ls, 1);
+            return;
+        }
+        lua_pop(ls, 1);
+
         std::string vec_name = std::string("vector.") + type_info<T>::name();
 
         Registrar<vec_t, ctor()>(ls, vec_name.c_str())
@@ -25,17 +119,100 @@ struct vector_registrar
             .def("at", (const T &(vec_t::*)(size_t) const) & vec_t::at)
             .def("clear", &vec_t::clear)
             .def("size", &vec_t::size)
+            .def("sort", &parallel::sort<T>)
+            .def("stable_sort", &parallel::stable_sort<T>)
+            .def("reduce", &parallel::reduce<T>)
+            .def("transform", &parallel::transform<T>)
+            .def("partition", &parallel::partition<T>)
+            .def_raw("column", &column_registrar<vec_t>::gather)
+            .def_raw("set_column", &column_registrar<vec_t>::scatter)
+            .def_raw("each", &cursor_registrar<vec_t>::each)
             //
             ;
 
+        static const userdata::contiguous_t desc = {type_tag<T>(), &fetch};
+        luaL_getmetatable(ls, type_info<vec_t>::metatable_name());
+        set_contiguous(ls, &desc);
+        lua_pop(ls, 1);
+
         // vector.int.new()
     }
+
+    static int lua_reg(lua_State *ls)
+    {
+        reg(ls);
+        return 0;
+    }
 };
 
 template <typename T>
 struct vector_registrar<T, typename std::enable_if<is_stl_container<T>::value>::type>
 {
-    static void reg(lua_State *ls) {}
+    static void prepare(lua_State *) {}
+};
+
+// abstract types only come in pointer vectors
+template <typename T>
+struct vector_registrar<T, typename std::enable_if<std::is_abstract<T>::value>::type>
+{
+    static void prepare(lua_State *ls)
+    {
+        type_info<std::vector<T *>>::set_on_demand(&ptr_vector_registrar<T>::reg);
+        impl::add_pending_vector(ls, std::string(type_info<T>::name()) + "*", &ptr_vector_registrar<T>::lua_reg);
+    }
+};
+
+// vector.Role* holds non-owning pointers, read only from lua
+template <typename T>
+struct ptr_vector_registrar
+{
+    using vec_t = std::vector<T *>;
+
+    static void reg(lua_State *ls)
+    {
+        if (luaL_getmetatable(ls, type_info<vec_t>::metatable_name()) != LUA_TNIL)
+        {
+            lua_pop(ls, 1);
+            return;
+        }
+        lua_pop(ls, 1);
+
+        std::string vec_name = std::string("vector.") + type_info<T>::name() + "*";
+
+        Registrar<vec_t, ctor()>(ls, vec_name.c_str())
+            .def("at", (T *const &(vec_t::*)(size_t) const) & vec_t::at)
+            .def("clear", &vec_t::clear)
+            .def("size", &vec_t::size)
+            .def_raw("each", &cursor_registrar<vec_t>::each)
+            //
+            ;
+    }
+
+    static int lua_reg(lua_State *ls)
+    {
+        reg(ls);
+        return 0;
+    }
+};
+
+// T.new_array(n, ...), skipped for containers and abstract types
+template <typename T, typename Ctor, typename Enabled = void>
+struct prepare_object_array
+{
+    static void prepare(lua_State *ls)
+    {
+        object_array_registrar<T>::reg(ls);
+
+        lua_pushstring(ls, "new_array");
+        lua_pushcfunction(ls, object_array_registrar<T>::fetch_creator((Ctor *)0));
+        lua_settable(ls, -3);
+    }
+};
+
+template <typename T, typename Ctor>
+struct prepare_object_array<T, Ctor, typename std::enable_if<is_stl_container<T>::value || std::is_abstract<T>::value>::type>
+{
+    static void prepare(lua_State *) {}
 };
 
 template <typename T, typename Ctor>
@@ -53,7 +230,9 @@ struct prepare_type
         lua_pushcfunction(ls, &lua_object_cloner_wrapper<T>::clone);
         lua_settable(ls, -3);
 
-        lua_setglobal(ls, name);
+        prepare_object_array<T, Ctor>::prepare(ls);
+
+        set_qualified_global(ls, name);
     }
 };
 
@@ -62,16 +241,11 @@ struct prepare_type<std::vector<T>, Ctor>
 {
     static void prepare_type_table(lua_State *ls, const char *name)
     {
-        bool is_new = false;
-
-        lua_getglobal(ls, "vector");
-        if (lua_isnil(ls, -1) != 0)
-        {
-            lua_newtable(ls);
-            is_new = true;
-        }
+        impl::push_vector_table(ls);
 
-        lua_pushstring(ls, type_info<T>::name());
+        // "vector.Role" -> vector["Role"], "int" -> vector["int"]
+        const char *prefix = "vector.";
+        lua_pushstring(ls, strncmp(name, prefix, strlen(prefix)) == 0 ? name + strlen(prefix) : name);
         lua_newtable(ls);
 
         lua_pushstring(ls, "new");
@@ -82,16 +256,8 @@ struct prepare_type<std::vector<T>, Ctor>
         lua_pushcfunction(ls, &lua_object_cloner_wrapper<std::vector<T>>::clone);
         lua_settable(ls, -3);
 
-        lua_settable(ls, -3);
-
-        if (is_new)
-        {
-            lua_setglobal(ls, "vector");
-        }
-        else
-        {
-            lua_pop(ls, 1);
-        }
+        lua_rawset(ls, -3);
+        lua_pop(ls, 1);
     }
 };
 
@@ -101,22 +267,24 @@ class Registrar
     friend class Engine;
 
 public:
+    // the first registration of T to end fixes its bases
     ~Registrar()
     {
         if (this->name_ != nullptr)
         {
-            std::string vec_name = std::string("vector.") + type_info<T>::name();
-            vector_registrar<T>::reg(this->ls_);
+            type_info<T>::freeze();
+            vector_registrar<T>::prepare(this->ls_);
         }
     }
 
     template <typename F>
     Registrar &def(const char *fname, F f)
     {
-        lua_getglobal(this->ls_, this->name_);
+        push_qualified_global(this->ls_, this->name_);
         lua_pushstring(this->ls_, fname);
         lua_pushcfunction(this->ls_, f);
         lua_settable(this->ls_, -3);
+        lua_pop(this->ls_, 1);
         return *this;
     }
 
@@ -129,16 +297,17 @@ public:
         static_assert(check_return_validity<R>::value,
                       "can't register function with return type of pointer to non-class/std::string to lua (except for [const] char*)");
 
+        this->check_name(fname);
+
         using method_t = userdata::method_t<R (T::*)(Args...)>;
 
         luaL_getmetatable(this->ls_, type_info<T>::metatable_name());
-        lua_pushstring(this->ls_, fname);
 
         auto *wrapper = static_cast<method_t *>(lua_newuserdata(this->ls_, sizeof(method_t)));
         new (wrapper) method_t(f);
 
-        lua_pushcclosure(this->ls_, &lua_function_forwarder<T, R, Args...>, 1);
-        lua_rawset(this->ls_, -3);
+        lua_pushcclosure(this->ls_, method_forwarder<T, R, Args...>::get(), 1);
+        this->set_method(fname, overload::signature<Args...>(true));
 
         lua_pop(this->ls_, 1);
         return *this;
@@ -153,25 +322,71 @@ public:
         static_assert(check_return_validity<R>::value,
                       "can't register function with return type of pointer to non-class/std::string to lua (except for [const] char*)");
 
+        this->check_name(fname);
+
         using method_t = userdata::method_t<R (T::*)(Args...) const>;
 
         luaL_getmetatable(this->ls_, type_info<T>::metatable_name());
-        lua_pushstring(this->ls_, fname);
 
         auto *wrapper = static_cast<method_t *>(lua_newuserdata(this->ls_, sizeof(method_t)));
         new (wrapper) method_t(f);
 
-        lua_pushcclosure(this->ls_, &lua_function_forwarder<T, R, Args...>, 1);
-        lua_rawset(this->ls_, -3);
+        lua_pushcclosure(this->ls_, method_forwarder<T, R, Args...>::get(), 1);
+        this->set_method(fname, overload::signature<Args...>(true));
 
         lua_pop(this->ls_, 1);
         return *this;
     }
 
+    // member function whose non-const primitive references are returned as extra values
+    template <typename R, typename... Args>
+    Registrar &def(const char *fname, out_params_t<R (T::*)(Args...)> f)
+    {
+        return this->def_out_params<R (T::*)(Args...), R, Args...>(fname, f.f);
+    }
+
+    template <typename R, typename... Args>
+    Registrar &def(const char *fname, out_params_t<R (T::*)(Args...) const> f)
+    {
+        return this->def_out_params<R (T::*)(Args...) const, R, Args...>(fname, f.f);
+    }
+
+#if __cplusplus >= 201703L
+    // noexcept is part of the function type since c++17
+    template <typename R, typename... Args>
+    Registrar &def(const char *fname, R (T::*f)(Args...) noexcept)
+    {
+        return this->def(fname, static_cast<R (T::*)(Args...)>(f));
+    }
+
+    template <typename R, typename... Args>
+    Registrar &def(const char *fname, R (T::*f)(Args...) const noexcept)
+    {
+        return this->def(fname, static_cast<R (T::*)(Args...) const>(f));
+    }
+#endif
+
+    // free function taking the object as first parameter, called as a method from lua
+    template <typename R, typename... Args>
+    Registrar &def(const char *fname, R (*f)(T &, Args...))
+    {
+        return this->def_extension<T>(fname, f);
+    }
+
+    template <typename R, typename... Args>
+    Registrar &def(const char *fname, R (*f)(const T &, Args...))
+    {
+        return this->def_extension<const T>(fname, f);
+    }
+
     // member variable
+    // (function types excluded, c++17 noexcept member functions would bind here otherwise)
     template <typename P>
-    Registrar &def(const char *mname, P T::*m)
+    typename std::enable_if<!std::is_function<P>::value, Registrar &>::type
+    def(const char *mname, P T::*m)
     {
+        this->check_name(mname);
+
         luaL_getmetatable(this->ls_, type_info<T>::metatable_name());
         lua_pushstring(this->ls_, mname);
 
@@ -181,19 +396,146 @@ public:
 
         property_wrapper->access_handler = &access_property_function<T, P>;
         property_wrapper->write_handler = &write_property_function<T, P>;
+        property_wrapper->gather_handler = &gather_property_function<T, P>;
+        property_wrapper->scatter_handler = &scatter_property_function<T, P>;
+        property_wrapper->get_handler = &get_member_function<T, P T::*>;
+        property_wrapper->set_handler = &set_member_function<T, P T::*>;
         property_wrapper->property_holder = m;
         property_wrapper->property = static_cast<void *>(&property_wrapper->property_holder);
 
         lua_rawset(this->ls_, -3);
 
         lua_pop(this->ls_, 1);
+
+        add_field<T>(this->ls_, mname, property_wrapper);
         return *this;
     }
 
+    // nested member, def("info_id", &Role::info, &Info::id) reads role.info.id in one step
+    template <typename P, typename M, typename... Ms>
+    typename std::enable_if<!std::is_function<P>::value, Registrar &>::type
+    def(const char *mname, P T::*m, M next, Ms... rest)
+    {
+        this->check_name(mname);
+
+        using path_t = userdata::member_path<T, P T::*, M, Ms...>;
+        using leaf_t = typename path_t::leaf_t;
+
+        luaL_getmetatable(this->ls_, type_info<T>::metatable_name());
+        lua_pushstring(this->ls_, mname);
+
+        using property_wrapper_t = userdata::property_wrapper_t<path_t>;
+        auto *property_wrapper = (property_wrapper_t *)lua_newuserdata(this->ls_, sizeof(property_wrapper_t));
+        new (property_wrapper) property_wrapper_t;
+
+        property_wrapper->access_handler = &access_member_function<T, path_t>;
+        property_wrapper->write_handler = &write_member_function<T, path_t>;
+        property_wrapper->gather_handler = &gather_property_function<T, leaf_t, path_t>;
+        property_wrapper->scatter_handler = &scatter_property_function<T, leaf_t, path_t>;
+        property_wrapper->get_handler = &get_member_function<T, path_t>;
+        property_wrapper->set_handler = &set_member_function<T, path_t>;
+        property_wrapper->property_holder = path_t(m, next, rest...);
+        property_wrapper->property = static_cast<void *>(&property_wrapper->property_holder);
+
+        lua_rawset(this->ls_, -3);
+
+        lua_pop(this->ls_, 1);
+
+        add_field<T>(this->ls_, mname, property_wrapper);
+        return *this;
+    }
+
+    // raw lua_CFunction as method, object at index 1, replaces overloads of fname
+    Registrar &def_raw(const char *fname, lua_CFunction f)
+    {
+        this->check_name(fname);
+        this->methods_.erase(fname);
+
+        luaL_getmetatable(this->ls_, type_info<T>::metatable_name());
+        lua_pushstring(this->ls_, fname);
+        lua_pushcfunction(this->ls_, f);
+        lua_rawset(this->ls_, -3);
+
+        lua_pop(this->ls_, 1);
+        return *this;
+    }
+
+    template <typename F, typename R, typename... Args>
+    Registrar &def_out_params(const char *fname, F f)
+    {
+        static_assert(check_params_validity<out_checked_t<Args>...>::value,
+                      "can't register function with parameter of non-const reference or pointer to non-class type to lua (except for const char*)");
+        static_assert(check_return_validity<R>::value,
+                      "can't register function with return type of pointer to non-class/std::string to lua (except for [const] char*)");
+
+        this->check_name(fname);
+
+        using method_t = userdata::method_t<F>;
+
+        luaL_getmetatable(this->ls_, type_info<T>::metatable_name());
+
+        auto *wrapper = static_cast<method_t *>(lua_newuserdata(this->ls_, sizeof(method_t)));
+        new (wrapper) method_t(f);
+
+        lua_pushcclosure(this->ls_, &lua_out_params_forwarder<T, R, Args...>, 1);
+        this->set_method(fname, overload::out_params_signature<Args...>(true));
+
+        lua_pop(this->ls_, 1);
+        return *this;
+    }
+
+    template <typename Self, typename R, typename... Args>
+    Registrar &def_extension(const char *fname, R (*f)(Self &, Args...))
+    {
+        static_assert(check_params_validity<Args...>::value,
+                      "can't register function with parameter of non-const reference or pointer to non-class type to lua (except for const char*)");
+        static_assert(check_return_validity<R>::value,
+                      "can't register function with return type of pointer to non-class/std::string to lua (except for [const] char*)");
+
+        this->check_name(fname);
+
+        using function_t = userdata::function_t<R (*)(Self &, Args...)>;
+
+        luaL_getmetatable(this->ls_, type_info<T>::metatable_name());
+
+        auto *wrapper = static_cast<function_t *>(lua_newuserdata(this->ls_, sizeof(function_t)));
+        new (wrapper) function_t(f);
+
+        lua_pushcclosure(this->ls_, &lua_extension_forwarder<T, Self, R, Args...>, 1);
+        this->set_method(fname, overload::signature<Args...>(true));
+
+        lua_pop(this->ls_, 1);
+        return *this;
+    }
+
+    // additional constructor, T.new picks by arguments, def_ctor<ctor(double, double)>()
+    template <typename C>
+    Registrar &def_ctor()
+    {
+        return this->def_ctor((C *)0);
+    }
+
     template <typename... Ts>
     Registrar &inherit()
     {
         type_info<T>::template inherit_from<Ts...>();
+        this->inherit_fields<Ts...>();
+        return *this;
+    }
+
+    // values of T returned by value reach lua as tables of its registered fields
+    // only in this lua state, other engines registering T keep returning objects
+    Registrar &return_as_table(bool b = true)
+    {
+        if (b)
+        {
+            type_info<T>::set_return_as_table(true);
+        }
+
+        luaL_getmetatable(this->ls_, type_info<T>::metatable_name());
+        lua_pushboolean(this->ls_, b);
+        lua_rawsetp(this->ls_, -2, as_table_key());
+        lua_pop(this->ls_, 1);
         return *this;
     }
 
@@ -201,14 +543,15 @@ public:
     Registrar(lua_State *ls, const char *name)
         : ls_(ls)
     {
-        ZLUA_CHECK_THROW(ls, !type_info<T>::is_registered(), "register type<" + type_name<T>() + "> in name '" + name + "' failed, already registered with name " + type_info<T>::name());
-        type_info<T>::set_name(name);
+        ZLUA_CHECK_THROW(ls, type_info<T>::set_name(name), "register type<" + type_name<T>() + "> in name '" + name + "' failed, already registered with name " + type_info<T>::name());
 
         type_info<T>::template inherit_from<Bases...>();
 
         this->name_ = name;
+        this->inherit_fields<Bases...>();
 
         prepare_type<T, Ctor>::prepare_type_table(ls, name);
+        this->ctors_.push_back(ctor_signature((Ctor *)0));
 
         // this->prepare_type_table();
         this->prepare_metatable();
@@ -245,13 +588,74 @@ public:
         lua_pushcfunction(this->ls_, (&lua_object_deleter<T>));
         lua_rawset(this->ls_, -3);
 
+        lua_pushstring(this->ls_, "pin");
+        lua_pushcfunction(this->ls_, (&lua_object_pin<T>));
+        lua_rawset(this->ls_, -3);
+
+        lua_pushstring(this->ls_, "assign");
+        lua_pushcfunction(this->ls_, (&lua_object_assign<T>));
+        lua_rawset(this->ls_, -3);
+
+        lua_pushstring(this->ls_, "to_table");
+        lua_pushcfunction(this->ls_, (&lua_object_to_table<T>));
+        lua_rawset(this->ls_, -3);
+
+        lua_pushlightuserdata(this->ls_, const_cast<userdata::transfer_t *>(object_transfer<T>::get()));
+        lua_rawsetp(this->ls_, -2, transfer_key());
+
+        lua_pop(this->ls_, 1);
+    }
+
+    // pin, assign and to_table are set in every metatable, methods and fields can't replace them
+    void check_name(const char *fname)
+    {
+        static const char *const reserved[] = {"pin", "assign", "to_table"};
+        for (const char *r : reserved)
+        {
+            ZLUA_CHECK_THROW(this->ls_, strcmp(fname, r) != 0, std::string("register ") + fname + " of type " + this->name_ + " failed, the name is reserved");
+        }
+    }
+
+    // closure on top of stack, metatable below, fname accumulates overloads
+    void set_method(const char *fname, const overload::candidate_t &sig)
+    {
+        auto &sigs = this->methods_[fname];
+        sigs.push_back(sig);
+        overload::set_function(this->ls_, fname, sigs);
+    }
+
+    template <typename... Args>
+    static overload::candidate_t ctor_signature(void (*)(Args...))
+    {
+        return overload::signature<Args...>(false);
+    }
+
+    template <typename... Args>
+    Registrar &def_ctor(void (*)(Args...))
+    {
+        push_qualified_global(this->ls_, this->name_);
+        ZLUA_CHECK_THROW(this->ls_, lua_istable(this->ls_, -1), std::string("no type table ") + this->name_ + " for constructors");
+
+        lua_pushcfunction(this->ls_, (&lua_object_creator<T, Args...>));
+        this->ctors_.push_back(ctor_signature((void (*)(Args...))0));
+        overload::set_function(this->ls_, "new", this->ctors_);
+
         lua_pop(this->ls_, 1);
+        return *this;
+    }
+
+    template <typename... Ts>
+    void inherit_fields()
+    {
+        int expand[] = {0, (zlua::inherit_fields<T, Ts>(this->ls_), 0)...};
+        (void)expand;
     }
 
     // forbid assignment/copy ctor
     Registrar(const Registrar &) = delete;
     Registrar &operator=(const Registrar &) = delete;
-    Registrar(Registrar &&rhs) : ls_(rhs.ls_), name_(rhs.name_)
+    Registrar(Registrar &&rhs)
+        : ls_(rhs.ls_), name_(rhs.name_), methods_(std::move(rhs.methods_)), ctors_(std::move(rhs.ctors_))
     {
         rhs.ls_ = nullptr;
         rhs.name_ = nullptr;
@@ -259,6 +663,55 @@ public:
 
     lua_State *ls_;
     const char *name_;
+
+    // signatures of the functions under each method name and of T.new, for overloads
+    std::map<std::string, std::vector<overload::candidate_t>> methods_;
+    std::vector<overload::candidate_t> ctors_;
+};
+
+template <typename T>
+struct array_registrar
+{
+    using array_t = array<T>;
+
+    static void fetch(void *ud, void **data, size_t *size)
+    {
+        auto *obj = static_cast<userdata::object_t<array_t> *>(ud);
+        *data = const_cast<T *>(obj->ptr->data());
+        *size = obj->ptr->size();
+    }
+
+    static void reg(lua_State *ls, const char *name)
+    {
+        Registrar<array_t, ctor(size_t)>(ls, name)
+            .def("get", &array_t::get)
+            .def("set", &array_t::set)
+            .def("push_back", &array_t::push_back)
+            .def("resize", &array_t::resize)
+            .def("reserve", &array_t::reserve)
+            .def("clear", &array_t::clear)
+            .def("size", &array_t::size)
+            .def("fill", &array_t::fill)
+            .def("copy", &array_t::copy)
+            .def("slice", &array_t::slice)
+            .def("add", &array_t::add)
+            .def("mul", &array_t::mul)
+            .def("axpy", &array_t::axpy)
+            .def("sum", &array_t::sum)
+            .def("dot", &array_t::dot)
+            .def("min", &array_t::min)
+            .def("max", &array_t::max)
+            .def("clamp", &array_t::clamp)
+            .def("gather", &array_t::gather)
+            .def("scatter", &array_t::scatter)
+            //
+            ;
+
+        static const userdata::contiguous_t desc = {type_tag<T>(), &fetch};
+        luaL_getmetatable(ls, type_info<array_t>::metatable_name());
+        set_contiguous(ls, &desc);
+        lua_pop(ls, 1);
+    }
 };
 
 template <typename E>
@@ -275,6 +728,7 @@ public:
         lua_pushstring(this->ls_, ename);
         lua_pushinteger(this->ls_, static_cast<typename std::underlying_type<E>::type>(e));
         lua_settable(this->ls_, -3);
+        lua_pop(this->ls_, 1);
 
         return *this;
     }
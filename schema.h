@@ -0,0 +1,195 @@
+#pragma once
+#include "common.h"
+#include "engine.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// Schema
+// bindings recorded once and built into any number of engines
+//   zlua::Schema schema;
+//   schema.reg<Role, ctor(const std::string &, int)>("Role").def("name", &Role::name).def("get_age", &Role::get_age);
+//   schema.reg<Color>("Color").def("Red", Red);
+//   schema.on_build([](zlua::Engine &e) { e.reg_map<std::map<std::string, int>>("map.str_int"); });
+//   std::unique_ptr<zlua::Engine> engine = schema.build();
+// the recorders take the same arguments as Registrar/EnumRegistrar, steps run in recording order
+// each type's metatable is allocated at its final size before its methods are set
+// a schema is read only while engines are built from it, concurrent builds are fine
+////////////////////////////////////////////////////////////////////////////////
+class Schema;
+
+template <typename T, typename C, typename... Bases>
+class TypeRecorder
+{
+    friend class Schema;
+
+public:
+    using registrar_t = Registrar<T, C, Bases...>;
+    using step_t = std::function<void(registrar_t &)>;
+
+    template <typename... A>
+    TypeRecorder &def(const char *fname, A... a)
+    {
+        std::string name(fname);
+        this->steps_->push_back([name, a...](registrar_t &r) { r.def(name.c_str(), a...); });
+        return *this;
+    }
+
+    TypeRecorder &def_raw(const char *fname, lua_CFunction f)
+    {
+        std::string name(fname);
+        this->steps_->push_back([name, f](registrar_t &r) { r.def_raw(name.c_str(), f); });
+        return *this;
+    }
+
+    template <typename F>
+    TypeRecorder &def_extension(const char *fname, F f)
+    {
+        std::string name(fname);
+        this->steps_->push_back([name, f](registrar_t &r) { r.def_extension(name.c_str(), f); });
+        return *this;
+    }
+
+    template <typename Ctor>
+    TypeRecorder &def_ctor()
+    {
+        this->steps_->push_back([](registrar_t &r) { r.template def_ctor<Ctor>(); });
+        return *this;
+    }
+
+    template <typename... Ts>
+    TypeRecorder &inherit()
+    {
+        this->steps_->push_back([](registrar_t &r) { r.template inherit<Ts...>(); });
+        return *this;
+    }
+
+    TypeRecorder &return_as_table(bool b = true)
+    {
+        this->steps_->push_back([b](registrar_t &r) { r.return_as_table(b); });
+        return *this;
+    }
+
+private:
+    explicit TypeRecorder(std::shared_ptr<std::vector<step_t>> steps) : steps_(std::move(steps)) {}
+
+    std::shared_ptr<std::vector<step_t>> steps_;
+};
+
+template <typename E>
+class EnumRecorder
+{
+    friend class Schema;
+
+public:
+    EnumRecorder &def(const char *ename, E e)
+    {
+        this->values_->emplace_back(ename, e);
+        return *this;
+    }
+
+private:
+    explicit EnumRecorder(std::shared_ptr<std::vector<std::pair<std::string, E>>> values) : values_(std::move(values)) {}
+
+    std::shared_ptr<std::vector<std::pair<std::string, E>>> values_;
+};
+
+class Schema
+{
+public:
+    using step_t = std::function<void(Engine &)>;
+
+    template <typename T, typename C, typename... Bases>
+    TypeRecorder<T, C, Bases...> reg(const char *name)
+    {
+        using recorder_t = TypeRecorder<T, C, Bases...>;
+        auto steps = std::make_shared<std::vector<typename recorder_t::step_t>>();
+
+        std::string type_name(name);
+        this->steps_.push_back([type_name, steps](Engine &engine) {
+            lua_State *ls = engine.get_lua_state();
+            ZLUA_CHECK_THROW(ls, type_info<T>::set_name(type_name.c_str()), "register type<" + zlua::type_name<T>() + "> in name '" + type_name + "' failed, already registered with name " + type_info<T>::name());
+            reserve_metatable(ls, type_info<T>::metatable_name(), static_cast<int>(steps->size()) + reserved_metafields);
+
+            typename recorder_t::registrar_t registrar(ls, type_name.c_str());
+            for (auto &step : *steps)
+            {
+                step(registrar);
+            }
+        });
+
+        return recorder_t(steps);
+    }
+
+    template <typename E>
+    EnumRecorder<E> reg(const char *name)
+    {
+        auto values = std::make_shared<std::vector<std::pair<std::string, E>>>();
+
+        std::string enum_name(name);
+        this->steps_.push_back([enum_name, values](Engine &engine) {
+            auto &&registrar = engine.reg<E>(enum_name.c_str());
+            for (auto &v : *values)
+            {
+                registrar.def(v.first.c_str(), v.second);
+            }
+        });
+
+        return EnumRecorder<E>(values);
+    }
+
+    // anything else an engine needs, maps, functors, interfaces, scripts
+    Schema &on_build(step_t step)
+    {
+        this->steps_.push_back(std::move(step));
+        return *this;
+    }
+
+    size_t size() const { return this->steps_.size(); }
+
+    // registers everything recorded in engine
+    void apply(Engine &engine) const
+    {
+        for (auto &step : this->steps_)
+        {
+            step(engine);
+        }
+    }
+
+    std::unique_ptr<Engine> build() const
+    {
+        std::unique_ptr<Engine> engine(new Engine());
+        this->apply(*engine);
+        return engine;
+    }
+
+private:
+    // __name, __index, __newindex, __gc, pin, assign, to_table, transfer
+    const static int reserved_metafields = 8;
+
+    // creates the metatable luaL_newmetatable would, with room for nrec entries
+    static void reserve_metatable(lua_State *ls, const char *metatable_name, int nrec)
+    {
+        lua_getfield(ls, LUA_REGISTRYINDEX, metatable_name);
+        bool exists = !lua_isnil(ls, -1);
+        lua_pop(ls, 1);
+        if (exists)
+        {
+            return;
+        }
+
+        lua_createtable(ls, 0, nrec);
+        lua_pushstring(ls, metatable_name);
+        lua_setfield(ls, -2, "__name");
+        lua_setfield(ls, LUA_REGISTRYINDEX, metatable_name);
+    }
+
+    std::vector<step_t> steps_;
+};
+
+} // namespace zlua
@@ -0,0 +1,124 @@
+#pragma once
+#include "common.h"
+#include "meta.h"
+#include "stack.h"
+#include "userdata.h"
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// span
+// non-owning view of contiguous elements, a c++11 stand-in for std::span
+// registered functions may take span<[const] T> to read lua owned arrays in place
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class span
+{
+public:
+    using element_type = T;
+    using value_type = typename std::remove_cv<T>::type;
+    using iterator = T *;
+
+    span() : data_(nullptr), size_(0) {}
+    span(T *data, size_t size) : data_(data), size_(size) {}
+
+    template <size_t N>
+    span(T (&arr)[N]) : data_(arr), size_(N) {}
+
+    template <typename U, typename = typename std::enable_if<std::is_convertible<U (*)[], T (*)[]>::value>::type>
+    span(const span<U> &rhs) : data_(rhs.data()), size_(rhs.size()) {}
+
+    T *data() const { return this->data_; }
+    size_t size() const { return this->size_; }
+    bool empty() const { return this->size_ == 0; }
+
+    T &operator[](size_t i) const { return this->data_[i]; }
+
+    iterator begin() const { return this->data_; }
+    iterator end() const { return this->data_ + this->size_; }
+
+    span subspan(size_t offset, size_t count = size_t(-1)) const
+    {
+        offset = offset < this->size_ ? offset : this->size_;
+        count = count < this->size_ - offset ? count : this->size_ - offset;
+        return span(this->data_ + offset, count);
+    }
+
+private:
+    T *data_;
+    size_t size_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// contiguous
+// metatable slot describing how to view a userdata as contiguous elements
+////////////////////////////////////////////////////////////////////////////////
+inline const void *contiguous_key()
+{
+    static const char key = 0;
+    return &key;
+}
+
+// binds metatable on top of stack to descriptor
+inline void set_contiguous(lua_State *ls, const userdata::contiguous_t *desc)
+{
+    lua_pushlightuserdata(ls, const_cast<userdata::contiguous_t *>(desc));
+    lua_rawsetp(ls, -2, contiguous_key());
+}
+
+// fetch data/size of userdata at pos, false if it is not a contiguous container of elem_tag
+inline bool fetch_contiguous(lua_State *ls, int pos, const void *elem_tag, void **data, size_t *size, bool *is_const)
+{
+    void *ud = lua_touserdata(ls, pos);
+    if (ud == nullptr || lua_getmetatable(ls, pos) == 0)
+    {
+        return false;
+    }
+
+    lua_rawgetp(ls, -1, contiguous_key());
+    auto *desc = static_cast<const userdata::contiguous_t *>(lua_touserdata(ls, -1));
+    lua_pop(ls, 2);
+
+    if (desc == nullptr || desc->elem_tag != elem_tag)
+    {
+        return false;
+    }
+
+    // every contiguous container is wrapped by userdata::object_t
+    *is_const = static_cast<userdata::object_t<char> *>(ud)->is_const;
+    desc->fetch(ud, data, size);
+    return true;
+}
+
+template <typename T>
+struct stack_op<span<T>>
+{
+    using value_type = typename span<T>::value_type;
+
+    static void peek(lua_State *ls, span<T> &s, int pos = -1)
+    {
+        if (lua_isnil(ls, pos) != 0)
+        {
+            s = span<T>();
+            return;
+        }
+
+        void *data = nullptr;
+        size_t size = 0;
+        bool is_const = false;
+        ZLUA_ARG_CHECK_THROW(ls, fetch_contiguous(ls, pos, type_tag<value_type>(), &data, &size, &is_const), pos,
+                             "not a contiguous container of " + type_name<value_type>());
+        ZLUA_ARG_CHECK_THROW(ls, std::is_const<T>::value || !is_const, pos,
+                             "cannot cast const container to span<" + type_name<value_type>() + ">");
+
+        s = span<T>(static_cast<T *>(data), size);
+    }
+
+    static void pop(lua_State *ls, span<T> &s, int pos = -1)
+    {
+        peek(ls, s, pos);
+        lua_remove(ls, pos);
+    }
+};
+
+} // namespace zlua
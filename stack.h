@@ -1,6 +1,7 @@
 #pragma once
 #include "common.h"
 #include "traits.h"
+#include "marshal.h"
 #include "meta.h"
 #include "userdata.h"
 #include <utility>
@@ -64,7 +65,7 @@ struct stack_op<T, typename std::enable_if<
     static typename std::enable_if<!std::is_pointer<U>::value>::type
     peek(lua_State *ls, U &u, int pos = -1)
     {
-        ZLUA_ARG_CHECK_THROW(ls, lua_isinteger(ls, pos), pos, "not a floating point value");
+        ZLUA_ARG_CHECK_THROW(ls, lua_isnumber(ls, pos), pos, "not a floating point value");
         u = static_cast<Base>(luaL_checknumber(ls, pos));
     }
 
@@ -126,10 +127,13 @@ struct stack_op<T, typename std::enable_if<
         _push(ls, &c, 1);
     }
 
+    // sized by lua's length, keeps embedded NULs
     static void peek(lua_State *ls, std::string &s, int pos = -1)
     {
         ZLUA_ARG_CHECK_THROW(ls, lua_isstring(ls, pos), pos, "not a string value");
-        s = luaL_checkstring(ls, pos);
+        size_t len = 0;
+        const char *p = lua_tolstring(ls, pos, &len);
+        s.assign(p, len);
     }
 
     static void peek(lua_State *ls, const char *&s, int pos = -1)
@@ -178,6 +182,53 @@ private:
     }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// std::string_view
+// points straight into lua's string storage, no copy and no strlen
+// pop keeps the lua string at the bottom of the current call frame
+// so the view stays valid until the registered function returns
+#if __cplusplus >= 201703L
+inline bool fetch_contiguous(lua_State *ls, int pos, const void *elem_tag, void **data, size_t *size, bool *is_const);
+
+template <typename T>
+struct stack_op<T, typename std::enable_if<
+                       !is_reference_wrapper<T>::value &&
+                       is_string_view_type<base_type_t<T>>::value>::type>
+{
+    static void push(lua_State *ls, std::string_view s)
+    {
+        lua_pushlstring(ls, s.data(), s.size());
+    }
+
+    // lua strings, or userdata laid out as contiguous chars (buffer)
+    static void peek(lua_State *ls, std::string_view &s, int pos = -1)
+    {
+        void *data = nullptr;
+        size_t size = 0;
+        bool is_const = false;
+        if (lua_type(ls, pos) == LUA_TUSERDATA && fetch_contiguous(ls, pos, type_tag<char>(), &data, &size, &is_const))
+        {
+            s = std::string_view(static_cast<const char *>(data), size);
+            return;
+        }
+
+        ZLUA_ARG_CHECK_THROW(ls, lua_isstring(ls, pos), pos, "not a string value");
+        size_t len = 0;
+        const char *p = lua_tolstring(ls, pos, &len);
+        s = std::string_view(p, len);
+    }
+
+    static void pop(lua_State *ls, std::string_view &s, int pos = -1)
+    {
+        pos = lua_absindex(ls, pos);
+        peek(ls, s, pos);
+        lua_pushvalue(ls, pos);
+        lua_insert(ls, 1);
+        lua_remove(ls, pos + 1);
+    }
+};
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // struct/class
 // rejects std::string and stl containers(vector, map, set, etc...)
@@ -187,6 +238,11 @@ struct stack_op<T, typename std::enable_if<
                        !std::is_same<base_type_t<T>, std::string>::value &&
                        //!is_stl_container<base_type_t<T>>::value &&
                        !is_tuple_type<base_type_t<T>>::value &&
+                       !is_pair_type<base_type_t<T>>::value &&
+                       !is_optional_type<base_type_t<T>>::value &&
+                       !is_span_type<base_type_t<T>>::value &&
+                       !is_string_view_type<base_type_t<T>>::value &&
+                       !is_lua_ref_type<base_type_t<T>>::value &&
                        !is_reference_wrapper<T>::value>::type>
 {
     using Base = base_type_t<T>;
@@ -194,8 +250,14 @@ struct stack_op<T, typename std::enable_if<
     using const_userdata_object_t = userdata::object_t<const Base>;
 
     // rvalue
-    static void push(lua_State *ls, Base &&b, int pos = -1)
+    static void push(lua_State *ls, Base &&b, int = -1)
     {
+        if (type_info<Base>::return_as_table() && returns_as_table(ls))
+        {
+            marshal<Base>::to_table(ls, b);
+            return;
+        }
+
         auto *object_wrapper = static_cast<userdata_object_t *>(lua_newuserdata(ls, sizeof(userdata_object_t)));
         new (object_wrapper) userdata_object_t;
         object_wrapper->ptr = new Base(std::move(b));
@@ -205,7 +267,7 @@ struct stack_op<T, typename std::enable_if<
     }
 
     // lvalue
-    static void push_new(lua_State *ls, Base *b, int pos = -1)
+    static void push_new(lua_State *ls, Base *b, int = -1)
     {
         auto *object_wrapper = static_cast<userdata_object_t *>(lua_newuserdata(ls, sizeof(userdata_object_t)));
         new (object_wrapper) userdata_object_t;
@@ -215,7 +277,7 @@ struct stack_op<T, typename std::enable_if<
         prepare_metatable(ls);
     }
 
-    static void push(lua_State *ls, Base *b, int pos = -1)
+    static void push(lua_State *ls, Base *b, int = -1)
     {
         if (b == nullptr)
         {
@@ -230,7 +292,7 @@ struct stack_op<T, typename std::enable_if<
         prepare_metatable(ls);
     }
 
-    static void push(lua_State *ls, const Base *b, int pos = -1)
+    static void push(lua_State *ls, const Base *b, int = -1)
     {
         if (b == nullptr)
         {
@@ -256,11 +318,16 @@ struct stack_op<T, typename std::enable_if<
     }
 
     // peek
+    // a table converts through the registered fields
     static void peek(lua_State *ls, Base &b, int pos = -1)
     {
-        // ZLUA_ARG_CHECK_THROW(ls, luaL_checkudata(ls, pos, type_info<Base>::name()), pos, "incorrect userdata type");
-        auto *object_wrapper = static_cast<userdata_object_t *>(lua_touserdata(ls, pos));
-        b = *object_wrapper->ptr;
+        if (lua_istable(ls, pos))
+        {
+            marshal<Base>::from_table(ls, pos, b);
+            return;
+        }
+
+        b = *base_ptr(ls, pos, check_object(ls, pos));
     }
 
     static void peek(lua_State *ls, Base *&b, int pos = -1)
@@ -272,10 +339,11 @@ struct stack_op<T, typename std::enable_if<
             return;
         }
 
-        auto *object_wrapper = static_cast<userdata_object_t *>(lua_touserdata(ls, pos));
+        ZLUA_ARG_CHECK_THROW(ls, !lua_istable(ls, pos), pos, "cannot bind table to non-const " + std::string(type_info<Base>::name()));
+        auto *object_wrapper = check_object(ls, pos);
         ZLUA_ARG_CHECK_THROW(ls, !object_wrapper->is_const, pos, "cannot cast const " + type_name<Base>() + " to non-const reference");
 
-        b = object_wrapper->ptr;
+        b = base_ptr(ls, pos, object_wrapper);
     }
 
     static void peek(lua_State *ls, const Base *&b, int pos = -1)
@@ -286,9 +354,13 @@ struct stack_op<T, typename std::enable_if<
             return;
         }
 
-        // ZLUA_ARG_CHECK_THROW(ls, luaL_checkudata(ls, pos, type_info<Base>::name()), pos, "incorrect userdata type");
-        auto *object_wrapper = static_cast<userdata_object_t *>(lua_touserdata(ls, pos));
-        b = object_wrapper->ptr;
+        if (lua_istable(ls, pos))
+        {
+            b = from_table(ls, pos);
+            return;
+        }
+
+        b = base_ptr(ls, pos, check_object(ls, pos));
     }
 
     // pop
@@ -300,11 +372,76 @@ struct stack_op<T, typename std::enable_if<
     }
 
 private:
+    // the object at pos, derived types share the layout so only functors, which have no
+    // bases, are matched against their exact metatable
+    static userdata_object_t *check_object(lua_State *ls, int pos)
+    {
+        if (is_functor_type<Base>::value)
+        {
+            ZLUA_ARG_CHECK_THROW(ls, luaL_testudata(ls, pos, type_info<Base>::metatable_name()) != nullptr, pos, "expected a registered functor of this signature");
+        }
+
+        ZLUA_ARG_CHECK_THROW(ls, lua_type(ls, pos) == LUA_TUSERDATA, pos, "expected " + std::string(type_info<Base>::name()));
+        return static_cast<userdata_object_t *>(lua_touserdata(ls, pos));
+    }
+
+    // whether Base is returned by value as a table in ls
+    static bool returns_as_table(lua_State *ls)
+    {
+        bool b = false;
+        if (luaL_getmetatable(ls, type_info<Base>::metatable_name()) == LUA_TTABLE)
+        {
+            lua_rawgetp(ls, -1, as_table_key());
+            b = lua_toboolean(ls, -1) != 0;
+            lua_pop(ls, 1);
+        }
+        lua_pop(ls, 1);
+
+        return b;
+    }
+
+    // the Base part of the object at pos, which may be of a type registered with Base as a base
+    static Base *base_ptr(lua_State *ls, int pos, userdata_object_t *object_wrapper)
+    {
+        Base *b = object_wrapper->ptr;
+        if (b == nullptr || !type_info<Base>::is_registered() || lua_getmetatable(ls, pos) == 0)
+        {
+            return b;
+        }
+
+        size_t offset = 0;
+        if (lua_rawgetp(ls, -1, transfer_key()) == LUA_TLIGHTUSERDATA)
+        {
+            auto *transfer = static_cast<const userdata::transfer_t *>(lua_touserdata(ls, -1));
+            transfer->base_offset(type_info<Base>::name(), &offset);
+        }
+        lua_pop(ls, 2);
+
+        return reinterpret_cast<Base *>((char *)b + offset);
+    }
+
+    // object converted from the table at pos for a const reference/pointer parameter
+    // kept alive at the bottom of the current call frame until the call returns
+    static const Base *from_table(lua_State *ls, int pos)
+    {
+        pos = lua_absindex(ls, pos);
+
+        auto *object_wrapper = static_cast<userdata_object_t *>(lua_newuserdata(ls, sizeof(userdata_object_t)));
+        new (object_wrapper) userdata_object_t;
+        object_wrapper->ptr = new_marshal_target<Base>(ls);
+        object_wrapper->need_release = true;
+        prepare_metatable(ls);
+
+        marshal<Base>::from_table(ls, pos, *object_wrapper->ptr);
+        lua_insert(ls, 1);
+        return object_wrapper->ptr;
+    }
+
     static void prepare_metatable(lua_State *ls)
     {
         // ZLUA_CHECK_THROW(ls, type_info<Base>::is_registered(), std::string("prepare_metatable for type <") + type_name<Base>() + "> failed, not registered");
-        const char *metatable_name = type_info<Base>::metatable_name();
-        luaL_setmetatable(ls, metatable_name);
+        push_metatable<Base>(ls);
+        lua_setmetatable(ls, -2);
     }
 };
 
@@ -372,6 +509,17 @@ struct tuple_op
         stack_op<decltype(std::get<N - 1>(t))>::push(ls, std::get<N - 1>(t));
     }
 
+    // returned tuples, elements held by value are moved out, reference elements stay views
+    template <typename... Args>
+    static void push(lua_State *ls, std::tuple<Args...> &&t)
+    {
+        tuple_op<N - 1>::push(ls, std::move(t));
+        using elem_t = typename std::tuple_element<N - 1, std::tuple<Args...>>::type;
+        stack_op<elem_t>::push(ls, std::forward<elem_t>(std::get<N - 1>(t)));
+    }
+
+    // table_pos 0 reads values from the stack, otherwise from the table on top, which stays there
+    // (table arguments converted for const references are anchored below it, at index 1)
     template <typename... Args>
     static void pop(lua_State *ls, std::tuple<Args...> &t, int table_pos, bool reversed_order = false)
     {
@@ -379,10 +527,9 @@ struct tuple_op
 
         if (!reversed_order)
         {
-            if (lua_istable(ls, table_pos) != 0)
+            if (table_pos != 0)
             {
-                lua_pushinteger(ls, N);
-                lua_rawget(ls, table_pos);
+                lua_rawgeti(ls, -1, N);
             }
 
             stack_op<elem_t>::pop(ls, std::get<N - 1>(t));
@@ -392,10 +539,9 @@ struct tuple_op
 
         if (reversed_order)
         {
-            if (lua_istable(ls, table_pos) != 0)
+            if (table_pos != 0)
             {
-                lua_pushinteger(ls, N);
-                lua_rawget(ls, table_pos);
+                lua_rawgeti(ls, -1, N);
             }
 
             stack_op<elem_t>::pop(ls, std::get<N - 1>(t));
@@ -407,10 +553,13 @@ template <>
 struct tuple_op<0>
 {
     template <typename... Args>
-    static void push(lua_State *ls, std::tuple<Args...> &t) {}
+    static void push(lua_State *, std::tuple<Args...> &) {}
 
     template <typename... Args>
-    static void pop(lua_State *ls, std::tuple<Args...> &t, int table_pos, bool reversed_order = false) {}
+    static void push(lua_State *, std::tuple<Args...> &&) {}
+
+    template <typename... Args>
+    static void pop(lua_State *, std::tuple<Args...> &, int, bool = false) {}
 };
 } // namespace impl
 
@@ -422,18 +571,97 @@ struct stack_op<std::tuple<Args...>>
         impl::tuple_op<sizeof...(Args)>::push(ls, tuple);
     }
 
+    static void push(lua_State *ls, std::tuple<Args...> &&tuple)
+    {
+        impl::tuple_op<sizeof...(Args)>::push(ls, std::move(tuple));
+    }
+
     // not implemented for this type
     static void peek(lua_State *ls, std::tuple<Args...> &tuple) {}
 
-    static void pop(lua_State *ls, std::tuple<Args...> &tuple, int pos = -1)
+    // a sequence on top supplies the values when lua passed nargs (default: the whole stack)
+    // values for a different number of parameters, and the last parameter doesn't take a table;
+    // record tables are values themselves
+    static void pop(lua_State *ls, std::tuple<Args...> &tuple, int = -1, int nargs = -1)
+    {
+        nargs = nargs < 0 ? lua_gettop(ls) : nargs;
+        bool from_table = !last_accepts_table<Args...>::value &&
+                          nargs != static_cast<int>(sizeof...(Args)) &&
+                          lua_istable(ls, -1) != 0 && lua_rawlen(ls, -1) > 0;
+        impl::tuple_op<sizeof...(Args)>::pop(ls, tuple, from_table ? -1 : 0, false);
+        if (from_table)
+        {
+            lua_pop(ls, 1);
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// pair, pushed as two values
+template <typename A, typename B>
+struct stack_op<std::pair<A, B>>
+{
+    static void push(lua_State *ls, const std::pair<A, B> &p)
+    {
+        stack_op<A>::push(ls, p.first);
+        stack_op<B>::push(ls, p.second);
+    }
+
+    static void push(lua_State *ls, std::pair<A, B> &&p)
     {
-        impl::tuple_op<sizeof...(Args)>::pop(ls, tuple, pos, false);
-        if (lua_istable(ls, pos) != 0)
+        stack_op<A>::push(ls, std::forward<A>(p.first));
+        stack_op<B>::push(ls, std::forward<B>(p.second));
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// optional, nil when empty
+#if __cplusplus >= 201703L
+template <typename T>
+struct stack_op<std::optional<T>>
+{
+    static void push(lua_State *ls, const std::optional<T> &o)
+    {
+        if (!o.has_value())
         {
-            lua_remove(ls, pos);
+            lua_pushnil(ls);
+            return;
         }
+
+        stack_op<T>::push(ls, T(*o));
+    }
+
+    static void push(lua_State *ls, std::optional<T> &&o)
+    {
+        if (!o.has_value())
+        {
+            lua_pushnil(ls);
+            return;
+        }
+
+        stack_op<T>::push(ls, std::move(*o));
+    }
+
+    static void peek(lua_State *ls, std::optional<T> &o, int pos = -1)
+    {
+        if (lua_isnoneornil(ls, pos))
+        {
+            o.reset();
+            return;
+        }
+
+        T value{};
+        stack_op<T>::peek(ls, value, pos);
+        o = std::move(value);
+    }
+
+    static void pop(lua_State *ls, std::optional<T> &o, int pos = -1)
+    {
+        peek(ls, o, pos);
+        lua_remove(ls, pos);
     }
 };
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // TODO stl containers specialization
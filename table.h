@@ -0,0 +1,398 @@
+#pragma once
+#include "common.h"
+#include "core.h"
+#include "error.h"
+#include "stack.h"
+#include <string>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// table
+// c++ handle of a lua table, held by registry reference
+//   t.get<int>("id"), t.get<int>("id", 0), t.set("id", 1), t.sub("limits"),
+//   t.for_each<std::string, int>([](const std::string &k, int v) { ... })
+// values are decoded with stack_op, so registered classes convert from tables and userdata
+// reads/writes are raw, metamethods of the table are not consulted
+// handles and keys must not outlive the lua state they were made from
+////////////////////////////////////////////////////////////////////////////////
+
+// pre-bound key, holds the interned lua string in the registry
+// indexing with it pushes the existing string instead of hashing a c string again
+class table_key
+{
+public:
+    table_key() : ls_(nullptr), ref_(LUA_NOREF) {}
+
+    table_key(lua_State *ls, const char *key)
+        : ls_(impl::main_thread(ls))
+    {
+        lua_pushstring(ls, key);
+        this->ref_ = luaL_ref(ls, LUA_REGISTRYINDEX);
+    }
+
+    ~table_key() { this->reset(); }
+
+    table_key(const table_key &) = delete;
+    table_key &operator=(const table_key &) = delete;
+
+    table_key(table_key &&rhs) : ls_(rhs.ls_), ref_(rhs.ref_)
+    {
+        rhs.ls_ = nullptr;
+        rhs.ref_ = LUA_NOREF;
+    }
+
+    table_key &operator=(table_key &&rhs)
+    {
+        if (this != &rhs)
+        {
+            this->reset();
+            std::swap(this->ls_, rhs.ls_);
+            std::swap(this->ref_, rhs.ref_);
+        }
+        return *this;
+    }
+
+    void push(lua_State *ls) const { lua_rawgeti(ls, LUA_REGISTRYINDEX, this->ref_); }
+
+private:
+    void reset()
+    {
+        if (this->ls_ != nullptr)
+        {
+            luaL_unref(impl::running_thread(this->ls_), LUA_REGISTRYINDEX, this->ref_);
+            this->ls_ = nullptr;
+            this->ref_ = LUA_NOREF;
+        }
+    }
+
+    lua_State *ls_;
+    int ref_;
+};
+
+namespace impl
+{
+// restores the stack top on scope exit, also when decoding throws
+struct stack_restorer
+{
+    stack_restorer(lua_State *ls) : ls_(ls), top_(lua_gettop(ls)) {}
+    stack_restorer(lua_State *ls, int top) : ls_(ls), top_(top) {}
+    ~stack_restorer() { lua_settop(this->ls_, this->top_); }
+
+    lua_State *ls_;
+    int top_;
+};
+
+// pushes t[key] with t on top of stack
+inline int raw_get(lua_State *ls, const char *key)
+{
+    lua_pushstring(ls, key);
+    return lua_rawget(ls, -2);
+}
+
+inline int raw_get(lua_State *ls, const std::string &key)
+{
+    lua_pushlstring(ls, key.c_str(), key.length());
+    return lua_rawget(ls, -2);
+}
+
+inline int raw_get(lua_State *ls, const table_key &key)
+{
+    key.push(ls);
+    return lua_rawget(ls, -2);
+}
+
+inline int raw_get(lua_State *ls, lua_Integer i)
+{
+    return lua_rawgeti(ls, -1, i);
+}
+
+inline int raw_get(lua_State *ls, int i)
+{
+    return lua_rawgeti(ls, -1, i);
+}
+
+// t[key] = value with t below value on stack
+inline void raw_set(lua_State *ls, const char *key)
+{
+    lua_pushstring(ls, key);
+    lua_insert(ls, -2);
+    lua_rawset(ls, -3);
+}
+
+inline void raw_set(lua_State *ls, const std::string &key)
+{
+    lua_pushlstring(ls, key.c_str(), key.length());
+    lua_insert(ls, -2);
+    lua_rawset(ls, -3);
+}
+
+inline void raw_set(lua_State *ls, const table_key &key)
+{
+    key.push(ls);
+    lua_insert(ls, -2);
+    lua_rawset(ls, -3);
+}
+
+inline void raw_set(lua_State *ls, lua_Integer i)
+{
+    lua_rawseti(ls, -2, i);
+}
+
+inline void raw_set(lua_State *ls, int i)
+{
+    lua_rawseti(ls, -2, i);
+}
+
+// objects are stored by copy, pointers as views
+template <typename V, typename Enabled = void>
+struct table_value_op
+{
+    static void push(lua_State *ls, const V &v) { stack_op<V>::push(ls, v); }
+};
+
+template <typename V>
+struct table_value_op<V, typename std::enable_if<is_proxy_member<V>::value>::type>
+{
+    static void push(lua_State *ls, const V &v) { stack_op<V>::push(ls, V(v)); }
+};
+} // namespace impl
+
+class table
+{
+public:
+    table() : ls_(nullptr), ref_(LUA_NOREF) {}
+
+    // references the table at pos, nil gives an empty handle
+    table(lua_State *ls, int pos)
+        : ls_(nullptr), ref_(LUA_NOREF)
+    {
+        if (lua_isnoneornil(ls, pos))
+        {
+            return;
+        }
+
+        ZLUA_ARG_CHECK_THROW(ls, lua_istable(ls, pos), pos, "not a table");
+        lua_pushvalue(ls, pos);
+        this->ls_ = impl::main_thread(ls);
+        this->ref_ = luaL_ref(ls, LUA_REGISTRYINDEX);
+    }
+
+    // global table, dotted names walk nested tables
+    static table global(lua_State *ls, const char *name)
+    {
+        push_qualified_global(ls, name);
+        table t(ls, -1);
+        lua_pop(ls, 1);
+        return t;
+    }
+
+    static table create(lua_State *ls, int narr = 0, int nrec = 0)
+    {
+        lua_createtable(ls, narr, nrec);
+        table t(ls, -1);
+        lua_pop(ls, 1);
+        return t;
+    }
+
+    ~table() { this->reset(); }
+
+    table(const table &rhs) : ls_(nullptr), ref_(LUA_NOREF)
+    {
+        if (rhs.valid())
+        {
+            lua_State *ls = impl::running_thread(rhs.ls_);
+            rhs.push(ls);
+            this->ls_ = rhs.ls_;
+            this->ref_ = luaL_ref(ls, LUA_REGISTRYINDEX);
+        }
+    }
+
+    table(table &&rhs) : ls_(rhs.ls_), ref_(rhs.ref_)
+    {
+        rhs.ls_ = nullptr;
+        rhs.ref_ = LUA_NOREF;
+    }
+
+    table &operator=(table rhs)
+    {
+        std::swap(this->ls_, rhs.ls_);
+        std::swap(this->ref_, rhs.ref_);
+        return *this;
+    }
+
+    bool valid() const { return this->ls_ != nullptr; }
+    explicit operator bool() const { return this->valid(); }
+    lua_State *state() const { return this->ls_; }
+
+    // pushes the table, nil for an empty handle
+    void push(lua_State *ls) const
+    {
+        if (this->valid())
+        {
+            lua_rawgeti(ls, LUA_REGISTRYINDEX, this->ref_);
+        }
+        else
+        {
+            lua_pushnil(ls);
+        }
+    }
+
+    template <typename K>
+    bool has(const K &key) const
+    {
+        lua_State *ls = this->checked_state();
+        impl::stack_restorer restorer(ls);
+        this->push(ls);
+        return impl::raw_get(ls, key) != LUA_TNIL;
+    }
+
+    // t[key] decoded as T
+    template <typename T, typename K>
+    T get(const K &key) const
+    {
+        static_assert(!std::is_pointer<T>::value || !is_string_type<base_type_t<T>>::value, "get<std::string> instead, the lua string may be collected");
+
+        lua_State *ls = this->checked_state();
+        impl::stack_restorer restorer(ls);
+        this->push(ls);
+        impl::raw_get(ls, key);
+
+        T value{};
+        stack_op<T>::peek(ls, value, -1);
+        return value;
+    }
+
+    // t[key] decoded as T, def if nil
+    template <typename T, typename K>
+    T get(const K &key, const T &def) const
+    {
+        static_assert(!std::is_pointer<T>::value || !is_string_type<base_type_t<T>>::value, "get<std::string> instead, the lua string may be collected");
+
+        lua_State *ls = this->checked_state();
+        impl::stack_restorer restorer(ls);
+        this->push(ls);
+        if (impl::raw_get(ls, key) == LUA_TNIL)
+        {
+            return def;
+        }
+
+        T value{};
+        stack_op<T>::peek(ls, value, -1);
+        return value;
+    }
+
+    // nested table, an empty handle if t[key] is nil
+    template <typename K>
+    table sub(const K &key) const
+    {
+        return this->get<table>(key);
+    }
+
+    template <typename K, typename V>
+    void set(const K &key, const V &value)
+    {
+        lua_State *ls = this->checked_state();
+        impl::stack_restorer restorer(ls);
+        this->push(ls);
+        impl::table_value_op<V>::push(ls, value);
+        impl::raw_set(ls, key);
+    }
+
+    template <typename K>
+    void set(const K &key, const char *value)
+    {
+        lua_State *ls = this->checked_state();
+        impl::stack_restorer restorer(ls);
+        this->push(ls);
+        stack_op<const char *>::push(ls, value);
+        impl::raw_set(ls, key);
+    }
+
+    // t[key] = nil
+    template <typename K>
+    void erase(const K &key)
+    {
+        lua_State *ls = this->checked_state();
+        impl::stack_restorer restorer(ls);
+        this->push(ls);
+        lua_pushnil(ls);
+        impl::raw_set(ls, key);
+    }
+
+    // length of the sequence part
+    size_t size() const
+    {
+        lua_State *ls = this->checked_state();
+        impl::stack_restorer restorer(ls);
+        this->push(ls);
+        return lua_rawlen(ls, -1);
+    }
+
+    // f(K, V) for every pair, pairs whose key or value doesn't decode throw
+    template <typename K, typename V, typename F>
+    void for_each(F f) const
+    {
+        lua_State *ls = this->checked_state();
+        impl::stack_restorer restorer(ls);
+        this->push(ls);
+
+        lua_pushnil(ls);
+        while (lua_next(ls, -2) != 0)
+        {
+            K key{};
+            V value{};
+
+            // decode a copy of the key, string conversion would confuse lua_next
+            lua_pushvalue(ls, -2);
+            stack_op<K>::peek(ls, key, -1);
+            stack_op<V>::peek(ls, value, -2);
+            lua_pop(ls, 2);
+
+            f(key, value);
+        }
+    }
+
+private:
+    // the running thread, the table is read and written there
+    lua_State *checked_state() const
+    {
+        ZLUA_CHECK_THROW(this->ls_, this->valid(), "access through an empty table handle");
+        return impl::running_thread(this->ls_);
+    }
+
+    void reset()
+    {
+        if (this->ls_ != nullptr)
+        {
+            luaL_unref(impl::running_thread(this->ls_), LUA_REGISTRYINDEX, this->ref_);
+            this->ls_ = nullptr;
+            this->ref_ = LUA_NOREF;
+        }
+    }
+
+    lua_State *ls_;
+    int ref_;
+};
+
+template <>
+struct stack_op<table>
+{
+    static void push(lua_State *ls, const table &t)
+    {
+        t.push(ls);
+    }
+
+    static void peek(lua_State *ls, table &t, int pos = -1)
+    {
+        t = table(ls, pos);
+    }
+
+    static void pop(lua_State *ls, table &t, int pos = -1)
+    {
+        peek(ls, t, pos);
+        lua_remove(ls, pos);
+    }
+};
+
+} // namespace zlua
@@ -1,7 +1,49 @@
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include "../zlua.h"
 using namespace std;
 
+int failures = 0;
+
+// reports a failed check and goes on
+#define CHECK(cond)                                                                   \
+    if (!(cond))                                                                      \
+    {                                                                                 \
+        cout << "FAILED " << __FILE__ << ":" << __LINE__ << ": " << #cond << endl; \
+        ++failures;                                                                   \
+    }
+
+// raises(f, ...) in lua: true and the message if f raises a lua error or throws a zlua::exception
+// f runs on its own coroutine, so an exception thrown through it leaves the engine usable
+int lua_raises(lua_State *ls)
+{
+    lua_State *co = lua_newthread(ls);
+    lua_insert(ls, 1);
+    lua_xmove(ls, co, lua_gettop(ls) - 1);
+
+    bool raised = false;
+    std::string msg;
+    try
+    {
+        int status = lua_resume(co, ls, lua_gettop(co) - 1);
+        if (status != LUA_OK && status != LUA_YIELD)
+        {
+            raised = true;
+            msg = lua_tostring(co, -1) != nullptr ? lua_tostring(co, -1) : "";
+        }
+    }
+    catch (const zlua::exception &e)
+    {
+        raised = true;
+        msg = e.what();
+    }
+
+    lua_pushboolean(ls, raised);
+    lua_pushstring(ls, msg.c_str());
+    return 2;
+}
+
 enum Enum
 {
     Zero,
@@ -75,6 +117,467 @@ public:
 
 Derived d;
 
+struct Point
+{
+    double x = 0;
+    double y = 0;
+};
+
+struct Entity
+{
+    Point pos;
+    int id = 0;
+};
+
+void reg_entity(zlua::Engine &engine)
+{
+    engine.reg<Point, ctor()>("Point")
+        .def("x", &Point::x)
+        .def("y", &Point::y)
+        //
+        ;
+
+    engine.reg<Entity, ctor()>("Entity")
+        .def("pos", &Entity::pos)
+        .def("id", &Entity::id)
+        //
+        ;
+}
+
+// returned by value as a table
+struct Extent
+{
+    double w = 0;
+    double h = 0;
+};
+
+// takes points converted from tables
+struct Plotter
+{
+    double span(const Point &p)
+    {
+        return p.x + p.y;
+    }
+
+    double left(const Point *p)
+    {
+        return p->x;
+    }
+
+    Point origin()
+    {
+        return Point();
+    }
+
+    Extent extent(const Point &a, const Point &b)
+    {
+        Extent e;
+        e.w = b.x - a.x;
+        e.h = b.y - a.y;
+        return e;
+    }
+};
+
+// takes whole lua tables
+zlua::table kept_table;
+
+struct Tally
+{
+    int count(zlua::table t)
+    {
+        return static_cast<int>(t.size());
+    }
+
+    int pick(int k, zlua::table t)
+    {
+        return t.get<int>(k);
+    }
+
+    double scale(const Point &p, int k)
+    {
+        return (p.x + p.y) * k;
+    }
+
+    void keep(zlua::table t)
+    {
+        kept_table = t;
+    }
+};
+
+// async functions, their results come from the thread pool
+struct Loader
+{
+    std::future<int> load(int x)
+    {
+        return zlua::run_async([=] { return x * 2; });
+    }
+
+    std::future<int> fail()
+    {
+        return zlua::run_async([]() -> int { throw std::runtime_error("load failed"); });
+    }
+};
+
+// several results, returned or written through out params
+struct Calc
+{
+    void divmod(int a, int b, int &q, int &r)
+    {
+        q = a / b;
+        r = a % b;
+    }
+
+    bool parse(const std::string &s, int &value, std::string &rest)
+    {
+        size_t used = 0;
+        try
+        {
+            value = std::stoi(s, &used);
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+        rest = s.substr(used);
+        return true;
+    }
+
+    std::pair<int, int> minmax(int a, int b)
+    {
+        return a < b ? std::make_pair(a, b) : std::make_pair(b, a);
+    }
+
+    std::tuple<int, double, std::string> stats(int a, int b)
+    {
+        return std::make_tuple(a + b, (a + b) / 2.0, std::to_string(a) + "," + std::to_string(b));
+    }
+
+#if __cplusplus >= 201703L
+    std::optional<int> root(int x)
+    {
+        for (int i = 0; i * i <= x; ++i)
+        {
+            if (i * i == x)
+            {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    int or_default(std::optional<int> v)
+    {
+        return v.value_or(-1);
+    }
+#endif
+};
+
+// containers handed out as live views
+struct Inventory
+{
+    std::map<std::string, int> counts;
+    std::unordered_map<int, std::string> names;
+
+    std::map<std::string, int> *get_counts()
+    {
+        return &this->counts;
+    }
+
+    std::unordered_map<int, std::string> *get_names()
+    {
+        return &this->names;
+    }
+};
+
+Inventory inventory;
+
+// vectors walked with cursors
+struct Route
+{
+    std::vector<Point> stops;
+    std::vector<Point *> marks;
+
+    std::vector<Point> *get_stops()
+    {
+        return &this->stops;
+    }
+
+    std::vector<Point *> *get_marks()
+    {
+        return &this->marks;
+    }
+};
+
+Route route;
+
+// columns: integer fields keep their range through typed arrays
+struct Sample
+{
+    int16_t level = 0;
+    uint32_t mask = 0;
+    uint64_t id = 0;
+    double weight = 0;
+    std::string tag;
+};
+
+std::vector<Sample> samples;
+
+// nested members: config structs read through proxies and member paths
+struct Limits
+{
+    int max_conn = 0;
+};
+
+struct Info
+{
+    int id = 0;
+    Limits limits;
+};
+
+struct Role
+{
+    Info info;
+};
+
+std::vector<Role> roles;
+
+// fields inherited from a base that isn't the first one
+struct Tag
+{
+    int code = 0;
+};
+
+struct Badge : Point, Tag
+{
+    int tag_code() const
+    {
+        return this->code;
+    }
+};
+
+// arrays: read and written in place through spans
+struct Stats
+{
+    double mean(zlua::span<const double> v)
+    {
+        double sum = 0;
+        for (double x : v)
+        {
+            sum += x;
+        }
+        return v.size() == 0 ? 0 : sum / double(v.size());
+    }
+
+    void scale(zlua::span<double> v, double k)
+    {
+        for (double &x : v)
+        {
+            x *= k;
+        }
+    }
+};
+
+// callbacks: lua functions kept as std::function and zlua::function
+struct Bus
+{
+    std::function<int(int, const std::string &)> handler;
+    zlua::function<void(Point &)> on_point;
+    Point spot;
+
+    void subscribe(std::function<int(int, const std::string &)> h)
+    {
+        this->handler = h;
+    }
+
+    void watch(zlua::function<void(Point &)> f)
+    {
+        this->on_point = f;
+    }
+
+    int fire(int x)
+    {
+        return this->handler ? this->handler(x, "tick") : -1;
+    }
+
+    double move()
+    {
+        this->on_point(this->spot);
+        return this->spot.x;
+    }
+};
+
+// overloads: one name, chosen by argument count and lua types
+struct Vec2
+{
+    double x = 0;
+    double y = 0;
+
+    Vec2() {}
+    explicit Vec2(double s) : x(s), y(s) {}
+    Vec2(double x_, double y_) : x(x_), y(y_) {}
+
+    std::string kind(int) { return "int"; }
+    std::string kind(double) { return "double"; }
+    std::string kind(const std::string &) { return "string"; }
+    std::string kind(const Point &) { return "point"; }
+    std::string kind(const Vec2 &) { return "vec"; }
+    std::string kind(int, int) { return "pair"; }
+};
+
+// strings: decoded by length, embedded NULs included
+struct Codec
+{
+    size_t length(const std::string &s)
+    {
+        return s.size();
+    }
+
+    std::string reverse(std::string s)
+    {
+        return std::string(s.rbegin(), s.rend());
+    }
+
+#if __cplusplus >= 201703L
+    size_t view_length(std::string_view s)
+    {
+        return s.size();
+    }
+
+    std::string_view head(std::string_view s, size_t n)
+    {
+        return s.substr(0, n);
+    }
+#endif
+};
+
+// object arrays: one block of particles, stepped in place from C++
+struct Particle
+{
+    static int alive;
+
+    double x = 0;
+    double v = 0;
+
+    explicit Particle(double v0)
+        : v(v0)
+    {
+        ++alive;
+    }
+
+    ~Particle()
+    {
+        --alive;
+    }
+};
+
+int Particle::alive = 0;
+
+struct Integrator
+{
+    void advance(zlua::span<Particle> ps, double dt)
+    {
+        for (auto &p : ps)
+        {
+            p.x += p.v * dt;
+        }
+    }
+
+    double total(zlua::object_array<Particle> &ps)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < ps.size(); ++i)
+        {
+            sum += ps[i].x;
+        }
+        return sum;
+    }
+};
+
+// interfaces implemented in lua
+struct Strategy
+{
+    virtual ~Strategy() {}
+    virtual int decide(int tick) = 0;
+    virtual std::string name() const { return "cpp"; }
+
+    int bonus = 0;
+};
+
+// polymorphic first base, Strategy lies at a non-zero offset in the trampoline
+struct Tagged
+{
+    virtual ~Tagged() {}
+    int tag = 7;
+};
+
+struct LuaStrategy : Tagged, zlua::lua_impl<LuaStrategy, Strategy>
+{
+    int decide(int tick) override { return this->call<int>(0, tick); }
+    std::string name() const override { return this->overridden(1) ? this->call<std::string>(1) : Strategy::name(); }
+};
+
+struct Arena
+{
+    std::string play(Strategy *s, int tick)
+    {
+        return s->name() + ":" + std::to_string(s->decide(tick) + s->bonus);
+    }
+};
+
+// n fixed-size records of <I4 key, <i4 value, keys 10, 20, ... and values -1, -2, ...
+void write_records(const char *path, int n)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    for (int i = 1; i <= n; ++i)
+    {
+        uint32_t fields[] = {uint32_t(i * 10), uint32_t(-i)};
+        for (uint32_t f : fields)
+        {
+            char bytes[] = {char(f & 0xff), char((f >> 8) & 0xff), char((f >> 16) & 0xff), char(f >> 24)};
+            out.write(bytes, sizeof(bytes));
+        }
+    }
+}
+
+// calls lua back through handles
+struct Relay
+{
+    zlua::function<bool()> probe;
+    zlua::table notes;
+
+    void set(zlua::function<bool()> f, zlua::table t)
+    {
+        this->probe = f;
+        this->notes = t;
+    }
+
+    bool run()
+    {
+        this->notes.set(static_cast<int>(this->notes.size()) + 1, this->probe());
+        return this->probe();
+    }
+};
+
+// reads mapped views in place
+struct Reader
+{
+    size_t count(zlua::span<const char> bytes, int c)
+    {
+        size_t n = 0;
+        for (char b : bytes)
+        {
+            n += b == char(c) ? 1 : 0;
+        }
+        return n;
+    }
+};
+
+// pin is one of the names every type gets
+struct Marker
+{
+    int pin = 0;
+};
+
 int getd(lua_State *ls)
 {
     zlua::stack_op<Derived>::push(ls, (Derived *)&d);
@@ -87,6 +590,212 @@ void fun_template() {}
 template <typename R, typename... Args>
 std::pair<R, std::tuple<Args...>> deduce_func(R (*)(Args...));
 
+// engines: registered from many threads at once, each with its own state
+struct Ticket : Tag
+{
+    int seat = 0;
+};
+
+void check_engines()
+{
+    std::atomic<int> ok(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t)
+    {
+        threads.emplace_back([&ok, t] {
+            try
+            {
+                zlua::Engine e;
+                e.reg<Tag, ctor()>("Tag").def("code", &Tag::code);
+                e.reg<Ticket, ctor(), Tag>("Ticket").def("seat", &Ticket::seat);
+                std::string script = "local t = Ticket.new() t.code = 3 t.seat = " + std::to_string(t) + " assert(t.code + t.seat == " + std::to_string(3 + t) + ")";
+                if (luaL_dostring(e.get_lua_state(), script.c_str()) == LUA_OK)
+                {
+                    ++ok;
+                }
+            }
+            catch (const zlua::exception &)
+            {
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    CHECK(ok == 8);
+
+    // a type keeps its name in every engine
+    zlua::Engine other;
+    bool renamed = false;
+    try
+    {
+        other.reg<Ticket, ctor()>("Pass");
+    }
+    catch (const zlua::exception &)
+    {
+        renamed = true;
+    }
+    CHECK(renamed);
+}
+
+// schemas: one recording builds every engine of a pool
+struct Gauge
+{
+    double level = 0;
+
+    Gauge() {}
+    explicit Gauge(double l) : level(l) {}
+
+    double add(double d)
+    {
+        return this->level += d;
+    }
+};
+
+enum class Mode
+{
+    Idle = 1,
+    Busy = 2,
+};
+
+zlua::Schema make_schema()
+{
+    zlua::Schema schema;
+    schema.reg<Gauge, ctor()>("Gauge")
+        .def_ctor<ctor(double)>()
+        .def("level", &Gauge::level)
+        .def("add", &Gauge::add);
+    schema.reg<Mode>("Mode")
+        .def("Idle", Mode::Idle)
+        .def("Busy", Mode::Busy);
+    schema.on_build([](zlua::Engine &e) {
+        luaL_dostring(e.get_lua_state(), "function gauge_sum(a, b) local g = Gauge.new(a) g:add(b) return g.level end "
+                                         "function mode_busy() return Mode.Busy end "
+                                         "function bump() seq = (seq or 0) + 1 return seq end "
+                                         "function fail_in_task() error('task boom') end");
+    });
+    return schema;
+}
+
+void check_schema()
+{
+    zlua::Schema schema = make_schema();
+    zlua::EnginePool pool(3, schema);
+    CHECK(pool.size() == 3 && pool.available() == 3);
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+        CHECK(pool.at(i).call<double>("gauge_sum", 1.5, 2) == 3.5);
+        CHECK(pool.at(i).call<int>("mode_busy") == 2);
+    }
+
+    // the engines are separate states
+    pool.at(0).call<int>("bump");
+    CHECK(pool.at(0).call<int>("bump") == 2 && pool.at(1).call<int>("bump") == 1);
+
+    {
+        auto a = pool.checkout();
+        auto b = pool.try_checkout();
+        auto c = pool.try_checkout();
+        CHECK(a && b && c && !pool.try_checkout() && pool.available() == 0);
+        CHECK(c->call<double>("gauge_sum", 1, 1) == 2);
+        b.release();
+        CHECK(!b && pool.available() == 1);
+    }
+    CHECK(pool.available() == 3);
+
+    // a thread gets one nobody used, then the one it had last, even behind a free one
+    zlua::EnginePool pair(2, schema);
+    size_t theirs = 0;
+    std::thread([&] { theirs = pair.checkout().index(); }).join();
+    size_t mine = pair.checkout().index();
+    CHECK(mine != theirs);
+    CHECK(pair.checkout().index() == mine);
+    CHECK(pair.checkout().index() == mine);
+}
+
+// executor: a task parked on a gate until the test opens it
+std::promise<void> hold_gate;
+std::shared_future<void> hold_open = hold_gate.get_future().share();
+
+int lua_hold(lua_State *)
+{
+    hold_open.wait();
+    return 0;
+}
+
+void check_executor()
+{
+    zlua::Schema schema = make_schema();
+    schema.on_build([](zlua::Engine &e) { lua_register(e.get_lua_state(), "hold", &lua_hold); });
+    zlua::Executor executor(4, schema);
+    CHECK(executor.size() == 4);
+
+    std::vector<std::future<double>> sums;
+    for (int i = 0; i < 100; ++i)
+    {
+        sums.push_back(executor.submit<double>("gauge_sum", i, 0.5));
+    }
+    double total = 0;
+    for (auto &f : sums)
+    {
+        total += f.get();
+    }
+    CHECK(total == 5000);
+
+    // pinned calls run in order on the same engine
+    std::vector<std::future<int>> bumps;
+    for (int i = 0; i < 5; ++i)
+    {
+        bumps.push_back(executor.submit_to<int>(2, "bump"));
+    }
+    bool in_order = true;
+    for (int i = 0; i < 5; ++i)
+    {
+        in_order = bumps[i].get() == i + 1 && in_order;
+    }
+    CHECK(in_order);
+
+    std::string task_error;
+    try
+    {
+        executor.submit<void>("fail_in_task").get();
+    }
+    catch (const zlua::exception &e)
+    {
+        task_error = e.what();
+    }
+    CHECK(task_error.find("task boom") != std::string::npos);
+
+    bool no_worker = false;
+    try
+    {
+        executor.submit_to<int>(4, "bump");
+    }
+    catch (const zlua::exception &)
+    {
+        no_worker = true;
+    }
+    CHECK(no_worker);
+
+    // worker 0 is held, the others steal what was queued behind it
+    auto held = executor.submit_to<void>(0, "hold");
+    std::vector<std::future<double>> queued;
+    for (int i = 0; i < 16; ++i)
+    {
+        queued.push_back(executor.submit<double>("gauge_sum", 1, 1));
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    bool all_ran = true;
+    for (auto &f : queued)
+    {
+        all_ran = f.wait_until(deadline) == std::future_status::ready && all_ran;
+    }
+    CHECK(all_ran);
+    hold_gate.set_value();
+    held.get();
+}
+
 int main()
 {
     zlua::Engine engine;
@@ -125,7 +834,424 @@ int main()
         .def("say2", &Derived::say2)
         .def("getd", getd);
 
-    engine.load_file("./test.lua");
+    reg_entity(engine);
+    lua_register(ls, "raises", &lua_raises);
+#if __cplusplus >= 201703L
+    lua_pushboolean(ls, 1);
+    lua_setglobal(ls, "has_cxx17");
+#endif
+
+    engine.reg<Extent, ctor()>("Extent")
+        .def("w", &Extent::w)
+        .def("h", &Extent::h)
+        .return_as_table()
+        //
+        ;
+
+    engine.reg<Tally, ctor()>("Tally")
+        .def("count", &Tally::count)
+        .def("pick", &Tally::pick)
+        .def("scale", &Tally::scale)
+        .def("keep", &Tally::keep)
+        //
+        ;
+
+    engine.reg<Loader, ctor()>("Loader")
+        .def("load", &Loader::load)
+        .def("fail", &Loader::fail)
+        //
+        ;
+
+    engine.reg<Calc, ctor()>("Calc")
+        .def("divmod", zlua::out_params(&Calc::divmod))
+        .def("parse", zlua::out_params(&Calc::parse))
+        .def("minmax", &Calc::minmax)
+        .def("stats", &Calc::stats)
+#if __cplusplus >= 201703L
+        .def("root", &Calc::root)
+        .def("or_default", &Calc::or_default)
+#endif
+        //
+        ;
+
+    engine.reg_map<std::map<std::string, int>>("map.string_int");
+    engine.reg_map<std::unordered_map<int, std::string>>("map.int_string");
+    engine.reg<Inventory, ctor()>("Inventory")
+        .def("counts", &Inventory::get_counts)
+        .def("names", &Inventory::get_names)
+        //
+        ;
+    zlua::stack_op<Inventory>::push(ls, &inventory);
+    lua_setglobal(ls, "inventory");
+
+    route.stops.resize(3);
+    for (size_t i = 0; i < route.stops.size(); ++i)
+    {
+        route.stops[i].x = double(i + 1);
+    }
+    route.marks = {&route.stops[2], nullptr, &route.stops[0]};
+    engine.reg<Route, ctor()>("Route")
+        .def("stops", &Route::get_stops)
+        .def("marks", &Route::get_marks)
+        //
+        ;
+    zlua::stack_op<Route>::push(ls, &route);
+    lua_setglobal(ls, "route");
+
+    samples.resize(3);
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        samples[i].level = int16_t(-int(i));
+        samples[i].mask = 0xfffffff0u + uint32_t(i);
+        samples[i].id = i == 1 ? UINT64_MAX : i + 1;
+        samples[i].weight = 0.5 * double(i);
+        samples[i].tag = std::string(1, char('a' + i));
+    }
+    engine.reg<Sample, ctor()>("Sample")
+        .def("level", &Sample::level)
+        .def("mask", &Sample::mask)
+        .def("id", &Sample::id)
+        .def("weight", &Sample::weight)
+        .def("tag", &Sample::tag)
+        //
+        ;
+    zlua::stack_op<std::vector<Sample>>::push(ls, &samples);
+    lua_setglobal(ls, "samples");
+
+    engine.reg<Limits, ctor()>("Limits")
+        .def("max_conn", &Limits::max_conn)
+        //
+        ;
+    engine.reg<Info, ctor()>("Info")
+        .def("id", &Info::id)
+        .def("limits", &Info::limits)
+        //
+        ;
+    engine.reg<Role, ctor()>("Role")
+        .def("info", &Role::info)
+        .def("max_conn", &Role::info, &Info::limits, &Limits::max_conn)
+        //
+        ;
+    roles.resize(3);
+    for (size_t i = 0; i < roles.size(); ++i)
+    {
+        roles[i].info.limits.max_conn = int(10 * (i + 1));
+    }
+    zlua::stack_op<std::vector<Role>>::push(ls, &roles);
+    lua_setglobal(ls, "roles");
+
+    engine.reg<Tag, ctor()>("Tag")
+        .def("code", &Tag::code)
+        //
+        ;
+    engine.reg<Badge, ctor(), Point, Tag>("Badge")
+        .def("tag_code", &Badge::tag_code)
+        //
+        ;
+
+    engine.reg<Stats, ctor()>("Stats")
+        .def("mean", &Stats::mean)
+        .def("scale", &Stats::scale)
+        //
+        ;
+
+    engine.reg<Bus, ctor()>("Bus")
+        .def("subscribe", &Bus::subscribe)
+        .def("watch", &Bus::watch)
+        .def("fire", &Bus::fire)
+        .def("move", &Bus::move)
+        //
+        ;
+    // handles must go before the engine, so bus lives in this scope
+    Bus bus;
+    zlua::stack_op<Bus>::push(ls, &bus);
+    lua_setglobal(ls, "bus");
+
+    engine.reg<Vec2, ctor()>("Vec2")
+        .def_ctor<ctor(double)>()
+        .def_ctor<ctor(double, double)>()
+        .def("x", &Vec2::x)
+        .def("y", &Vec2::y)
+        .def("kind", (std::string(Vec2::*)(int)) & Vec2::kind)
+        .def("kind", (std::string(Vec2::*)(double)) & Vec2::kind)
+        .def("kind", (std::string(Vec2::*)(const std::string &)) & Vec2::kind)
+        .def("kind", (std::string(Vec2::*)(const Point &)) & Vec2::kind)
+        .def("kind", (std::string(Vec2::*)(const Vec2 &)) & Vec2::kind)
+        .def("kind", (std::string(Vec2::*)(int, int)) & Vec2::kind)
+        //
+        ;
+
+    engine.reg<Codec, ctor()>("Codec")
+        .def("length", &Codec::length)
+        .def("reverse", &Codec::reverse)
+#if __cplusplus >= 201703L
+        .def("view_length", &Codec::view_length)
+        .def("head", &Codec::head)
+#endif
+        //
+        ;
+
+    engine.reg<Particle, ctor(double)>("Particle")
+        .def("x", &Particle::x)
+        .def("v", &Particle::v)
+        //
+        ;
+    engine.reg<Integrator, ctor()>("Integrator")
+        .def("advance", &Integrator::advance)
+        .def("total", &Integrator::total)
+        //
+        ;
+
+    engine.reg_interface<LuaStrategy>("Strategy", {"decide", "name"})
+        .def("decide", &Strategy::decide)
+        .def("name", &Strategy::name)
+        //
+        ;
+    engine.reg<Arena, ctor()>("Arena")
+        .def("play", &Arena::play)
+        //
+        ;
+
+    bool reserved = false;
+    try
+    {
+        engine.reg<Marker, ctor()>("Marker").def("pin", &Marker::pin);
+    }
+    catch (const zlua::exception &)
+    {
+        reserved = true;
+    }
+    CHECK(reserved);
+
+    engine.reg<Plotter, ctor()>("Plotter")
+        .def("span", &Plotter::span)
+        .def("left", &Plotter::left)
+        .def("origin", &Plotter::origin)
+        .def("extent", &Plotter::extent)
+        //
+        ;
+
+    // small enough that the functor tests run on the thread pool
+    zlua::parallel::threshold() = 64;
+    engine.reg_functor<zlua::comparator<int>>("desc", [](const int &a, const int &b) { return a > b; });
+    engine.reg_functor<zlua::reducer<int>>("add", [](const int &a, const int &b) { return a + b; });
+    engine.reg_functor<zlua::transformer<int>>("square", [](const int &a) { return a * a; });
+    engine.reg_functor<zlua::predicate<int>>("even", [](const int &a) { return a % 2 == 0; });
+
+    engine.reg<Relay, ctor()>("Relay")
+        .def("set", &Relay::set)
+        .def("run", &Relay::run)
+        //
+        ;
+    engine.reg<Reader, ctor()>("Reader")
+        .def("count", &Reader::count)
+        //
+        ;
+    write_records("records.tmp", 3);
+    engine.map_file("records", "records.tmp");
+
+    zlua::channel ch;
+    zlua::Engine peer;
+    reg_entity(peer);
+    peer.reg<Extent, ctor()>("Extent")
+        .def("w", &Extent::w)
+        .def("h", &Extent::h)
+        //
+        ;
+    engine.set_channel("outbox", ch);
+    peer.set_channel("inbox", ch);
+
+    try
+    {
+        engine.load_file("./test.lua");
+    }
+    catch (const zlua::exception &e)
+    {
+        cout << "FAILED test.lua: " << e.what() << endl;
+        ++failures;
+    }
+
+    // tables: read and written through registry handles
+    zlua::table cfg = engine.get_table("config");
+    CHECK(cfg.valid() && cfg.state() == ls);
+    CHECK(cfg.get<int>("port") == 8080);
+    CHECK(cfg.get<int>("missing", 80) == 80);
+    CHECK(cfg.sub("limits").get<int>("conns") == 16);
+    CHECK(!cfg.sub("missing").valid());
+    CHECK(!engine.get_table("no_such_table").valid());
+    auto port = engine.make_key("port");
+    cfg.set(port, 9);
+    CHECK(cfg.get<int>(port) == 9);
+    cfg.erase("limits");
+    CHECK(!cfg.has("limits"));
+    int ports = 0;
+    cfg.sub("ports").for_each<int, int>([&](int k, int v) { ports += k * v; });
+    CHECK(ports == 1 * 80 + 2 * 443);
+    CHECK(cfg.sub("ports").size() == 2);
+    CHECK(kept_table.valid() && kept_table.state() == ls && kept_table.get<std::string>(1) == "kept");
+    kept_table = zlua::table();
+
+    // events: the task waiting in test.lua is woken from C++, it runs at the next poll
+    CHECK(engine.signal("door", 5, "open") == 1);
+    CHECK(engine.signal("door") == 0);
+
+    // async: tasks suspended on futures resume as they complete
+    engine.spawn("load_task", 5);
+    CHECK(engine.pending_tasks() > 0);
+    engine.run_until(std::chrono::steady_clock::now() + std::chrono::seconds(2));
+    CHECK(engine.pending_tasks() == 0);
+    zlua::table loaded = engine.get_table("loaded");
+    CHECK(loaded.get<int>("spawned") == 42);
+    CHECK(loaded.get<int>("from_cpp") == 10);
+    CHECK(loaded.get<std::string>("failed").find("load failed") != std::string::npos);
+    CHECK(loaded.get<bool>("yielded"));
+    zlua::table parked = engine.get_table("parked");
+    CHECK(parked.get<std::string>(1) == "door 5 open");
+    CHECK(parked.get<std::string>("order") == "inner outer bell | fast slow");
+
+    // budgets: runaway calls are interrupted, calls within budget are not
+    auto budget_code = [&](const zlua::budget &b, const char *name) {
+        try
+        {
+            engine.call<void>(b, name);
+        }
+        catch (const zlua::call_error &e)
+        {
+            return e.code();
+        }
+        return zlua::error_code::runtime;
+    };
+    CHECK(budget_code(zlua::budget(100000), "spin") == zlua::error_code::budget_exceeded);
+    CHECK(budget_code(zlua::budget(std::chrono::milliseconds(20)), "spin") == zlua::error_code::budget_exceeded);
+    CHECK(budget_code(zlua::budget(100000), "spin_in_pcall") == zlua::error_code::budget_exceeded);
+    CHECK(engine.call<int>(zlua::budget(100000), "twice", 21) == 42);
+    CHECK(engine.get_function<int(int)>("twice").call(zlua::budget(100000), 4) == 8);
+    CHECK(engine.call<int>("twice", 5) == 10);
+
+    // host calls: dotted names, tuples, objects, reused handles and errors
+    CHECK(engine.call<double>("host.math.scale", 2.5, 4) == 10.0);
+    auto full_name = engine.call<std::tuple<std::string, std::string>>("split_name", "ada lovelace");
+    CHECK(std::get<0>(full_name) == "ada" && std::get<1>(full_name) == "lovelace");
+    engine.call<void>("split_name", std::string("a b"));
+    Point host_point;
+    host_point.x = 6;
+    CHECK(engine.call<double>("point_x", host_point) == 6);
+    auto scale = engine.get_function<double(double, int)>("host.math.scale");
+    double scaled = 0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        scaled += scale(0.5, 2);
+    }
+    CHECK(scaled == 1000);
+    CHECK(!engine.get_function<int()>("host.nothing") && !engine.get_function<int()>("nothing.at.all"));
+    auto call_message = [&](const char *name) {
+        try
+        {
+            engine.call<void>(name);
+        }
+        catch (const zlua::call_error &e)
+        {
+            return std::string(e.what());
+        }
+        return std::string();
+    };
+    CHECK(call_message("no.such.fn").find("no function 'no.such.fn'") != std::string::npos);
+    CHECK(call_message("fail_hard").find("host boom") != std::string::npos && call_message("fail_hard").find("stack traceback") != std::string::npos);
+    CHECK(lua_gettop(ls) == 0);
+
+    // maps: lua wrote through the views
+    CHECK(inventory.counts.size() == 2 && inventory.counts["size"] == 7 && inventory.counts["b"] == 20);
+    CHECK(inventory.names.empty());
+
+    // vectors only exist where they were used
+    int top = lua_gettop(ls);
+    CHECK(luaL_getmetatable(ls, "zlua.vector.Point") == LUA_TTABLE && luaL_getmetatable(ls, "zlua.vector.Point*") == LUA_TTABLE);
+    CHECK(luaL_getmetatable(ls, "zlua.vector.Tally") == LUA_TNIL && luaL_getmetatable(ls, "zlua.vector.buffer") == LUA_TNIL);
+    lua_settop(ls, top);
+
+    // interfaces: a lua table behind a Strategy from C++
+    CHECK((zlua::calc_base_offset<LuaStrategy, Strategy>() != 0));
+    {
+        std::unique_ptr<LuaStrategy> negate = zlua::implement<LuaStrategy>(engine.get_table("negate"));
+        Strategy *s = negate.get();
+        CHECK(s->decide(3) == -3 && s->name() == "cpp");
+        CHECK(Arena().play(s, 1) == "cpp:-1");
+    }
+
+    // mapped files: a rewritten file is mapped anew, older views keep their mapping
+    write_records("records.tmp", 4);
+    engine.map_file("grown", "records.tmp");
+    CHECK(luaL_dostring(ls, "assert(#grown == 32 and #records == 24 and grown:search(8, 1, '<I', 40) == 4)") == LUA_OK);
+    lua_settop(ls, top);
+    std::remove("records.tmp");
+
+    // callbacks: the handles outlive the lua locals, errors carry the traceback
+    lua_gc(ls, LUA_GCCOLLECT, 0);
+    CHECK(bus.fire(1) == 5);
+    std::string bus_error;
+    try
+    {
+        bus.move();
+    }
+    catch (const zlua::call_error &e)
+    {
+        bus_error = e.what();
+    }
+    CHECK(bus_error.find("bad point") != std::string::npos && bus_error.find("stack traceback") != std::string::npos);
+
+    // nested members: set_column wrote through the member path
+    CHECK(roles[0].info.limits.max_conn == 5 && roles[1].info.limits.max_conn == 20 && roles[0].info.id == 0);
+
+    // object arrays: the blocks lua dropped were finalized with all their elements
+    lua_gc(ls, LUA_GCCOLLECT, 0);
+    CHECK(Particle::alive == 0);
+
+    // cursors: lua wrote through them, pinned copies stayed apart
+    CHECK(route.stops.size() == 1 && route.stops[0].x == 4 && route.stops[0].y == 0);
+
+    // columns: rejected writes left every sample as it was
+    CHECK(samples[0].mask == 0xfffffff0u && samples[1].mask == 7 && samples[1].id == UINT64_MAX && samples[2].level == -20);
+
+    // batch calls: failing items are reported one by one, the others go through
+    int batch_in[] = {1, 2, 3, 4, 5, 6};
+    int batch_out[] = {-1, -1, -1, -1, -1, -1};
+    std::vector<zlua::batch_error> batch_errors;
+    CHECK(engine.call_batch("batch_item", zlua::span<const int>(batch_in), zlua::span<int>(batch_out), &batch_errors) == 3);
+    CHECK(batch_out[0] == 10 && batch_out[1] == -1 && batch_out[2] == 30 && batch_out[3] == -1 && batch_out[4] == -1 && batch_out[5] == 60);
+    CHECK(batch_errors.size() == 3);
+    CHECK(batch_errors.size() == 3 && batch_errors[0].index == 1 && batch_errors[0].message.find("two") != std::string::npos);
+    CHECK(batch_errors.size() == 3 && batch_errors[1].index == 3 && batch_errors[1].message.find("not an integer") != std::string::npos);
+    CHECK(batch_errors.size() == 3 && batch_errors[2].index == 4);
+    std::tuple<int, int> pairs[] = {std::make_tuple(1, 2), std::make_tuple(3, 4)};
+    int sums[2] = {};
+    CHECK(engine.call_batch(engine.get_function<int(int, int)>("add"), zlua::span<const std::tuple<int, int>>(pairs), zlua::span<int>(sums)) == 2);
+    CHECK(sums[0] == 3 && sums[1] == 7);
+    CHECK(engine.call<int>("twice", 8) == 16);
+
+    // return_as_table holds in the engine that asked for it only
+    zlua::stack_op<Extent>::push(ls, Extent());
+    CHECK(lua_type(ls, -1) == LUA_TTABLE);
+    zlua::stack_op<Extent>::push(peer.get_lua_state(), Extent());
+    CHECK(lua_type(peer.get_lua_state(), -1) == LUA_TUSERDATA);
+    lua_pop(ls, 1);
+    lua_pop(peer.get_lua_state(), 1);
+
+    // channels: the entity moved to peer, which registered the same types
+    CHECK(luaL_dostring(peer.get_lua_state(), "local tag, got, extra = inbox:receive() "
+                                              "assert(tag == 'entity' and got.id == 7 and got.pos.x == 1.5) "
+                                              "assert(extra.tags[2] == 'b') "
+                                              "assert(inbox:receive() == nil)") == LUA_OK);
+
+    check_engines();
+    check_schema();
+    check_executor();
+
+    if (failures != 0)
+    {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
 
+    cout << "all checks passed" << endl;
     return 0;
 }
@@ -13,6 +13,540 @@ for i = 0, v:size() - 1 do
     print("  v:at(" .. i .. ") = " .. v:at(i))
 end
 
+local a = array.float.new(16)
+a:fill(0.5)
+local b = array.float.new(16)
+for i = 0, b:size() - 1 do
+    b:set(i, i)
+end
+a:axpy(2, b)
+print("a:sum() = " .. a:sum() .. ", a:min() = " .. a:min() .. ", a:max() = " .. a:max() .. ", a:dot(b) = " .. a:dot(b))
+
+-- functors: registered C++ callables drive the parallel algorithms
+local w = vector.int.new()
+for i = 1, 1000 do
+    w:push_back(i)
+end
+w:sort(functor.desc)
+assert(w:at(0) == 1000 and w:at(999) == 1)
+assert(w:reduce(0, functor.add) == 500500)
+assert(w:partition(functor.even) == 500)
+for i = 0, 499 do
+    assert(w:at(i) % 2 == 0)
+end
+w:transform(functor.square)
+assert(w:reduce(0, functor.add) == 333833500)
+assert(raises(w.sort, w, function(a, b) return a > b end))
+assert(raises(w.sort, w, functor.add))
+assert(raises(w.reduce, w, 0, 1))
+
+-- marshalling: registered fields convert structs to and from tables
+local plotter = Plotter.new()
+assert(plotter:span({x = 1, y = 2}) == 3)
+assert(plotter:left({x = 4}) == 4)
+local p = plotter:origin()
+assert(p:assign({x = 3, y = 4}) == p and p.x == 3 and p.y == 4)
+p:assign({y = 5})
+assert(p.x == 3 and p.y == 5)
+local pt = p:to_table()
+assert(type(pt) == "table" and pt.x == 3 and pt.y == 5)
+local ext = plotter:extent({x = 1, y = 1}, p)
+assert(type(ext) == "table" and ext.w == 2 and ext.h == 4)
+local e = Entity.new()
+e:assign({id = 3, pos = {x = 1, y = 2}})
+assert(e.id == 3 and e.pos.x == 1 and e.pos.y == 2)
+local et = e:to_table()
+assert(et.id == 3 and type(et.pos) == "table" and et.pos.y == 2)
+assert(raises(p.assign, p, {x = "left"}))
+assert(raises(plotter.span, plotter, 7))
+
+-- tables: taken whole by zlua::table parameters
+local tally = Tally.new()
+assert(tally:count({1, 2, 3}) == 3)
+assert(tally:count({}) == 0)
+assert(tally:pick(2, {7, 8, 9}) == 8)
+assert(tally:scale({x = 1, y = 2}, 3) == 9)
+assert(tally:scale({{x = 1, y = 2}, 3}) == 9)
+assert(raises(tally.count, tally, 5))
+config = {port = 8080, limits = {conns = 16}, ports = {80, 443}}
+async.spawn(function()
+    tally:keep({"kept"})
+end)
+collectgarbage()
+
+-- async: calls returning futures suspend tasks, and only tasks
+local loader = Loader.new()
+loaded = {}
+async.spawn(function()
+    local n = loader:load(21)
+    loaded.spawned = n
+    local ok, err = pcall(loader.fail, loader)
+    assert(not ok)
+    loaded.failed = err
+    coroutine.yield()
+    loaded.yielded = true
+end)
+assert(loaded.spawned == nil)
+
+function load_task(x)
+    loaded.from_cpp = loader:load(x)
+end
+
+local co = coroutine.wrap(function()
+    return loader:load(1), loader:load(2)
+end)
+local one, two = co()
+assert(one == 2 and two == 4)
+assert(loader:load(3) == 6)
+
+-- handles called back from a task run within it, and on the main thread otherwise
+local relay, notes = Relay.new(), {}
+relay:set(function() local _, main = coroutine.running() return not main end, notes)
+assert(relay:run() == false)
+local relayed
+async.spawn(function() relayed = relay:run() end)
+assert(relayed == true and notes[1] == false and notes[2] == true)
+
+-- scheduler: tasks park on timers and named events
+parked = {}
+async.spawn(function()
+    local n, what = async.wait("door")
+    parked[1] = "door " .. n .. " " .. what
+end)
+-- timers keep their own list, how many polls pass before they fire depends on the machine
+local order, timed = {}, {}
+async.spawn(function()
+    async.sleep(0.05)
+    timed[#timed + 1] = "slow"
+    parked.order = table.concat(order, " ") .. " | " .. table.concat(timed, " ")
+end)
+async.spawn(function()
+    async.sleep(0.01)
+    timed[#timed + 1] = "fast"
+end)
+async.spawn(function()
+    async.spawn(function()
+        coroutine.yield()
+        order[#order + 1] = "inner"
+    end)
+    coroutine.yield()
+    order[#order + 1] = "outer"
+end)
+async.spawn(function()
+    local rung = async.wait("bell")
+    order[#order + 1] = "bell"
+    assert(rung == 1)
+end)
+async.spawn(function()
+    coroutine.yield()
+    coroutine.yield()
+    assert(async.signal("bell", 1) == 1)
+end)
+assert(#order == 0 and #timed == 0 and parked[1] == nil)
+assert(raises(async.sleep, 1))
+
+-- budgets
+function spin()
+    while true do
+    end
+end
+
+function spin_in_pcall()
+    while true do
+        pcall(spin)
+    end
+end
+
+function twice(x)
+    return x * 2
+end
+
+-- maps: live views of std::map and std::unordered_map
+local counts = inventory:counts()
+counts.a = 1
+counts["b"] = 2
+counts.c = 3
+assert(#counts == 3 and counts:size() == 3 and counts.b == 2 and counts:find("c") == 3)
+assert(counts.missing == nil and counts:find("missing") == nil)
+counts.size = 7
+assert(counts.size == 7 and getmetatable(counts).size(counts) == 4)
+assert(counts.__gc == nil and counts.__index == nil)
+counts.c = nil
+assert(counts:erase("a") and not counts:erase("a"))
+local seen = {}
+for k, v in pairs(counts) do
+    seen[#seen + 1] = k .. "=" .. v
+end
+assert(table.concat(seen, " ") == "b=2 size=7")
+
+-- changes during pairs: erase the next key, insert, assign, clear
+counts.a, counts.c, counts.d = 1, 3, 4
+seen = {}
+for k, v in pairs(counts) do
+    seen[#seen + 1] = k
+    if k == "a" then
+        counts.b = nil
+        counts.bb = 5
+        counts.d = 40
+    end
+end
+assert(table.concat(seen, " ") == "a bb c d size")
+seen = {}
+for k in pairs(counts) do
+    seen[#seen + 1] = k
+    getmetatable(counts).clear(counts)
+end
+assert(#seen == 1 and #counts == 0)
+counts.b, counts.size = 20, 7
+
+local names = inventory:names()
+for i = 1, 100 do
+    names[i] = "n" .. i
+end
+assert(#names == 100 and names[42] == "n42" and names:size() == 100)
+local total = 0
+for k, v in pairs(names) do
+    total = total + k
+    names[k] = nil
+end
+assert(total == 5050 and #names == 0)
+names[1], names[2] = "one", "two"
+assert(raises(function()
+    for k in pairs(names) do
+        names[1], names[2] = nil, nil
+        names[3] = "three"
+    end
+end))
+names:clear()
+assert(raises(function() counts.x = "not a number" end))
+
+-- vectors of registered types are registered when first used
+assert(vector.Nothing == nil)
+local points = vector.Point.new()
+points:push_back(Point.new())
+assert(points:size() == 1 and points:at(0).x == 0)
+
+-- cursors: one object per loop, detached when the loop ends, pin copies
+local stops = route:stops()
+local seen, first = {}, nil
+for s in stops:each() do
+    first = first or s
+    assert(s == first)
+    seen[#seen + 1] = s.x
+    s.y = s.x * 10
+end
+assert(#seen == 3 and seen[1] == 1 and seen[3] == 3)
+assert(stops:at(1).y == 20)
+assert(raises(function() return first.x end))
+local marked = {}
+for m in route:marks():each() do
+    marked[#marked + 1] = m.x
+end
+assert(#marked == 2 and marked[1] == 3 and marked[2] == 1)
+local pinned
+for s in stops:each() do
+    if s.x == 2 then
+        pinned = s:pin()
+    end
+end
+assert(pinned ~= first and pinned.x == 2 and pinned.y == 20)
+route:marks():clear()
+stops:clear()
+stops:push_back(Point.new())
+for s in stops:each() do
+    s.x = 4
+end
+assert(pinned.x == 2 and pinned.y == 20)
+pinned.x = 5
+assert(stops:at(0).x == 4)
+assert(pinned:pin() == pinned)
+
+-- interfaces: lua tables implement Strategy, C++ calls them through Strategy *
+local arena = Arena.new()
+local doubler = Strategy.implement({decide = function(self, tick) return tick * 2 end})
+assert(arena:play(doubler, 4) == "cpp:8")
+local named = Strategy.implement({base = 10, decide = function(self, tick) return self.base + tick end, name = function() return "lua" end})
+assert(arena:play(named, 1) == "lua:11")
+assert(named:decide(2) == 12 and named:name() == "lua")
+assert(raises(Strategy.new))
+negate = {decide = function(self, tick) return -tick end}
+
+-- mapped files: records of <I4 key, <i4 value sorted by key
+assert(#records == 24 and records:size() == 24)
+local key, value, next_pos = records:unpack("<Ii", 9)
+assert(key == 20 and value == -2 and next_pos == 17)
+local at, insert_at = records:search(8, 1, "<I", 20)
+assert(at == 2 and insert_at == 2)
+at, insert_at = records:search(8, 1, "<I", 25)
+assert(at == nil and insert_at == 3)
+assert(records:search(8, 5, "<i", -1) == nil)
+local second = records:slice(9, 16)
+assert(#second == 8 and second:unpack("<i", 5) == -2)
+assert(second:tostring() == records:tostring(9, 16))
+assert(Reader.new():count(records, 0) == 9)
+assert(raises(records.unpack, records, "<I", 23))
+assert(raises(records.search, records, 8, 6, "<I", 1))
+
+-- multiple results
+local calc = Calc.new()
+local q, r = calc:divmod(7, 2)
+assert(q == 3 and r == 1)
+q, r = calc:divmod(7, 2, 99)
+assert(q == 3 and r == 1)
+assert(raises(calc.divmod, calc, 7))
+local ok, value, rest = calc:parse("42px")
+assert(ok == true and value == 42 and rest == "px")
+assert(select("#", calc:parse("x")) == 3 and calc:parse("x") == false)
+local lo, hi = calc:minmax(9, 4)
+assert(lo == 4 and hi == 9)
+local sum, mean, joined = calc:stats(3, 4)
+assert(sum == 7 and mean == 3.5 and joined == "3,4")
+assert(select("#", calc:stats(1, 1)) == 3)
+if has_cxx17 then
+    assert(calc:root(49) == 7)
+    assert(select("#", calc:root(50)) == 1 and calc:root(50) == nil)
+    assert(calc:or_default(5) == 5 and calc:or_default(nil) == -1)
+end
+
+-- batch calls: items 2, 4 and 5 fail in lua, in a bound function and in decoding
+function batch_item(x)
+    if x == 2 then
+        error("two")
+    elseif x == 4 then
+        return tally:pick("four", {})
+    elseif x == 5 then
+        return "five"
+    end
+    return x * 10
+end
+
+-- host calls: dotted names, several results, errors
+host = {math = {scale = function(x, k) return x * k end}}
+
+function split_name(s)
+    return s:match("(%w+) (%w+)")
+end
+
+function fail_hard()
+    error("host boom")
+end
+
+function point_x(p)
+    return p.x
+end
+
+function add(a, b)
+    return a + b
+end
+
+-- channels: an object sent to another engine moves, views of it here are released
+local sent = Entity.new()
+sent.id = 7
+local sent_pos = sent.pos
+sent_pos.x = 1.5
+outbox:send("entity", sent, {tags = {"a", "b"}})
+assert(raises(function() sent_pos.x = 42 end))
+assert(raises(function() return sent.id end))
+assert(raises(outbox.send, outbox, function() end))
+
+local ch = channel.new()
+assert(ch:receive() == nil)
+ch:send(1, "two", {3})
+ch:send(4)
+local one, two, three = ch:receive()
+assert(one == 1 and two == "two" and three[1] == 3)
+local drained = 0
+assert(ch:drain(function(x) drained = x end) == 1 and drained == 4)
+
+local levels = samples:column("level")
+assert(levels:get(2) == -2)
+local masks = samples:column("mask")
+assert(masks:get(0) == 0xfffffff0 and masks:get(2) == 0xfffffff2)
+assert(samples:column("weight"):sum() == 1.5)
+assert(samples:column("tag")[3] == "c")
+levels:set(2, -20)
+samples:set_column("level", levels)
+masks:set(1, 7)
+samples:set_column("mask", masks)
+masks:set(0, -1)
+assert(raises(samples.set_column, samples, "mask", masks))
+levels:set(0, 40000)
+assert(raises(samples.set_column, samples, "level", levels))
+assert(raises(samples.column, samples, "id"))
+local ids = array.int64.new(3)
+ids:fill(-5)
+assert(raises(samples.set_column, samples, "id", ids))
+
+local packed = buffer.new()
+packed:pack("<bBhHiI", -128, 255, -32768, 65535, -2147483648, 4294967295)
+assert(packed:size() == 14)
+local b1, b2, h1, h2, i1, i2 = packed:unpack("<bBhHiI")
+assert(b1 == -128 and b2 == 255 and h1 == -32768 and h2 == 65535 and i1 == -2147483648 and i2 == 4294967295)
+assert(raises(packed.pack, packed, "b", 128))
+assert(raises(packed.pack, packed, "b", -129))
+assert(raises(packed.pack, packed, "B", -1))
+assert(raises(packed.pack, packed, "B", 256))
+assert(raises(packed.pack, packed, "h", 32768))
+assert(raises(packed.pack, packed, "H", 65536))
+assert(raises(packed.pack, packed, "i", 2147483648))
+assert(raises(packed.pack, packed, "I", -1))
+assert(raises(packed.pack, packed, "I", 4294967296))
+packed:pack("<lL", math.mininteger, -1)
+assert(packed:size() == 30)
+
+do
+    local role = Role.new()
+    assert(rawequal(role.info, role.info) and rawequal(role.info.limits, role.info.limits))
+    role.info.limits.max_conn = 8
+    assert(role.max_conn == 8)
+    role.max_conn = 9
+    assert(role.info.limits.max_conn == 9)
+    collectgarbage()
+    collectgarbage("stop")
+    local before = collectgarbage("count")
+    for _ = 1, 1000 do
+        assert(role.info.limits.max_conn == 9)
+    end
+    assert(collectgarbage("count") - before < 1)
+    collectgarbage("restart")
+
+    local limits = Role.new().info.limits
+    collectgarbage()
+    limits.max_conn = 3
+    assert(limits.max_conn == 3)
+
+    assert(roles:column("max_conn"):get(2) == 30)
+    local conns = roles:column("max_conn")
+    conns:set(0, 5)
+    roles:set_column("max_conn", conns)
+    assert(roles:at(0).info.limits.max_conn == 5)
+    assert(raises(function() roles:at(0).info.id = 1 end))
+
+    local badge = Badge.new()
+    badge.code = 5
+    assert(badge.x == 0 and badge.code == 5 and badge:tag_code() == 5)
+end
+
+do
+    -- 1003 elements, not a multiple of the kernels' lanes
+    local n = 1003
+    local ints = array.int32.new(n)
+    local expected = 0
+    for i = 0, n - 1 do
+        ints:set(i, i - 500)
+        expected = expected + i - 500
+    end
+    assert(ints:sum() == expected and ints:min() == -500 and ints:max() == 502)
+    ints:fill(2147483647)
+    assert(ints:sum() == n * 2147483647)
+
+    local d, e = array.double.new(n), array.double.new(n)
+    d:fill(1.5)
+    e:fill(2)
+    d:mul(e)
+    d:add(d)
+    assert(d:get(0) == 6 and d:get(n - 1) == 6 and d:dot(e) == 12 * n)
+    d:axpy(-1, e)
+    d:clamp(0, 3.5)
+    assert(d:max() == 3.5 and d:min() == 3.5)
+
+    local src = array.int64.new(4)
+    for i = 0, 3 do
+        src:set(i, (i + 1) * 10)
+    end
+    local idx = array.int32.new(3)
+    idx:set(0, 3)
+    idx:set(1, 0)
+    idx:set(2, 3)
+    local picked = src:gather(idx)
+    assert(picked:size() == 3 and picked:get(0) == 40 and picked:get(1) == 10)
+    picked:fill(7)
+    src:scatter(idx, picked)
+    assert(src:get(0) == 7 and src:get(3) == 7 and src:get(1) == 20)
+    assert(src:slice(1, 3):sum() == 50 and src:slice(2, 100):size() == 2)
+
+    assert(raises(ints.get, ints, n))
+    assert(raises(d.add, d, array.double.new(1)))
+    assert(raises(array.double.new(0).min, array.double.new(0)))
+    assert(raises(d.clamp, d, 4, 0))
+    idx:set(0, -1)
+    assert(raises(src.gather, src, idx))
+    assert(raises(src.slice, src, 3, 1))
+
+    local stats = Stats.new()
+    local halves = array.double.new(4)
+    halves:fill(0.5)
+    stats:scale(halves, 4)
+    assert(halves:sum() == 8 and stats:mean(halves) == 2)
+    assert(raises(stats.mean, stats, ints))
+end
+
+do
+    local seen = {}
+    bus:subscribe(function(x, tag)
+        seen[#seen + 1] = tag
+        return x * 2
+    end)
+    assert(bus:fire(4) == 8 and seen[1] == "tick")
+    bus:watch(function(p) p.x = p.x + 1.5 end)
+    assert(bus:move() == 1.5 and bus:move() == 3.0)
+    bus:subscribe(nil)
+    assert(bus:fire(4) == -1)
+    bus:subscribe(function() error("boom") end)
+    assert(raises(bus.fire, bus, 1))
+    bus:subscribe(function() return "not a number" end)
+    assert(raises(bus.fire, bus, 1))
+    bus:subscribe(function(x, tag) return x + #tag end)
+    bus:watch(function() error("bad point") end)
+end
+
+do
+    local v0, v1, v2 = Vec2.new(), Vec2.new(3), Vec2.new(1, 2)
+    assert(v0.x == 0 and v1.x == 3 and v1.y == 3 and v2.x == 1 and v2.y == 2)
+    assert(raises(Vec2.new, 1, 2, 3))
+    assert(raises(Vec2.new, "wide"))
+    assert(v0:kind(2) == "int" and v0:kind(2.5) == "double" and v0:kind("2") == "string")
+    assert(v0:kind(v1) == "vec" and v0:kind(Point.new()) == "point")
+    assert(v0:kind(1, 2) == "pair")
+    assert(raises(v0.kind, v0, true))
+    assert(raises(v0.kind, v0, 1.5, 2))
+    assert(raises(v0.kind, v0))
+end
+
+do
+    local codec = Codec.new()
+    assert(codec:length("a\0b\0") == 4)
+    assert(codec:reverse("a\0b") == "b\0a")
+    if has_cxx17 then
+        local payload = string.rep("x\0", 2048)
+        assert(codec:view_length(payload) == 4096)
+        assert(codec:head(payload, 3) == "x\0x")
+        local packed_view = buffer.new()
+        packed_view:append("ab\0cd")
+        assert(codec:view_length(packed_view) == 5)
+        assert(raises(codec.view_length, codec, {}))
+    end
+end
+
+do
+    local ps = Particle.new_array(1000, 2.0)
+    assert(#ps == 1000 and ps:size() == 1000 and ps[1000].v == 2.0)
+    ps[1].v = 4.0
+    local integrator = Integrator.new()
+    integrator:advance(ps, 0.5)
+    assert(ps[1].x == 2.0 and ps[1000].x == 1.0)
+    assert(integrator:total(ps) == 1001.0)
+    assert(ps:column("x"):sum() == 1001.0)
+    assert(raises(function() return ps[0] end))
+    assert(raises(function() return ps[1001] end))
+    assert(raises(Particle.new_array, -1, 1.0))
+    assert(#Particle.new_array(0, 1.0) == 0)
+    local last = ps[1000]
+    ps = nil
+    collectgarbage()
+    assert(last.x == 1.0)
+end
+
 do return end
 
 local derived = Derived.new()
@@ -0,0 +1,169 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// thread_pool
+// fixed size pool of worker threads shared by parallel algorithms
+// tasks must never touch a lua_State, only plain C++ data
+////////////////////////////////////////////////////////////////////////////////
+class thread_pool
+{
+public:
+    explicit thread_pool(size_t n = default_size())
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            this->workers_.emplace_back([this] { this->run(); });
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->stopped_ = true;
+        }
+
+        this->cond_.notify_all();
+        for (auto &worker : this->workers_)
+        {
+            worker.join();
+        }
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    static thread_pool &shared()
+    {
+        static thread_pool pool;
+        return pool;
+    }
+
+    static size_t default_size()
+    {
+        size_t n = std::thread::hardware_concurrency();
+        return n > 1 ? n - 1 : 1;
+    }
+
+    size_t size() const { return this->workers_.size(); }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->tasks_.push_back(std::move(task));
+        }
+
+        this->cond_.notify_one();
+    }
+
+    // runs fn(i) for every i in [0, n) and blocks until all of them finish
+    // calling thread takes part in the work, so nested calls from workers don't deadlock
+    // the first exception thrown by fn is rethrown here
+    template <typename F>
+    void parallel_for(size_t n, F fn)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+
+        struct state_t
+        {
+            explicit state_t(F f) : fn(std::move(f)) {}
+
+            F fn;
+            size_t n = 0;
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> done{0};
+            std::mutex mutex;
+            std::condition_variable cond;
+            std::exception_ptr error;
+        };
+
+        auto state = std::make_shared<state_t>(std::move(fn));
+        state->n = n;
+
+        auto work = [state] {
+            size_t i;
+            while ((i = state->next.fetch_add(1)) < state->n)
+            {
+                try
+                {
+                    state->fn(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (!state->error)
+                    {
+                        state->error = std::current_exception();
+                    }
+                }
+
+                if (state->done.fetch_add(1) + 1 == state->n)
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->cond.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = n - 1 < this->size() ? n - 1 : this->size();
+        for (size_t i = 0; i < helpers; ++i)
+        {
+            this->submit(work);
+        }
+
+        work();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cond.wait(lock, [&state] { return state->done.load() == state->n; });
+
+        if (state->error)
+        {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+private:
+    void run()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                this->cond_.wait(lock, [this] { return this->stopped_ || !this->tasks_.empty(); });
+                if (this->tasks_.empty())
+                {
+                    return;
+                }
+
+                task = std::move(this->tasks_.front());
+                this->tasks_.pop_front();
+            }
+
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stopped_ = false;
+};
+
+} // namespace zlua
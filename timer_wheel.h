@@ -0,0 +1,138 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace zlua
+{
+////////////////////////////////////////////////////////////////////////////////
+// timer_wheel
+// hierarchical timing wheel of items due at a tick, 4 levels of 64 slots
+// level l holds the items due within 64^(l+1) ticks, a slot of it is moved down
+// a level when time enters its range, so adding and expiring an item is O(1)
+// items further than 64^4 ticks away wait in the last level and are moved again
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class timer_wheel
+{
+public:
+    const static int slot_bits = 6;
+    const static int slots = 1 << slot_bits;
+    const static int levels = 4;
+
+    timer_wheel() : now_(0), size_(0) {}
+
+    timer_wheel(const timer_wheel &) = delete;
+    timer_wheel &operator=(const timer_wheel &) = delete;
+
+    uint64_t now() const { return this->now_; }
+    size_t size() const { return this->size_; }
+    bool empty() const { return this->size_ == 0; }
+
+    // item is due at tick at, items already due go to expired
+    template <typename Expired>
+    void add(uint64_t at, std::unique_ptr<T> item, Expired &expired)
+    {
+        if (at <= this->now_)
+        {
+            expired.push_back(std::move(item));
+            return;
+        }
+
+        this->insert(entry_t{at, std::move(item)});
+        ++this->size_;
+    }
+
+    // moves time forward to tick to, appending the items that became due to expired
+    template <typename Expired>
+    void advance(uint64_t to, Expired &expired)
+    {
+        while (this->now_ < to)
+        {
+            if (this->size_ == 0)
+            {
+                this->now_ = to;
+                return;
+            }
+
+            uint64_t t = ++this->now_;
+            this->cascade(t, 1);
+
+            std::vector<entry_t> &slot = this->wheel_[0][t & (slots - 1)];
+            this->size_ -= slot.size();
+            for (auto &e : slot)
+            {
+                expired.push_back(std::move(e.item));
+            }
+            slot.clear();
+        }
+    }
+
+    // first tick after now at which advance may expire something, UINT64_MAX when empty
+    uint64_t next_due() const
+    {
+        if (this->size_ == 0)
+        {
+            return UINT64_MAX;
+        }
+
+        for (uint64_t t = this->now_ + 1; t <= this->now_ + slots; ++t)
+        {
+            if (!this->wheel_[0][t & (slots - 1)].empty() || (t & (slots - 1)) == 0)
+            {
+                return t;
+            }
+        }
+        return this->now_ + slots;
+    }
+
+private:
+    struct entry_t
+    {
+        uint64_t at;
+        std::unique_ptr<T> item;
+    };
+
+    void insert(entry_t &&e)
+    {
+        uint64_t delta = e.at - this->now_;
+        int level = 0;
+        while (level + 1 < levels && delta >= (uint64_t(1) << (slot_bits * (level + 1))))
+        {
+            ++level;
+        }
+
+        // beyond the last level, parked in the slot reached last
+        uint64_t at = e.at;
+        if (delta >= (uint64_t(1) << (slot_bits * levels)))
+        {
+            at = this->now_ + (uint64_t(1) << (slot_bits * levels)) - 1;
+        }
+
+        this->wheel_[level][(at >> (slot_bits * level)) & (slots - 1)].push_back(std::move(e));
+    }
+
+    // at a tick starting a slot of level l, that slot is spread over the levels below
+    void cascade(uint64_t t, int level)
+    {
+        if (level >= levels || (t & ((uint64_t(1) << (slot_bits * level)) - 1)) != 0)
+        {
+            return;
+        }
+
+        this->cascade(t, level + 1);
+
+        std::vector<entry_t> slot;
+        slot.swap(this->wheel_[level][(t >> (slot_bits * level)) & (slots - 1)]);
+        for (auto &e : slot)
+        {
+            this->insert(std::move(e));
+        }
+    }
+
+    uint64_t now_;
+    size_t size_;
+    std::vector<entry_t> wheel_[levels][slots];
+};
+
+} // namespace zlua
@@ -1,4 +1,5 @@
 #pragma once
+#include <functional>
 #include <utility>
 #include <type_traits>
 
@@ -8,6 +9,10 @@
 #include <unordered_map>
 #include <set>
 #include <unordered_set>
+#if __cplusplus >= 201703L
+#include <optional>
+#include <string_view>
+#endif
 
 namespace zlua
 {
@@ -83,6 +88,133 @@ struct is_tuple_type
     const static bool value = sizeof(decltype(detail((T *)(nullptr)))) == sizeof(int);
 };
 
+template <typename T>
+struct is_pair_type
+{
+    const static bool value = false;
+};
+
+template <typename A, typename B>
+struct is_pair_type<std::pair<A, B>>
+{
+    const static bool value = true;
+};
+
+// std::optional (c++17), nil when empty
+template <typename T>
+struct is_optional_type
+{
+    const static bool value = false;
+};
+
+#if __cplusplus >= 201703L
+template <typename T>
+struct is_optional_type<std::optional<T>>
+{
+    const static bool value = true;
+};
+#endif
+
+template <typename T>
+class span;
+
+template <typename T>
+struct is_span_type
+{
+    const static bool value = false;
+};
+
+template <typename T>
+struct is_span_type<span<T>>
+{
+    const static bool value = true;
+};
+
+// std::string_view (c++17), a view into lua's string storage
+template <typename T>
+struct is_string_view_type
+{
+    const static bool value = false;
+};
+
+#if __cplusplus >= 201703L
+template <>
+struct is_string_view_type<std::string_view>
+{
+    const static bool value = true;
+};
+#endif
+
+// lua functions as c++ callables, zlua::function<R(Args...)> and std::function<R(Args...)>
+template <typename Sig>
+class function;
+
+template <typename T>
+struct is_lua_function_type
+{
+    const static bool value = false;
+};
+
+template <typename Sig>
+struct is_lua_function_type<function<Sig>>
+{
+    const static bool value = true;
+};
+
+template <typename Sig>
+struct is_lua_function_type<std::function<Sig>>
+{
+    const static bool value = true;
+};
+
+// opaque c++ callables handed to lua, zlua::functor<R(Args...)>
+template <typename Sig>
+class functor;
+
+template <typename T>
+struct is_functor_type
+{
+    const static bool value = false;
+};
+
+template <typename Sig>
+struct is_functor_type<functor<Sig>>
+{
+    const static bool value = true;
+};
+
+// handles to lua values held by registry reference (zlua::table, zlua::function, ...)
+// passed by value, have their own stack_op
+class table;
+
+template <typename T>
+struct is_lua_ref_type
+{
+    const static bool value = is_lua_function_type<T>::value;
+};
+
+template <>
+struct is_lua_ref_type<table>
+{
+    const static bool value = true;
+};
+
+// whether any of Ts is a lua handle, which can't leave its lua state
+template <typename... Ts>
+struct has_lua_ref_type;
+
+template <typename T, typename... Ts>
+struct has_lua_ref_type<T, Ts...>
+{
+    const static bool value = is_lua_ref_type<T>::value || has_lua_ref_type<Ts...>::value;
+};
+
+template <>
+struct has_lua_ref_type<>
+{
+    const static bool value = false;
+};
+
 template <typename T>
 struct reference_wrapper;
 
@@ -204,6 +336,12 @@ struct element_size<std::tuple<Args...>>
     const static size_t value = sizeof...(Args);
 };
 
+template <typename A, typename B>
+struct element_size<std::pair<A, B>>
+{
+    const static size_t value = 2;
+};
+
 template <>
 struct element_size<void>
 {
@@ -337,11 +475,14 @@ struct is_const_member_function_pointer<T, typename std::enable_if<
 ////////////////////////////////////////////////////////////////////////////////
 // pack_tuple, pack_tuple_t
 // packs Args... to std::tuple<Args...> , but:
-//   replace <[const] std::string [&]> with <const char*>
+//   replace <[const] std::string [&]> with <std::string>
+//   replace <[const] char [&]> with <const char*>
 //   replace <[const] T &> with <reference_wrapper<[const] T>>
+//   replace <[const] span<T> [&]> and <[const] std::string_view [&]> with the plain view type
+//   replace <[const] table [&]> and other lua refs with the plain handle type
 // attensions:
 //   <char *> is replaced with <const char*>
-//   <[const] std::string *> is replaced with <const char*>
+//   <[const] std::string *> is replaced with <std::string>
 //   but these types should be rejected by check_params_validity when register function
 //   and thus never be used
 ////////////////////////////////////////////////////////////////////////////////
@@ -360,15 +501,26 @@ struct pack_element<void>
 };
 
 template <typename T>
-struct pack_element<T, typename std::enable_if<is_string_type<base_type_t<T>>::value>::type>
+struct pack_element<T, typename std::enable_if<std::is_same<base_type_t<T>, char>::value>::type>
 {
     using type = const char *;
 };
 
+// decoded with the length lua already knows
+template <typename T>
+struct pack_element<T, typename std::enable_if<std::is_same<base_type_t<T>, std::string>::value>::type>
+{
+    using type = std::string;
+};
+
 template <typename T>
 struct pack_element<T, typename std::enable_if<std::is_reference<T>::value &&
                                                !is_integral_type<base_type_t<T>>::value &&
-                                               !is_string_type<base_type_t<T>>::value>::type>
+                                               !is_string_type<base_type_t<T>>::value &&
+                                               !is_span_type<base_type_t<T>>::value &&
+                                               !is_string_view_type<base_type_t<T>>::value &&
+                                               !is_optional_type<base_type_t<T>>::value &&
+                                               !is_lua_ref_type<base_type_t<T>>::value>::type>
 {
     using type = reference_wrapper<typename std::remove_reference<T>::type>;
     // using type = reference_wrapper<base_type_t<T>>;
@@ -380,6 +532,17 @@ struct pack_element<T, typename std::enable_if<std::is_reference<T>::value &&
 {
     using type = base_type_t<T>;
 };
+
+// spans and string views are views already, lua refs are handles, all passed by value
+// optionals are small values
+template <typename T>
+struct pack_element<T, typename std::enable_if<is_span_type<base_type_t<T>>::value ||
+                                               is_string_view_type<base_type_t<T>>::value ||
+                                               is_optional_type<base_type_t<T>>::value ||
+                                               is_lua_ref_type<base_type_t<T>>::value>::type>
+{
+    using type = base_type_t<T>;
+};
 } // namespace impl
 
 template <typename... Args>
@@ -391,6 +554,80 @@ struct pack_tuple
 template <typename... Args>
 using pack_tuple_t = typename pack_tuple<Args...>::type;
 
+// whether a packed parameter binds a lua table as one value rather than as an argument list:
+// zlua::table, and classes taken by value, const reference or const pointer (marshalled)
+template <typename E>
+struct accepts_table
+{
+    using base_t = base_type_t<E>;
+    using target_t = typename std::remove_pointer<typename remove_reference_wrapper<E>::type>::type;
+
+    const static bool value = std::is_same<base_t, table>::value ||
+                              (std::is_class<base_t>::value &&
+                               !std::is_same<base_t, std::string>::value &&
+                               !is_tuple_type<base_t>::value &&
+                               !is_pair_type<base_t>::value &&
+                               !is_optional_type<base_t>::value &&
+                               !is_span_type<base_t>::value &&
+                               !is_string_view_type<base_t>::value &&
+                               !is_lua_ref_type<base_t>::value &&
+                               !is_functor_type<base_t>::value &&
+                               (std::is_const<target_t>::value || (!is_reference_wrapper<E>::value && !std::is_pointer<E>::value)));
+};
+
+template <typename... Es>
+struct last_accepts_table
+{
+    const static bool value = false;
+};
+
+template <typename E>
+struct last_accepts_table<E>
+{
+    const static bool value = accepts_table<E>::value;
+};
+
+template <typename E, typename... Es>
+struct last_accepts_table<E, Es...>
+{
+    const static bool value = last_accepts_table<Es...>::value;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// out params
+// functions bound through zlua::out_params(f) return their non-const references
+// to primitives/std::string as extra values instead of reading them from lua
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+struct is_out_param
+{
+    const static bool value = std::is_lvalue_reference<T>::value &&
+                              !std::is_const<typename std::remove_reference<T>::type>::value &&
+                              (!std::is_class<base_type_t<T>>::value || std::is_same<base_type_t<T>, std::string>::value);
+};
+
+// out params are stored/validated as plain values
+template <typename T>
+using out_checked_t = typename std::conditional<is_out_param<T>::value, base_type_t<T>, T>::type;
+
+template <typename... Args>
+using out_pack_tuple_t = std::tuple<typename impl::pack_element<out_checked_t<Args>>::type...>;
+
+template <typename... Args>
+struct in_param_count;
+
+template <>
+struct in_param_count<>
+{
+    const static int value = 0;
+};
+
+template <typename A, typename... Args>
+struct in_param_count<A, Args...>
+{
+    const static int value = (is_out_param<A>::value ? 0 : 1) + in_param_count<Args...>::value;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // check_params_validity
 // check registered function parameters validity
@@ -15,6 +15,7 @@ struct object_t
     size_t offset = 0;
     const bool is_const = std::is_const<T>::value;
     bool need_release = false;
+    bool is_cursor = false;
 };
 
 template <typename F>
@@ -27,6 +28,16 @@ struct method_t
     const bool is_const = is_const_member_function_pointer<F>::value;
 };
 
+// free function registered as a method, object is passed as first parameter
+template <typename F>
+struct function_t
+{
+    function_t() {}
+    function_t(F f_) : ptr(f_) {}
+
+    F ptr;
+};
+
 template <typename P>
 struct property_t
 {
@@ -36,12 +47,64 @@ struct property_t
     P ptr;
 };
 
+// chain of member pointers T::*a, A::*b, ... registered as a single property
+// resolve() walks the chain without materialising the intermediate objects
+template <typename T, typename... Ms>
+struct member_path;
+
+template <typename T, typename P>
+struct member_path<T, P T::*>
+{
+    using leaf_t = P;
+
+    member_path() {}
+    member_path(P T::*m_) : m(m_) {}
+
+    P *resolve(T *t) const { return &(t->*m); }
+
+    P T::*m;
+};
+
+template <typename T, typename P, typename... Ms>
+struct member_path<T, P T::*, Ms...>
+{
+    using next_t = member_path<P, Ms...>;
+    using leaf_t = typename next_t::leaf_t;
+
+    member_path() {}
+    member_path(P T::*m_, Ms... rest) : m(m_), next(rest...) {}
+
+    leaf_t *resolve(T *t) const { return this->next.resolve(&(t->*m)); }
+
+    P T::*m;
+    next_t next;
+};
+
+// address of the member designated by a member pointer or member_path
+template <typename T, typename P>
+P *member_of(T *t, P T::*m)
+{
+    return &(t->*m);
+}
+
+template <typename T, typename... Ms>
+typename member_path<T, Ms...>::leaf_t *member_of(T *t, const member_path<T, Ms...> &path)
+{
+    return path.resolve(t);
+}
+
 struct property_base_t
 {
     property_base_t() : property(nullptr) {}
 
     int (*access_handler)(lua_State *, void *, const char *key);
     int (*write_handler)(lua_State *, void *, const char *key);
+    // column access over n objects laid out every stride bytes from first
+    int (*gather_handler)(lua_State *, void *, const char *first, size_t stride, size_t n);
+    void (*scatter_handler)(lua_State *, void *, char *first, size_t stride, size_t n, int pos);
+    // table marshalling, obj points at the object declaring the field
+    void (*get_handler)(lua_State *, void *, const void *obj);
+    void (*set_handler)(lua_State *, void *, void *obj, int pos);
     void *property;
 };
 
@@ -53,6 +116,40 @@ struct property_wrapper_t : property_base_t
     property_t<P> property_holder;
 };
 
+// stored as lightuserdata in metatables of registered types
+// lets lua-owned objects move to another lua state by pointer (zlua::channel)
+// and parameters of a base type find where that base lies in the object
+struct transfer_t
+{
+    const char *(*metatable_name)();
+    int (*push_metatable)(lua_State *ls);
+    void (*push)(lua_State *ls, void *ptr);
+    void (*destroy)(void *ptr);
+    bool (*base_offset)(const char *base, size_t *offset);
+};
+
+// stored as lightuserdata in metatables of types whose elements are laid out contiguously
+// lets span<T> parameters bind to them without copying
+struct contiguous_t
+{
+    const void *elem_tag;
+    void (*fetch)(void *ud, void **data, size_t *size);
+};
+
 } // namespace userdata
 
+// metatable key of the transfer_t of registered types
+inline const void *transfer_key()
+{
+    static const char key = 0;
+    return &key;
+}
+
+// metatable key set to true for types returned by value as lua tables
+inline const void *as_table_key()
+{
+    static const char key = 0;
+    return &key;
+}
+
 } // namespace zlua
\ No newline at end of file
@@ -53,6 +53,12 @@ struct tuple_invoker<sequence<S...>>
     {
         return (c->*f)(std::get<S>(t)...);
     }
+
+    template <typename C, typename R, typename... Args, typename T>
+    static R invoke(R (*f)(C &, Args...), C *c, T &t)
+    {
+        return f(*c, std::get<S>(t)...);
+    }
 };
 } // namespace impl
 
@@ -68,26 +74,118 @@ Ret tuple_invoke(Ret (Obj::*f)(Args...), Obj *obj, Tuple &t)
     return impl::tuple_invoker<sequence_t<Args...>>::invoke(f, obj, t);
 };
 
+template <typename Obj, typename Ret, typename... Args, typename Tuple>
+Ret tuple_invoke(Ret (*f)(Obj &, Args...), Obj *obj, Tuple &t)
+{
+    return impl::tuple_invoker<sequence_t<Args...>>::invoke(f, obj, t);
+};
+
 template <typename C, typename R, typename T, typename... Args>
 struct wrapped_tuple_invoke
 {
+    // returns the number of values pushed, tuples/pairs spread into several
     static int call(lua_State *ls, R (C::*f)(Args...), C *c, T &t)
     {
         R ret = tuple_invoke(f, c, t);
         stack_op<R>::push(ls, std::forward<R>(ret));
-        return 1;
+        return element_size<R>::value;
+    }
+
+    static int call(lua_State *ls, R (*f)(C &, Args...), C *c, T &t)
+    {
+        R ret = tuple_invoke(f, c, t);
+        stack_op<R>::push(ls, std::forward<R>(ret));
+        return element_size<R>::value;
     }
 };
 
 template <typename C, typename T, typename... Args>
 struct wrapped_tuple_invoke<C, void, T, Args...>
 {
-    static int call(lua_State *ls, void (C::*f)(Args...), C *c, T &t)
+    static int call(lua_State *, void (C::*f)(Args...), C *c, T &t)
     {
         tuple_invoke(f, c, t);
         return 0;
     }
+
+    static int call(lua_State *, void (*f)(C &, Args...), C *c, T &t)
+    {
+        tuple_invoke(f, c, t);
+        return 0;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// out_params
+// .def("divmod", zlua::out_params(&Calc::divmod)) for void divmod(int, int, int &q, int &r)
+// gives `local q, r = calc:divmod(7, 2)`, outputs follow the return value if any
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+struct out_params_t
+{
+    F f;
+};
+
+template <typename F>
+out_params_t<F> out_params(F f)
+{
+    return out_params_t<F>{f};
+}
+
+namespace impl
+{
+template <typename A, typename E>
+typename std::enable_if<is_out_param<A>::value>::type read_in_param(lua_State *, E &, int &)
+{
+}
+
+template <typename A, typename E>
+typename std::enable_if<!is_out_param<A>::value>::type read_in_param(lua_State *ls, E &e, int &pos)
+{
+    stack_op<E>::peek(ls, e, pos++);
+}
+
+template <typename A, typename E>
+typename std::enable_if<is_out_param<A>::value>::type push_out_param(lua_State *ls, E &e, int &n)
+{
+    stack_op<E>::push(ls, e);
+    ++n;
+}
+
+template <typename A, typename E>
+typename std::enable_if<!is_out_param<A>::value>::type push_out_param(lua_State *, E &, int &)
+{
+}
+
+template <typename>
+struct out_params_op;
+
+template <size_t... S>
+struct out_params_op<sequence<S...>>
+{
+    // inputs are the in_param_count values following the object, read in place
+    // arguments past them are ignored
+    template <typename... Args, typename Tuple>
+    static void read(lua_State *ls, Tuple &t)
+    {
+        const int n_in = in_param_count<Args...>::value;
+        ZLUA_CHECK_THROW(ls, lua_gettop(ls) - 1 >= n_in, "expected " + std::to_string(n_in) + " arguments");
+
+        int pos = 2;
+        int expand[] = {0, (read_in_param<Args>(ls, std::get<S>(t), pos), 0)...};
+        (void)expand;
+    }
+
+    template <typename... Args, typename Tuple>
+    static int push(lua_State *ls, Tuple &t)
+    {
+        int n = 0;
+        int expand[] = {0, (push_out_param<Args>(ls, std::get<S>(t), n), 0)...};
+        (void)expand;
+        return n;
+    }
 };
+} // namespace impl
 
 ////////////////////////////////////////////////////////////////////////////////
 // tuple_construct
@@ -106,6 +204,12 @@ struct tuple_constructor<sequence<S...>>
     {
         return new T(std::get<S>(params)...);
     }
+
+    template <typename T, typename... Args>
+    static T *construct_at(void *where, std::tuple<Args...> &params)
+    {
+        return new (where) T(std::get<S>(params)...);
+    }
 };
 } // namespace impl
 
@@ -115,4 +219,11 @@ T *tuple_construct(std::tuple<Args...> &params)
     return impl::tuple_constructor<sequence_t<Args...>>::template construct<T>(params);
 }
 
+// placement version, constructs in caller provided storage
+template <typename T, typename... Args>
+T *tuple_construct_at(void *where, std::tuple<Args...> &params)
+{
+    return impl::tuple_constructor<sequence_t<Args...>>::template construct_at<T>(where, params);
+}
+
 } // namespace zlua
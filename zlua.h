@@ -1,6 +1,9 @@
 #pragma once
 #include "common.h"
 #include "engine.h"
+#include "executor.h"
+#include "pool.h"
+#include "schema.h"
 
 namespace zlua
 {